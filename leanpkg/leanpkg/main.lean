@@ -63,6 +63,7 @@ def test (lean_args : list string) := build lean_args >> make_test lean_args
 
 def init_gitignore_contents :=
 "*.olean
+*.icache
 /_target
 /leanpkg.path
 "
@@ -0,0 +1,11 @@
+prelude
+import init.data.nat.basic init.data.string.basic
+
+def lean.version : nat × nat × nat :=
+(3, 3, 1)
+
+def lean.githash : string :=
+"45080e24fa5694853f5cf6fec1128cb1ce60a8a6"
+
+def lean.is_release : bool :=
+0 ≠ 0
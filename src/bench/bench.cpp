@@ -0,0 +1,253 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "util/json.hpp"
+#include "init/init.h"
+#include "bench/bench.h"
+#include "githash.h" // NOLINT
+
+namespace lean {
+using json = nlohmann::json;
+
+second_duration bench_result::median() const {
+    if (m_samples.empty()) return second_duration(0);
+    std::vector<second_duration> s(m_samples);
+    std::sort(s.begin(), s.end());
+    unsigned n = s.size();
+    if (n % 2 == 1)
+        return s[n / 2];
+    else
+        return (s[n / 2 - 1] + s[n / 2]) / 2;
+}
+
+second_duration bench_result::min() const {
+    if (m_samples.empty()) return second_duration(0);
+    return *std::min_element(m_samples.begin(), m_samples.end());
+}
+
+second_duration bench_result::mean() const {
+    if (m_samples.empty()) return second_duration(0);
+    second_duration r(0);
+    for (second_duration const & d : m_samples)
+        r += d;
+    return r / m_samples.size();
+}
+
+second_duration bench_result::stddev() const {
+    if (m_samples.size() < 2) return second_duration(0);
+    double m = mean().count();
+    double r = 0;
+    for (second_duration const & d : m_samples)
+        r += (d.count() - m) * (d.count() - m);
+    return second_duration(std::sqrt(r / (m_samples.size() - 1)));
+}
+
+bool bench_runner::selected(std::string const & name) const {
+    return m_config.m_filter.empty() || name.find(m_config.m_filter) != std::string::npos;
+}
+
+void bench_runner::report(bench_result const & r) const {
+    std::cerr << r.m_name << ": ";
+    if (r.m_ok)
+        std::cerr << display_profiling_time{r.median()} << " (min " << display_profiling_time{r.min()}
+                  << ", " << r.m_samples.size() << "x" << r.m_iterations << ")\n";
+    else
+        std::cerr << "FAILED: " << r.m_error << "\n";
+}
+
+void bench_runner::micro(std::string const & name, std::function<void()> const & iteration) {
+    if (!selected(name)) return;
+    bench_result r;
+    r.m_name       = name;
+    r.m_kind       = "micro";
+    r.m_iterations = 1;
+    try {
+        /* calibrate: double the number of iterations until a sample takes long enough */
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < r.m_iterations; i++)
+                iteration();
+            second_duration d = std::chrono::steady_clock::now() - start;
+            if (d >= m_config.m_min_sample_time || r.m_iterations >= (1u << 30))
+                break;
+            r.m_iterations *= 2;
+        }
+        for (unsigned j = 0; j < m_config.m_samples; j++) {
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < r.m_iterations; i++)
+                iteration();
+            second_duration d = std::chrono::steady_clock::now() - start;
+            r.m_samples.push_back(d / r.m_iterations);
+        }
+    } catch (std::exception & ex) {
+        r.m_ok    = false;
+        r.m_error = ex.what();
+    }
+    report(r);
+    m_results.push_back(r);
+}
+
+static std::string quote(std::string const & s) {
+    return "'" + s + "'";
+}
+
+void bench_runner::macro(std::string const & name, std::string const & file, std::string const & args) {
+    if (!selected(name)) return;
+    bench_result r;
+    r.m_name       = name;
+    r.m_kind       = "macro";
+    r.m_iterations = 1;
+    std::string cmd;
+    if (!m_config.m_lean_path.empty())
+        cmd += "LEAN_PATH=" + quote(m_config.m_lean_path) + " ";
+    cmd += quote(m_config.m_lean) + " -j0 " + args + " " + quote(file) + " > /dev/null 2>&1";
+    for (unsigned j = 0; j < m_config.m_macro_runs; j++) {
+        auto start = std::chrono::steady_clock::now();
+        int status = std::system(cmd.c_str());
+        second_duration d = std::chrono::steady_clock::now() - start;
+        if (status != 0) {
+            r.m_ok    = false;
+            r.m_error = "command failed with status " + std::to_string(status) + ": " + cmd;
+            break;
+        }
+        r.m_samples.push_back(d);
+    }
+    report(r);
+    m_results.push_back(r);
+}
+
+void bench_runner::write_json(std::ostream & out) const {
+    json benchmarks = json::array();
+    for (bench_result const & r : m_results) {
+        json j;
+        j["name"]       = r.m_name;
+        j["kind"]       = r.m_kind;
+        j["status"]     = r.m_ok ? "ok" : "failed";
+        j["iterations"] = r.m_iterations;
+        j["samples"]    = r.m_samples.size();
+        if (r.m_ok) {
+            j["median"] = r.median().count();
+            j["min"]    = r.min().count();
+            j["mean"]   = r.mean().count();
+            j["stddev"] = r.stddev().count();
+        } else {
+            j["error"]  = r.m_error;
+        }
+        benchmarks.push_back(j);
+    }
+    json config;
+    config["samples"]         = m_config.m_samples;
+    config["macro_runs"]      = m_config.m_macro_runs;
+    config["min_sample_time"] = m_config.m_min_sample_time.count();
+#if defined(LEAN_MULTI_THREAD)
+    config["multi_thread"]    = true;
+#else
+    config["multi_thread"]    = false;
+#endif
+    json report;
+    report["version"]    = 1;
+    report["githash"]    = LEAN_GITHASH;
+    report["unit"]       = "seconds";
+    report["config"]     = config;
+    report["benchmarks"] = benchmarks;
+    out << report.dump(2) << "\n";
+}
+}
+
+using namespace lean; // NOLINT
+
+static void display_help(std::ostream & out) {
+    out << "Lean benchmark suite\n";
+    out << "Usage: lean_bench [options]\n";
+    out << "  --json=file        write the results to the given file in JSON format\n";
+    out << "  --filter=str       only run benchmarks whose name contains the given string\n";
+    out << "  --samples=num      number of samples for each micro-benchmark (default: 10)\n";
+    out << "  --runs=num         number of runs for each macro-benchmark (default: 3)\n";
+    out << "  --lean=path        lean executable used by the macro-benchmarks\n";
+    out << "  --lean-path=path   LEAN_PATH used by the macro-benchmarks\n";
+    out << "  --bench-dir=path   directory containing the macro-benchmark inputs (tests/bench)\n";
+    out << "  --tests-dir=path   directory containing the lean tests (tests/lean)\n";
+    out << "  --micro-only       only run the micro-benchmarks\n";
+    out << "  --macro-only       only run the macro-benchmarks\n";
+}
+
+static bool get_opt(char const * arg, char const * opt, std::string & val) {
+    size_t n = strlen(opt);
+    if (strncmp(arg, opt, n) == 0 && arg[n] == '=') {
+        val = arg + n + 1;
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char ** argv) {
+    bench_config cfg;
+    std::string json_file, val;
+    bool micro = true, macro = true;
+    for (int i = 1; i < argc; i++) {
+        char const * arg = argv[i];
+        if (get_opt(arg, "--json", val)) {
+            json_file = val;
+        } else if (get_opt(arg, "--filter", val)) {
+            cfg.m_filter = val;
+        } else if (get_opt(arg, "--samples", val)) {
+            cfg.m_samples = std::max(1, atoi(val.c_str()));
+        } else if (get_opt(arg, "--runs", val)) {
+            cfg.m_macro_runs = std::max(1, atoi(val.c_str()));
+        } else if (get_opt(arg, "--lean", val)) {
+            cfg.m_lean = val;
+        } else if (get_opt(arg, "--lean-path", val)) {
+            cfg.m_lean_path = val;
+        } else if (get_opt(arg, "--bench-dir", val)) {
+            cfg.m_bench_dir = val;
+        } else if (get_opt(arg, "--tests-dir", val)) {
+            cfg.m_tests_dir = val;
+        } else if (strcmp(arg, "--micro-only") == 0) {
+            macro = false;
+        } else if (strcmp(arg, "--macro-only") == 0) {
+            micro = false;
+        } else {
+            display_help(strcmp(arg, "--help") == 0 ? std::cout : std::cerr);
+            return strcmp(arg, "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (macro && cfg.m_lean.empty()) {
+        std::cerr << "lean_bench: macro-benchmarks require --lean=path (use --micro-only to skip them)\n";
+        return 1;
+    }
+
+    initializer init;
+    bench_runner runner(cfg);
+    bool ok = true;
+    try {
+        if (micro) {
+            run_micro_benchmarks(runner);
+            run_server_benchmarks(runner);
+        }
+        if (macro)
+            run_macro_benchmarks(runner);
+    } catch (std::exception & ex) {
+        std::cerr << "lean_bench: " << ex.what() << "\n";
+        ok = false;
+    }
+    ok = ok && std::all_of(runner.results().begin(), runner.results().end(),
+                           [](bench_result const & r) { return r.m_ok; });
+    if (json_file.empty()) {
+        runner.write_json(std::cout);
+    } else {
+        std::ofstream out(json_file);
+        runner.write_json(out);
+    }
+    return ok ? 0 : 1;
+}
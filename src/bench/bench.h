@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include "util/timeit.h"
+
+namespace lean {
+/** \brief Result of a benchmark: the duration of one iteration in each sample. */
+struct bench_result {
+    std::string                  m_name;
+    std::string                  m_kind;       // "micro" or "macro"
+    unsigned                     m_iterations; // iterations per sample
+    std::vector<second_duration> m_samples;    // time per iteration
+    bool                         m_ok = true;
+    std::string                  m_error;
+
+    second_duration median() const;
+    second_duration min() const;
+    second_duration mean() const;
+    second_duration stddev() const;
+};
+
+struct bench_config {
+    unsigned        m_samples     = 10;
+    unsigned        m_macro_runs  = 3;
+    second_duration m_min_sample_time = second_duration(0.02);
+    std::string     m_filter;
+    std::string     m_lean;        // lean executable used by the macro benchmarks
+    std::string     m_lean_path;   // LEAN_PATH for the macro benchmarks
+    std::string     m_bench_dir;   // directory containing the inputs of the macro benchmarks
+    std::string     m_tests_dir;   // tests/lean directory
+};
+
+/** \brief Runs benchmarks and collects the results.
+
+    Micro-benchmarks are functions executing one iteration. The number of iterations per sample is calibrated
+    such that a sample takes at least \c m_min_sample_time, then \c m_samples samples are measured.
+    Macro-benchmarks run the lean executable \c m_macro_runs times on an input file. */
+class bench_runner {
+    bench_config              m_config;
+    std::vector<bench_result> m_results;
+
+    bool selected(std::string const & name) const;
+    void report(bench_result const & r) const;
+public:
+    bench_runner(bench_config const & cfg):m_config(cfg) {}
+
+    bench_config const & config() const { return m_config; }
+    std::vector<bench_result> const & results() const { return m_results; }
+
+    /** \brief Run micro-benchmark \c name, \c iteration executes one iteration. */
+    void micro(std::string const & name, std::function<void()> const & iteration);
+    /** \brief Run the lean executable on \c file (with the given extra arguments). */
+    void macro(std::string const & name, std::string const & file, std::string const & args = std::string());
+
+    /** \brief Write the results as a JSON document. */
+    void write_json(std::ostream & out) const;
+};
+
+void run_micro_benchmarks(bench_runner & r);
+void run_macro_benchmarks(bench_runner & r);
+void run_server_benchmarks(bench_runner & r);
+}
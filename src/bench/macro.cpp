@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include "bench/bench.h"
+
+namespace lean {
+/* Files from tests/lean/run exercising the elaborator, the congruence closure module, and ematching. */
+static char const * g_run_tests[] = {
+    "rb_map1.lean",
+    "cc1.lean",
+    "cc2.lean",
+    "ematch1.lean",
+    "simp_lemmas_with_mvars.lean",
+    "smt_destruct.lean",
+    nullptr
+};
+
+/* Tactic heavy files from tests/lean/run, most of their time is spent in the VM. */
+static char const * g_vm_tests[] = {
+    "comp_val1.lean",
+    "norm_num_tst.lean",
+    "conv_tac1.lean",
+    "smt_ematch2.lean",
+    nullptr
+};
+
+/* Run a VM heavy benchmark. When the threaded interpreter is available, it is compared with the switch-based one. */
+static void vm_macro(bench_runner & r, std::string const & name, std::string const & file) {
+#if defined(LEAN_THREADED_VM)
+    r.macro("vm/threaded/" + name, file);
+    r.macro("vm/switch/" + name, file, "-D vm.threaded=false");
+#else
+    r.macro("vm/switch/" + name, file);
+#endif
+}
+
+void run_macro_benchmarks(bench_runner & r) {
+    bench_config const & cfg = r.config();
+    if (!cfg.m_bench_dir.empty()) {
+        r.macro("import/init", cfg.m_bench_dir + "/import_init.lean");
+        r.macro("elab/tc_storm", cfg.m_bench_dir + "/tc_storm.lean");
+        r.macro("elab/simp_large", cfg.m_bench_dir + "/simp_large.lean");
+        vm_macro(r, "eval", cfg.m_bench_dir + "/vm_eval.lean");
+        vm_macro(r, "nat", cfg.m_bench_dir + "/vm_nat.lean");
+    }
+    if (!cfg.m_tests_dir.empty()) {
+        for (unsigned i = 0; g_run_tests[i]; i++)
+            r.macro(std::string("elab/run/") + g_run_tests[i], cfg.m_tests_dir + "/run/" + g_run_tests[i]);
+        for (unsigned i = 0; g_vm_tests[i]; i++)
+            vm_macro(r, std::string("run/") + g_vm_tests[i], cfg.m_tests_dir + "/run/" + g_vm_tests[i]);
+    }
+}
+}
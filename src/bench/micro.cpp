@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include <vector>
+#include "util/buffer.h"
+#include "util/exception.h"
+#include "kernel/expr.h"
+#include "kernel/level.h"
+#include "kernel/abstract.h"
+#include "kernel/instantiate.h"
+#include "kernel/replace_fn.h"
+#include "kernel/environment.h"
+#include "kernel/type_checker.h"
+#include "kernel/standard_kernel.h"
+#include "library/module.h"
+#include "bench/bench.h"
+
+namespace lean {
+static expr mk_const(char const * prefix, unsigned i) {
+    return mk_constant(name(prefix).append_after(i));
+}
+
+/* Remark: the results of the benchmarked operations are stored in variables declared outside of the iterations
+   to make sure they are not optimized away. */
+static void bench_mk_app(bench_runner & r) {
+    expr f = Const("f");
+    buffer<expr> args;
+    for (unsigned i = 0; i < 1000; i++)
+        args.push_back(mk_const("a", i));
+    expr result;
+    r.micro("mk_app/1000_args", [&]() {
+            result = mk_app(f, args);
+        });
+}
+
+/* Return the locals of a telescope (x_1 : A) ... (x_n : A), and the body (f x_1 ... x_n). */
+static expr mk_telescope(unsigned n, buffer<expr> & locals) {
+    expr A = Const("A");
+    for (unsigned i = 0; i < n; i++)
+        locals.push_back(mk_local(name("x").append_after(i), A));
+    return mk_app(Const("f"), locals);
+}
+
+static void bench_abstract_instantiate(bench_runner & r) {
+    buffer<expr> locals;
+    expr body = mk_telescope(500, locals);
+    expr result;
+    r.micro("abstract/pi_500_binders", [&]() {
+            result = Pi(locals, body, false);
+        });
+    expr abst = abstract_locals(body, locals.size(), locals.data());
+    buffer<expr> vals;
+    for (unsigned i = 0; i < locals.size(); i++)
+        vals.push_back(mk_const("b", i));
+    r.micro("instantiate_rev/500_vars", [&]() {
+            result = instantiate_rev(abst, vals.size(), vals.data());
+        });
+    /* Instantiate the binders of a Pi one at a time, as done when entering a telescope. */
+    expr pi = Pi(locals, body);
+    r.micro("instantiate/pi_500_binders", [&]() {
+            expr e = pi;
+            unsigned i = 0;
+            while (is_pi(e)) {
+                e = instantiate(binding_body(e), vals[i]);
+                i++;
+            }
+            result = e;
+        });
+}
+
+/* Create a complete binary tree of applications of depth \c d. When \c shared is true, the subtrees are shared. */
+static expr mk_app_tree(unsigned d, bool shared, unsigned & leaf) {
+    if (d == 0)
+        return mk_const("c", leaf++ % 16);
+    if (shared) {
+        expr t = mk_app_tree(d - 1, shared, leaf);
+        return mk_app(Const("g"), t, t);
+    } else {
+        expr t1 = mk_app_tree(d - 1, shared, leaf);
+        expr t2 = mk_app_tree(d - 1, shared, leaf);
+        return mk_app(Const("g"), t1, t2);
+    }
+}
+
+static void bench_expr_eq(bench_runner & r) {
+    /* Disable caching, otherwise the two trees would share their nodes. */
+    scoped_expr_caching no_caching(false);
+    unsigned leaf1 = 0, leaf2 = 0;
+    expr t1 = mk_app_tree(14, false, leaf1);
+    expr t2 = mk_app_tree(14, false, leaf2);
+    bool eq = true;
+    r.micro("expr_eq/unshared_tree_depth_14", [&]() {
+            eq = eq && is_equal(t1, t2);
+        });
+    leaf1 = leaf2 = 0;
+    expr s1 = mk_app_tree(100, true, leaf1);
+    expr s2 = mk_app_tree(100, true, leaf2);
+    r.micro("expr_eq/shared_dag_depth_100", [&]() {
+            eq = eq && is_equal(s1, s2);
+        });
+    if (!eq)
+        throw exception("expr_eq benchmark: terms are not equal");
+}
+
+static void bench_replace(bench_runner & r) {
+    unsigned leaf = 0;
+    expr dag = mk_app_tree(16, true, leaf);
+    expr c0  = mk_const("c", 0);
+    expr d   = Const("d");
+    auto fn  = [&](expr const & e) {
+        if (e == c0) return some_expr(d);
+        return none_expr();
+    };
+    expr result;
+    r.micro("replace/cache/shared_dag_depth_16", [&]() {
+            result = replace(dag, fn, true);
+        });
+    r.micro("replace/no_cache/shared_dag_depth_16", [&]() {
+            result = replace(dag, fn, false);
+        });
+}
+
+static void bench_level_normalize(bench_runner & r) {
+    level l = mk_level_zero();
+    for (unsigned i = 0; i < 200; i++) {
+        level p = mk_param_univ(name("u").append_after(i % 20));
+        for (unsigned j = 0; j < i % 5; j++)
+            p = mk_succ(p);
+        l = i % 2 == 0 ? mk_max(l, p) : mk_max(p, mk_succ(l));
+    }
+    level result;
+    r.micro("level/normalize_max_200", [&]() {
+            result = normalize(l);
+        });
+}
+
+static environment add_decl(environment const & env, declaration const & d) {
+    return env.add(check(env, d));
+}
+
+/* Definitions f_0 := fun x, x, and f_{i+1} := fun x, f_i x */
+static environment add_delta_chain(environment env, char const * prefix, unsigned n, expr const & A) {
+    expr x = mk_local("x", A);
+    env = add_decl(env, mk_definition(env, name(prefix).append_after(0u), level_param_names(),
+                                      Pi(x, A), Fun(x, x)));
+    for (unsigned i = 1; i < n; i++)
+        env = add_decl(env, mk_definition(env, name(prefix).append_after(i), level_param_names(), Pi(x, A),
+                                          Fun(x, mk_app(mk_const(prefix, i - 1), x))));
+    return env;
+}
+
+static void bench_type_checker(bench_runner & r) {
+    unsigned n = 200;
+    environment env;
+    expr A = Const("A");
+    env = add_decl(env, mk_axiom("A", level_param_names(), mk_Type()));
+    env = add_decl(env, mk_axiom("c", level_param_names(), A));
+    env = add_delta_chain(env, "f", n, A);
+    env = add_delta_chain(env, "g", n, A);
+    expr c  = Const("c");
+    expr fc = mk_app(mk_const("f", n - 1), c);
+    expr gc = mk_app(mk_const("g", n - 1), c);
+    expr result;
+    bool eq = true;
+    r.micro("type_checker/whnf_delta_chain_200", [&]() {
+            type_checker tc(env);
+            result = tc.whnf(fc);
+        });
+    r.micro("type_checker/is_def_eq_delta_chain_200", [&]() {
+            type_checker tc(env);
+            eq = eq && tc.is_def_eq(fc, gc);
+        });
+    if (!eq)
+        throw exception("type_checker benchmark: terms are not definitionally equal");
+    r.micro("type_checker/check_delta_chain_200", [&]() {
+            type_checker tc(env);
+            result = tc.check(fc);
+        });
+}
+
+/* Kernel type checking throughput: check again a sample of the declarations imported from the standard library.
+   Each declaration is checked using a fresh type checker, as done when it is added to the environment. */
+static void bench_check_imported(bench_runner & r) {
+    bench_config const & cfg = r.config();
+    if (cfg.m_lean_path.empty())
+        return;
+    environment env = import_modules(mk_environment(), "bench", {module_name(name("init"))},
+                                     mk_olean_loader({cfg.m_lean_path}));
+    buffer<declaration> decls;
+    unsigned i = 0;
+    env.for_each_declaration([&](declaration const & d) {
+            if (d.is_trusted() && i++ % 64 == 0)
+                decls.push_back(d);
+        });
+    expr result;
+    r.micro("type_checker/check_imported/init", [&]() {
+            for (declaration const & d : decls) {
+                type_checker tc(env);
+                result = tc.check(d.get_type(), d.get_univ_params());
+                if (d.is_definition())
+                    result = tc.check(d.get_value(), d.get_univ_params());
+            }
+        });
+}
+
+void run_micro_benchmarks(bench_runner & r) {
+    bench_mk_app(r);
+    bench_abstract_instantiate(r);
+    bench_expr_eq(r);
+    bench_replace(r);
+    bench_level_normalize(r);
+    bench_type_checker(r);
+    bench_check_imported(r);
+}
+}
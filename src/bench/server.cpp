@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include <vector>
+#include "kernel/standard_kernel.h"
+#include "library/module.h"
+#include "library/decl_name_index.h"
+#include "frontends/lean/completion.h"
+#include "bench/bench.h"
+
+namespace lean {
+#if defined(LEAN_JSON)
+/* Modules imported by the environment used to benchmark the server commands. */
+static char const * g_server_imports[] = {
+    "init", "data.buffer.parser", "data.rbmap", "data.vector", "data.bitvec", "data.lazy_list", "data.stream",
+    nullptr
+};
+
+/* Patterns of different lengths, the index cannot be used for the first one (see decl_name_index::find_candidates). */
+static char const * g_server_patterns[] = { "a", "succ", "add_comm", "list.length_map", nullptr };
+
+static void bench_decl_queries(bench_runner & r, char const * kind, environment const & env) {
+    options opts;
+    std::vector<json> result;
+    std::vector<pair<std::string, environment>> envs = {{"bench", env}};
+    for (unsigned i = 0; g_server_patterns[i]; i++) {
+        std::string pattern = g_server_patterns[i];
+        r.micro(std::string("server/complete/") + kind + "/" + pattern, [&]() {
+                result = get_decl_completions(pattern, env, opts);
+            });
+        r.micro(std::string("server/search/") + kind + "/" + pattern, [&]() {
+                result.clear();
+                search_decls(pattern, envs, opts, result);
+            });
+    }
+}
+
+/* Latency of the `complete` and `search` server commands, with and without the declaration name index. */
+void run_server_benchmarks(bench_runner & r) {
+    bench_config const & cfg = r.config();
+    if (cfg.m_lean_path.empty())
+        return;
+    std::vector<module_name> imports;
+    for (unsigned i = 0; g_server_imports[i]; i++)
+        imports.push_back(module_name(string_to_name(g_server_imports[i])));
+    environment env = import_modules(mk_environment(), "bench", imports, mk_olean_loader({cfg.m_lean_path}));
+    decl_name_index & idx = get_decl_name_index();
+    idx.clear();
+    bench_decl_queries(r, "scan", env);
+    buffer<name> ns;
+    env.for_each_declaration([&](declaration const & d) { ns.push_back(d.get_name()); });
+    idx.insert(ns);
+    bench_decl_queries(r, "index", env);
+    idx.clear();
+}
+#else
+void run_server_benchmarks(bench_runner &) {}
+#endif
+}
@@ -5,6 +5,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Gabriel Ebner
 */
 #include <fstream>
+#include <cstring>
+#include <cstdlib>
 #include "kernel/init_module.h"
 #include "util/init_module.h"
 #include "util/test.h"
@@ -87,8 +89,19 @@ int main(int argc, char ** argv) {
         });
 #endif
 
-    if (argc < 2) {
-        std::cout << "usage: leanchecker export.out lemma_to_print" << std::endl;
+    unsigned num_threads = 0;
+    int first_arg = 1;
+    if (first_arg < argc && strncmp(argv[first_arg], "-j", 2) == 0) {
+        if (argv[first_arg][2]) {
+            num_threads = atoi(argv[first_arg] + 2);
+        } else if (first_arg + 1 < argc) {
+            num_threads = atoi(argv[++first_arg]);
+        }
+        first_arg++;
+    }
+
+    if (argc < first_arg + 1) {
+        std::cout << "usage: leanchecker [-j num_threads] export.out lemma_to_print" << std::endl;
         return 1;
     }
 
@@ -119,16 +132,15 @@ int main(int argc, char ** argv) {
     });
 
     try {
-        std::ifstream in(argv[1]);
-        if (!in) throw exception(sstream() << "file not found: " << argv[1]);
+        if (!std::ifstream(argv[first_arg])) throw exception(sstream() << "file not found: " << argv[first_arg]);
 
         unsigned trust_lvl = 0;
         auto env = mk_environment(trust_lvl);
         lowlevel_notations notations;
-        import_from_text(in, env, notations);
+        import_from_text(argv[first_arg], env, notations, num_threads);
 
         buffer<name> to_print;
-        for (int i = 2; i < argc; i++)
+        for (int i = first_arg + 1; i < argc; i++)
             to_print.push_back(string_to_name(argv[i]));
 
         checker_print_fn(std::cout, env, notations).handle_cmdline_args(to_print);
@@ -8,97 +8,210 @@ Author: Gabriel Ebner
 #include "kernel/environment.h"
 #include "kernel/inductive/inductive.h"
 #include "kernel/type_checker.h"
+#include "kernel/for_each_fn.h"
 #include "util/sstream.h"
+#include "util/thread.h"
+#include "util/mapped_file.h"
+#include <cstring>
+#include <algorithm>
 #include <string>
+#include <vector>
+#include <memory>
 #include <iostream>
 #include <unordered_map>
 #include "kernel/quotient/quotient.h"
 
 namespace lean {
 
+/* Hand-written tokenizer for a line of the export file. */
+class line_tokenizer {
+    char const * m_curr;
+    char const * m_end;
+
+    void skip_spaces() {
+        while (m_curr != m_end && (*m_curr == ' ' || *m_curr == '\t' || *m_curr == '\r'))
+            m_curr++;
+    }
+
+    static bool is_digit(char c) { return '0' <= c && c <= '9'; }
+
+public:
+    struct token {
+        char const * m_begin;
+        char const * m_end;
+
+        bool operator==(char const * s) const {
+            size_t len = m_end - m_begin;
+            return strncmp(m_begin, s, len) == 0 && s[len] == 0;
+        }
+        bool is_number() const { return m_begin != m_end && is_digit(*m_begin); }
+        std::string str() const { return std::string(m_begin, m_end); }
+    };
+
+    line_tokenizer(char const * begin, char const * end) : m_curr(begin), m_end(end) {}
+
+    /* \brief Return the next whitespace-delimited token, the token is empty at the end of the line. */
+    token next_token() {
+        skip_spaces();
+        char const * begin = m_curr;
+        while (m_curr != m_end && *m_curr != ' ' && *m_curr != '\t' && *m_curr != '\r')
+            m_curr++;
+        return token{begin, m_curr};
+    }
+
+    bool try_read_unsigned(unsigned & r) {
+        skip_spaces();
+        if (m_curr == m_end || !is_digit(*m_curr))
+            return false;
+        r = 0;
+        while (m_curr != m_end && is_digit(*m_curr)) {
+            r = 10 * r + (*m_curr - '0');
+            m_curr++;
+        }
+        return true;
+    }
+
+    unsigned read_unsigned() {
+        unsigned r;
+        if (!try_read_unsigned(r))
+            throw exception("unsigned integer expected");
+        return r;
+    }
+
+    /* \brief Return the rest of the line, without the separator after the last token. */
+    std::string read_rest() {
+        if (m_curr != m_end) m_curr++;
+        return std::string(m_curr, m_end);
+    }
+};
+
+/* Table of the objects defined in the export file, indexed by their (dense) ids. */
+template<class T>
+class dense_table {
+    char const *      m_kind;
+    std::vector<T>    m_values;
+    std::vector<bool> m_defined;
+public:
+    explicit dense_table(char const * kind) : m_kind(kind) {}
+
+    void set(unsigned idx, T const & v) {
+        if (idx >= m_values.size()) {
+            m_values.resize(idx + 1);
+            m_defined.resize(idx + 1, false);
+        }
+        m_values[idx]  = v;
+        m_defined[idx] = true;
+    }
+
+    T const & at(unsigned idx) const {
+        if (idx >= m_values.size() || !m_defined[idx])
+            throw exception(sstream() << "unknown " << m_kind << " index " << idx);
+        return m_values[idx];
+    }
+};
+
+/* Declaration of the export file, declarations are added to the environment in the order of the file. */
+struct export_decl {
+    enum class kind { Inductive, Definition, Axiom, Quotient };
+    kind                            m_kind;
+    unsigned                        m_line;
+    name                            m_name;
+    level_param_names               m_ls;
+    expr                            m_type;
+    expr                            m_value;
+    inductive::inductive_decl       m_ind;
+
+    /* result of type checking definitions and axioms */
+    optional<certified_declaration> m_certified;
+    std::exception_ptr              m_error;
+    bool                            m_checked = false;
+
+    export_decl(kind k, unsigned line) : m_kind(k), m_line(line) {}
+};
+
 struct text_importer {
-    std::unordered_map<unsigned, expr> m_expr;
-    std::unordered_map<unsigned, name> m_name;
-    std::unordered_map<unsigned, level> m_level;
+    dense_table<expr>  m_expr;
+    dense_table<name>  m_name;
+    dense_table<level> m_level;
 
     lowlevel_notations m_notations;
 
-    environment m_env;
+    std::vector<export_decl> m_decls;
+    unsigned m_line_num = 0;
 
-    text_importer(environment const & env) : m_env(env) {
-        m_level[0] = {};
-        m_name[0] = {};
+    text_importer() : m_expr("expression"), m_name("name"), m_level("universe level") {
+        m_level.set(0, level());
+        m_name.set(0, name());
     }
 
-    levels read_levels(std::istream & in) {
+    levels read_levels(line_tokenizer & in) {
         unsigned idx;
         buffer<level> ls;
-        while (in >> idx) {
+        while (in.try_read_unsigned(idx)) {
             ls.push_back(m_level.at(idx));
         }
         return to_list(ls);
     }
 
-    level_param_names read_level_params(std::istream & in) {
+    level_param_names read_level_params(line_tokenizer & in) {
         unsigned idx;
         buffer<name> ls;
-        while (in >> idx) {
+        while (in.try_read_unsigned(idx)) {
             ls.push_back(m_name.at(idx));
         }
         return to_list(ls);
     }
 
-    void handle_ind(std::istream & in) {
-        unsigned num_params, name_idx, type_idx, num_intros;
-        in >> num_params >> name_idx >> type_idx >> num_intros;
+    void handle_ind(line_tokenizer & in) {
+        unsigned num_params = in.read_unsigned();
+        unsigned name_idx   = in.read_unsigned();
+        unsigned type_idx   = in.read_unsigned();
+        unsigned num_intros = in.read_unsigned();
 
         buffer<inductive::intro_rule> intros;
         for (unsigned i = 0; i < num_intros; i++) {
-            unsigned name_idx, type_idx; in >> name_idx >> type_idx;
+            unsigned name_idx = in.read_unsigned();
+            unsigned type_idx = in.read_unsigned();
             intros.push_back(inductive::mk_intro_rule(m_name.at(name_idx), m_expr.at(type_idx)));
         }
 
         auto ls = read_level_params(in);
 
-        inductive::inductive_decl decl(m_name.at(name_idx), ls, num_params, m_expr.at(type_idx), to_list(intros));
-        m_env = inductive::add_inductive(m_env, decl, true).first;
+        export_decl d(export_decl::kind::Inductive, m_line_num);
+        d.m_ind = inductive::inductive_decl(m_name.at(name_idx), ls, num_params, m_expr.at(type_idx), to_list(intros));
+        m_decls.push_back(d);
     }
 
-    void handle_def(std::istream & in) {
-        unsigned name_idx, type_idx, val_idx;
-        in >> name_idx >> type_idx >> val_idx;
-        auto ls = read_level_params(in);
-
-        auto decl =
-            type_checker(m_env).is_prop(m_expr.at(type_idx)) ?
-                mk_theorem(m_name.at(name_idx), ls, m_expr.at(type_idx), m_expr.at(val_idx)) :
-                mk_definition(m_env, m_name.at(name_idx), ls, m_expr.at(type_idx), m_expr.at(val_idx), true, true);
-
-        m_env = m_env.add(check(m_env, decl, true));
+    void handle_def(line_tokenizer & in) {
+        unsigned name_idx = in.read_unsigned();
+        unsigned type_idx = in.read_unsigned();
+        unsigned val_idx  = in.read_unsigned();
+        export_decl d(export_decl::kind::Definition, m_line_num);
+        d.m_ls    = read_level_params(in);
+        d.m_name  = m_name.at(name_idx);
+        d.m_type  = m_expr.at(type_idx);
+        d.m_value = m_expr.at(val_idx);
+        m_decls.push_back(d);
     }
 
-    void handle_ax(std::istream & in) {
-        unsigned name_idx, type_idx;
-        in >> name_idx >> type_idx;
-        auto ls = read_level_params(in);
-        m_env = m_env.add(check(m_env, mk_axiom(m_name.at(name_idx), ls, m_expr.at(type_idx))));
+    void handle_ax(line_tokenizer & in) {
+        unsigned name_idx = in.read_unsigned();
+        unsigned type_idx = in.read_unsigned();
+        export_decl d(export_decl::kind::Axiom, m_line_num);
+        d.m_ls   = read_level_params(in);
+        d.m_name = m_name.at(name_idx);
+        d.m_type = m_expr.at(type_idx);
+        m_decls.push_back(d);
     }
 
-    void handle_notation(std::istream & in, lowlevel_notation_kind kind) {
-        unsigned name_idx, prec;
-        in >> name_idx >> prec;
-
-        std::string token;
-        std::getline(in, token);
-        if (!token.empty() && token.front())
-            token.erase(token.begin());
-        if (!token.empty() && token.back() == '\n')
-            token.erase(token.end() - 1);
-
+    void handle_notation(line_tokenizer & in, lowlevel_notation_kind kind) {
+        unsigned name_idx = in.read_unsigned();
+        unsigned prec     = in.read_unsigned();
+        std::string token = in.read_rest();
         m_notations[m_name.at(name_idx)] = { kind, token, prec };
     }
 
-    binder_info read_binder_info(std::string const & tok) {
+    binder_info read_binder_info(line_tokenizer::token const & tok) {
         if (tok == "#BI") {
             return mk_implicit_binder_info();
         } else if (tok == "#BS") {
@@ -108,16 +221,14 @@ struct text_importer {
         } else if (tok == "#BD") {
             return {};
         } else {
-            throw exception(sstream() << "unknown binder info: " << tok);
+            throw exception(sstream() << "unknown binder info: " << tok.str());
         }
     }
 
-    void handle_line(std::string const & line) {
-        std::istringstream in(line);
+    void handle_line(char const * begin, char const * end) {
+        line_tokenizer in(begin, end);
 
-        unsigned idx;
-        std::string cmd;
-        in >> cmd;
+        auto cmd = in.next_token();
         if (cmd == "#IND") {
             handle_ind(in);
         } else if (cmd == "#DEF") {
@@ -125,83 +236,267 @@ struct text_importer {
         } else if (cmd == "#AX") {
             handle_ax(in);
         } else if (cmd == "#QUOT") {
-            m_env = declare_quotient(m_env);
+            m_decls.push_back(export_decl(export_decl::kind::Quotient, m_line_num));
         } else if (cmd == "#PREFIX") {
             handle_notation(in, lowlevel_notation_kind::Prefix);
         } else if (cmd == "#POSTFIX") {
             handle_notation(in, lowlevel_notation_kind::Postfix);
         } else if (cmd == "#INFIX") {
             handle_notation(in, lowlevel_notation_kind::Infix);
-        } else if (std::istringstream(cmd) >> idx) {
-            std::string kind;
-            in >> kind;
+        } else if (cmd.is_number()) {
+            unsigned idx = line_tokenizer(cmd.m_begin, cmd.m_end).read_unsigned();
+            auto kind = in.next_token();
 
             if (kind == "#NS") {
-                unsigned p; std::string limb; in >> p >> std::skipws >> limb;
-                m_name[idx] = name(m_name.at(p), limb.c_str());
+                unsigned p = in.read_unsigned(); std::string limb = in.next_token().str();
+                m_name.set(idx, name(m_name.at(p), limb.c_str()));
             } else if (kind == "#NI") {
-                unsigned p, limb; in >> p >> limb;
-                m_name[idx] = name(m_name.at(p), limb);
+                unsigned p = in.read_unsigned(); unsigned limb = in.read_unsigned();
+                m_name.set(idx, name(m_name.at(p), limb));
             } else if (kind == "#US") {
-                unsigned l1; in >> l1;
-                m_level[idx] = mk_succ(m_level.at(l1));
+                unsigned l1 = in.read_unsigned();
+                m_level.set(idx, mk_succ(m_level.at(l1)));
             } else if (kind == "#UM") {
-                unsigned l1, l2; in >> l1 >> l2;
-                m_level[idx] = mk_max(m_level.at(l1), m_level.at(l2));
+                unsigned l1 = in.read_unsigned(); unsigned l2 = in.read_unsigned();
+                m_level.set(idx, mk_max(m_level.at(l1), m_level.at(l2)));
             } else if (kind == "#UIM") {
-                unsigned l1, l2; in >> l1 >> l2;
-                m_level[idx] = mk_imax(m_level.at(l1), m_level.at(l2));
+                unsigned l1 = in.read_unsigned(); unsigned l2 = in.read_unsigned();
+                m_level.set(idx, mk_imax(m_level.at(l1), m_level.at(l2)));
             } else if (kind == "#UP") {
-                unsigned i1; in >> i1;
-                m_level[idx] = mk_param_univ(m_name.at(i1));
+                unsigned i1 = in.read_unsigned();
+                m_level.set(idx, mk_param_univ(m_name.at(i1)));
             } else if (kind == "#EV") {
-                unsigned v; in >> v;
-                m_expr[idx] = mk_var(v);
+                unsigned v = in.read_unsigned();
+                m_expr.set(idx, mk_var(v));
             } else if (kind == "#ES") {
-                unsigned l; in >> l;
-                m_expr[idx] = mk_sort(m_level.at(l));
+                unsigned l = in.read_unsigned();
+                m_expr.set(idx, mk_sort(m_level.at(l)));
             } else if (kind == "#EC") {
-                unsigned n; in >> n;
+                unsigned n = in.read_unsigned();
                 auto ls = read_levels(in);
-                m_expr[idx] = mk_constant(m_name.at(n), ls);
+                m_expr.set(idx, mk_constant(m_name.at(n), ls));
             } else if (kind == "#EA") {
-                unsigned e1, e2; in >> e1 >> e2;
-                m_expr[idx] = mk_app(m_expr.at(e1), m_expr.at(e2));
+                unsigned e1 = in.read_unsigned(); unsigned e2 = in.read_unsigned();
+                m_expr.set(idx, mk_app(m_expr.at(e1), m_expr.at(e2)));
             } else if (kind == "#EZ") {
-                unsigned n, t, v, b; in >> n >> t >> v >> b;
-                m_expr[idx] = mk_let(m_name.at(n), m_expr.at(t), m_expr.at(v), m_expr.at(b));
+                unsigned n = in.read_unsigned(); unsigned t = in.read_unsigned();
+                unsigned v = in.read_unsigned(); unsigned b = in.read_unsigned();
+                m_expr.set(idx, mk_let(m_name.at(n), m_expr.at(t), m_expr.at(v), m_expr.at(b)));
             } else if (kind == "#EL") {
-                unsigned n, t, e; std::string b; in >> b >> n >> t >> e;
-                m_expr[idx] = mk_lambda(m_name.at(n), m_expr.at(t), m_expr.at(e), read_binder_info(b));
+                auto b = in.next_token();
+                unsigned n = in.read_unsigned(); unsigned t = in.read_unsigned(); unsigned e = in.read_unsigned();
+                m_expr.set(idx, mk_lambda(m_name.at(n), m_expr.at(t), m_expr.at(e), read_binder_info(b)));
             } else if (kind == "#EP") {
-                unsigned n, t, e; std::string b; in >> b >> n >> t >> e;
-                m_expr[idx] = mk_pi(m_name.at(n), m_expr.at(t), m_expr.at(e), read_binder_info(b));
+                auto b = in.next_token();
+                unsigned n = in.read_unsigned(); unsigned t = in.read_unsigned(); unsigned e = in.read_unsigned();
+                m_expr.set(idx, mk_pi(m_name.at(n), m_expr.at(t), m_expr.at(e), read_binder_info(b)));
             } else {
-                throw exception(sstream() << "unknown term definition kind: " << kind);
+                throw exception(sstream() << "unknown term definition kind: " << kind.str());
             }
         } else {
-            throw exception(sstream() << "unknown command: " << cmd);
+            throw exception(sstream() << "unknown command: " << cmd.str());
+        }
+    }
+};
+
+static exception at_line(unsigned line_num, char const * msg) {
+    return exception(sstream() << "line " << line_num << ": " << msg);
+}
+
+/* Type check definitions and axioms, and add the declarations to the environment in order.
+
+   The i-th declaration is type checked in the environment obtained after adding the first k declarations,
+   where k is the smallest number such that these declarations contain all constants used by the i-th
+   declaration. Since such an environment is an ancestor of the environment the declaration is added to,
+   the certified declaration can be added to the latter. Thus a worker thread can start type checking a
+   declaration as soon as its dependencies have been added, while other declarations are still being checked.
+   Inductive types and the quotient are checked and added by the main thread. */
+class export_checker {
+    std::vector<export_decl> &            m_decls;
+    std::vector<optional<environment>>    m_envs; // m_envs[k] is the environment containing the first k declarations
+    std::unordered_map<name, unsigned, name_hash> m_decl_of; // constant name -> index of the declaration introducing it
+
+    mutex                                 m_mutex;
+    condition_variable                    m_added_cv;
+    condition_variable                    m_checked_cv;
+    unsigned                              m_num_added = 0;
+    bool                                  m_failed = false;
+    atomic<unsigned>                      m_next_decl;
+
+    void register_constant(name const & n, unsigned i) {
+        m_decl_of.insert(std::make_pair(n, i));
+    }
+
+    /* Return k such that the first k declarations contain all constants used by the i-th declaration. */
+    unsigned get_num_deps(unsigned i) {
+        export_decl const & d = m_decls[i];
+        unsigned r = 0;
+        auto visit = [&](expr const & e, unsigned) {
+            if (r == i) return false;
+            if (is_constant(e)) {
+                auto it = m_decl_of.find(const_name(e));
+                /* unknown constants are reported by the type checker in the current environment */
+                r = std::max(r, it == m_decl_of.end() || it->second >= i ? i : it->second + 1);
+            }
+            return true;
+        };
+        for_each(d.m_type, visit);
+        if (d.m_kind == export_decl::kind::Definition)
+            for_each(d.m_value, visit);
+        return r;
+    }
+
+    static void certify(environment const & env, export_decl & d) {
+        try {
+            if (d.m_kind == export_decl::kind::Definition) {
+                auto decl =
+                    type_checker(env).is_prop(d.m_type) ?
+                        mk_theorem(d.m_name, d.m_ls, d.m_type, d.m_value) :
+                        mk_definition(env, d.m_name, d.m_ls, d.m_type, d.m_value, true, true);
+                d.m_certified = check(env, decl, true);
+            } else {
+                d.m_certified = check(env, mk_axiom(d.m_name, d.m_ls, d.m_type));
+            }
+        } catch (throwable & ex) {
+            d.m_error = std::make_exception_ptr(at_line(d.m_line, ex.what()));
+        } catch (std::exception & ex) {
+            d.m_error = std::make_exception_ptr(at_line(d.m_line, ex.what()));
+        }
+    }
+
+    void worker() {
+        save_stack_info(false);
+        while (true) {
+            unsigned i = m_next_decl++;
+            if (i >= m_decls.size()) break;
+            export_decl & d = m_decls[i];
+            if (d.m_kind != export_decl::kind::Definition && d.m_kind != export_decl::kind::Axiom)
+                continue;
+            unsigned num_deps = get_num_deps(i);
+            optional<environment> env;
+            {
+                unique_lock<mutex> lock(m_mutex);
+                m_added_cv.wait(lock, [&] { return m_num_added >= num_deps || m_failed; });
+                if (m_failed) break;
+                env = m_envs[num_deps];
+            }
+            certify(*env, d);
+            {
+                lock_guard<mutex> lock(m_mutex);
+                d.m_checked = true;
+            }
+            m_checked_cv.notify_all();
+        }
+    }
+
+    environment add(environment const & env, export_decl & d, bool parallel) {
+        try {
+            switch (d.m_kind) {
+            case export_decl::kind::Inductive:
+                return inductive::add_inductive(env, d.m_ind, true).first;
+            case export_decl::kind::Quotient:
+                return declare_quotient(env);
+            case export_decl::kind::Definition: case export_decl::kind::Axiom:
+                if (parallel) {
+                    unique_lock<mutex> lock(m_mutex);
+                    m_checked_cv.wait(lock, [&] { return d.m_checked; });
+                } else {
+                    certify(env, d);
+                }
+                if (d.m_error)
+                    std::rethrow_exception(d.m_error);
+                return env.add(*d.m_certified);
+            }
+        } catch (throwable & ex) {
+            if (d.m_error) throw;
+            throw at_line(d.m_line, ex.what());
+        } catch (std::exception & ex) {
+            throw at_line(d.m_line, ex.what());
+        }
+        lean_unreachable();
+    }
+
+public:
+    export_checker(std::vector<export_decl> & decls) : m_decls(decls), m_envs(decls.size() + 1), m_next_decl(0) {
+        for (unsigned i = 0; i < m_decls.size(); i++) {
+            export_decl const & d = m_decls[i];
+            switch (d.m_kind) {
+            case export_decl::kind::Inductive:
+                register_constant(d.m_ind.m_name, i);
+                register_constant(inductive::get_elim_name(d.m_ind.m_name), i);
+                for (auto & ir : d.m_ind.m_intro_rules)
+                    register_constant(inductive::intro_rule_name(ir), i);
+                break;
+            case export_decl::kind::Quotient:
+                register_constant("quot", i);
+                register_constant(name("quot", "mk"), i);
+                register_constant(name("quot", "lift"), i);
+                register_constant(name("quot", "ind"), i);
+                break;
+            case export_decl::kind::Definition: case export_decl::kind::Axiom:
+                register_constant(d.m_name, i);
+                break;
+            }
+        }
+    }
+
+    environment operator()(environment env, unsigned num_threads) {
+#if !defined(LEAN_MULTI_THREAD)
+        num_threads = 0;
+#endif
+        m_envs[0] = env;
+        std::vector<std::unique_ptr<lthread>> workers;
+        for (unsigned i = 0; i < num_threads; i++)
+            workers.emplace_back(new lthread([this] { worker(); }));
+        auto stop_workers = [&] {
+            {
+                lock_guard<mutex> lock(m_mutex);
+                m_failed = true;
+            }
+            m_added_cv.notify_all();
+            for (auto & w : workers) w->join();
+        };
+        try {
+            for (unsigned i = 0; i < m_decls.size(); i++) {
+                env = add(env, m_decls[i], num_threads > 0);
+                {
+                    lock_guard<mutex> lock(m_mutex);
+                    m_envs[i + 1] = env;
+                    m_num_added   = i + 1;
+                }
+                m_added_cv.notify_all();
+            }
+        } catch (...) {
+            stop_workers();
+            throw;
         }
+        stop_workers();
+        return env;
     }
 };
 
-void import_from_text(std::istream & in, environment & env, lowlevel_notations & notations) {
-    text_importer importer(env);
+void import_from_text(std::string const & fname, environment & env, lowlevel_notations & notations,
+                      unsigned num_threads) {
+    mapped_file file(fname);
+    text_importer importer;
 
-    std::string line;
-    unsigned line_num = 0;
-    while (std::getline(in, line)) {
-        line_num++;
+    char const * it  = file.data();
+    char const * end = it + file.size();
+    while (it != end) {
+        char const * eol = static_cast<char const *>(memchr(it, '\n', end - it));
+        if (!eol) eol = end;
+        importer.m_line_num++;
         try {
-            importer.handle_line(line);
+            importer.handle_line(it, eol);
         } catch (throwable & t) {
-            throw exception(sstream() << "line " << line_num << ": " << t.what());
+            throw at_line(importer.m_line_num, t.what());
         } catch (std::exception & e) {
-            throw exception(sstream() << "line " << line_num << ": " << e.what());
+            throw at_line(importer.m_line_num, e.what());
         }
+        it = eol == end ? end : eol + 1;
     }
 
-    env = importer.m_env;
+    env = export_checker(importer.m_decls)(env, num_threads);
     notations = std::move(importer.m_notations);
 }
 
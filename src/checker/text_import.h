@@ -23,6 +23,12 @@ struct lowlevel_notation_info {
 
 using lowlevel_notations = std::unordered_map<name, lowlevel_notation_info, name_hash>;
 
-void import_from_text(std::istream & in, environment & env, lowlevel_notations & notations);
+/** \brief Type check the declarations of the export file \c fname, and add them to \c env.
+
+    If \c num_threads > 0, then definitions and axioms are type checked by \c num_threads worker threads.
+    Each declaration is checked in the environment containing the declarations it depends on, while
+    the declarations are still added to \c env in the order of the export file. */
+void import_from_text(std::string const & fname, environment & env, lowlevel_notations & notations,
+                      unsigned num_threads = 0);
 
 }
@@ -3,3 +3,9 @@ FILE(GLOB_RECURSE OLEAN_FILES ${CMAKE_CURRENT_SOURCE_DIR}/*.olean)
 IF(OLEAN_FILES)
   FILE(REMOVE ${OLEAN_FILES})
 ENDIF()
+
+FILE(GLOB_RECURSE ICACHE_FILES ${CMAKE_CURRENT_SOURCE_DIR}/*.icache)
+
+IF(ICACHE_FILES)
+  FILE(REMOVE ${ICACHE_FILES})
+ENDIF()
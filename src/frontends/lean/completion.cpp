@@ -6,6 +6,7 @@ Authors: Gabriel Ebner, Leonardo de Moura, Sebastian Ullrich
 */
 #if defined(LEAN_JSON)
 #include <algorithm>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <library/projection.h>
@@ -17,6 +18,9 @@ Authors: Gabriel Ebner, Leonardo de Moura, Sebastian Ullrich
 #include "library/attribute_manager.h"
 #include "library/scoped_ext.h"
 #include "library/class.h"
+#include "library/aliases.h"
+#include "library/module.h"
+#include "library/decl_name_index.h"
 #include "frontends/lean/completion.h"
 #include "frontends/lean/util.h"
 
@@ -61,8 +65,8 @@ unsigned get_fuzzy_match_max_errors(unsigned prefix_sz) {
     return r;
 }
 
-optional<name> exact_prefix_match(environment const & env, std::string const & pattern, declaration const & d) {
-    if (auto it = is_essentially_atomic(env, d.get_name())) {
+optional<name> exact_prefix_match(environment const & env, std::string const & pattern, name const & d) {
+    if (auto it = is_essentially_atomic(env, d)) {
         std::string it_str = it->to_string();
         // if pattern "perfectly" matches beginning of declaration name, we just display d on the top of the list
         if (it_str.compare(0, pattern.size(), pattern) == 0)
@@ -71,6 +75,45 @@ optional<name> exact_prefix_match(environment const & env, std::string const & p
     return optional<name>();
 }
 
+/** \brief Store in \c r the names of the declarations in \c envs that may match \c pattern: the indexed declarations
+    that may contain \c pattern with at most \c max_errors errors, the declarations of the current modules
+    (they are not indexed yet), and the declarations that have an atomic alias starting with \c pattern.
+    The result is sorted using the order used by environment::for_each_declaration.
+    Return false if the index cannot be used, and all declarations must be considered. */
+static bool find_decl_candidates(std::string const & pattern, unsigned max_errors, std::vector<environment> const & envs,
+                                 buffer<name> & r) {
+    decl_name_index const & idx = get_decl_name_index();
+    if (idx.empty() || !idx.find_candidates(pattern, max_errors, r))
+        return false;
+    for (environment const & env : envs) {
+        get_curr_module_introduced_decl_names(env, r);
+        for_each_expr_alias(env, [&](name const & a, list<name> const & ds) {
+                if (a.is_atomic() && a.is_string() &&
+                    std::strncmp(a.get_string(), pattern.c_str(), pattern.size()) == 0) {
+                    for (name const & d : ds)
+                        r.push_back(d);
+                }
+            });
+    }
+    std::sort(r.begin(), r.end(), [](name const & n1, name const & n2) { return quick_cmp(n1, n2) < 0; });
+    r.shrink(std::unique(r.begin(), r.end()) - r.begin());
+    return true;
+}
+
+/** \brief Invoke \c fn on the declarations of \c env that are in \c candidates (see find_decl_candidates),
+    or on all declarations if \c candidates is nullptr. */
+static void for_each_decl_candidate(environment const & env, buffer<name> const * candidates,
+                                    std::function<void(name const &)> const & fn) {
+    if (candidates) {
+        for (name const & n : *candidates) {
+            if (env.find(n))
+                fn(n);
+        }
+    } else {
+        env.for_each_declaration([&](declaration const & d) { fn(d.get_name()); });
+    }
+}
+
 template<class T>
 void filter_completions(std::string const & pattern, std::vector<pair<std::string, T>> & selected,
                         std::vector<json> & completions, unsigned max_results, std::function<json(T const &)> serialize) {
@@ -129,21 +172,23 @@ std::vector<json> get_decl_completions(std::string const & pattern, environment
     std::vector<pair<name, name>> exact_matches;
     std::vector<pair<std::string, name>> selected;
     bitap_fuzzy_search matcher(pattern, max_errors);
-    env.for_each_declaration([&](declaration const & d) {
-        if (is_projection(env, d.get_name())) {
-            auto s_name = d.get_name().get_prefix();
+    buffer<name> candidates;
+    bool use_index = find_decl_candidates(pattern, max_errors, {env}, candidates);
+    for_each_decl_candidate(env, use_index ? &candidates : nullptr, [&](name const & d) {
+        if (is_projection(env, d)) {
+            auto s_name = d.get_prefix();
             if (is_class(env, s_name))
                 return;
         }
-        if (is_internal_name(d.get_name())) {
+        if (is_internal_name(d)) {
             return;
         }
         if (auto it = exact_prefix_match(env, pattern, d)) {
-            exact_matches.emplace_back(*it, d.get_name());
+            exact_matches.emplace_back(*it, d);
         } else {
-            std::string text = d.get_name().to_string();
+            std::string text = d.to_string();
             if (matcher.match(text))
-                selected.emplace_back(text, d.get_name());
+                selected.emplace_back(text, d);
         }
     });
     unsigned num_results = 0;
@@ -173,24 +218,29 @@ void search_decls(std::string const & pattern, std::vector<pair<std::string, env
     std::vector<pair<name, name>> exact_matches;
     std::vector<pair<std::string, name>> selected;
     bitap_fuzzy_search matcher(pattern, max_errors);
+    std::vector<environment> all_envs;
+    for (auto & env_file : envs)
+        all_envs.push_back(env_file.second);
+    buffer<name> candidates;
+    bool use_index = find_decl_candidates(pattern, max_errors, all_envs, candidates);
 
     for (auto & env_file : envs) {
         auto & env = env_file.second;
-        env.for_each_declaration([&](declaration const & d) {
-            if (name2env.find(d.get_name())) return;
-            name2env.insert(d.get_name(), env_file);
-            if (is_projection(env, d.get_name())) {
-                auto s_name = d.get_name().get_prefix();
+        for_each_decl_candidate(env, use_index ? &candidates : nullptr, [&](name const & d) {
+            if (name2env.find(d)) return;
+            name2env.insert(d, env_file);
+            if (is_projection(env, d)) {
+                auto s_name = d.get_prefix();
             }
-            if (is_internal_name(d.get_name())) {
+            if (is_internal_name(d)) {
                 return;
             }
             if (auto it = exact_prefix_match(env, pattern, d)) {
-                exact_matches.emplace_back(*it, d.get_name());
+                exact_matches.emplace_back(*it, d);
             } else {
-                std::string text = d.get_name().to_string();
+                std::string text = d.to_string();
                 if (matcher.match(text))
-                    selected.emplace_back(text, d.get_name());
+                    selected.emplace_back(text, d);
             }
         });
     }
@@ -234,19 +284,21 @@ std::vector<json> get_field_completions(name const & s, std::string const & patt
     std::vector<pair<name, name>> exact_matches;
     std::vector<pair<std::string, name>> selected;
     bitap_fuzzy_search matcher(new_pattern, max_errors);
+    buffer<name> candidates;
+    bool use_index = find_decl_candidates(new_pattern, max_errors, {env}, candidates);
 
-    env.for_each_declaration([&](declaration const & d) {
-        if (d.get_name() == s ||
-            !is_prefix_of(s, d.get_name()) ||
-            is_internal_name(d.get_name())) {
+    for_each_decl_candidate(env, use_index ? &candidates : nullptr, [&](name const & d) {
+        if (d == s ||
+            !is_prefix_of(s, d) ||
+            is_internal_name(d)) {
             return;
         }
         if (auto it = exact_prefix_match(env, new_pattern, d)) {
-            exact_matches.emplace_back(*it, d.get_name());
+            exact_matches.emplace_back(*it, d);
         } else {
-            std::string text = d.get_name().to_string();
+            std::string text = d.to_string();
             if (matcher.match(text))
-                selected.emplace_back(text, d.get_name());
+                selected.emplace_back(text, d);
         }
     });
     unsigned num_results = 0;
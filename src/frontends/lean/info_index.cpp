@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include <vector>
+#include <iterator>
+#include <tuple>
+#include "library/type_context.h"
+#include "frontends/lean/info_index.h"
+
+namespace lean {
+info_index::key info_index::mk_key(pos_info const & pos, std::string const & file_name, manager_entry const & m) {
+    bool in_range = m.m_loc.m_file_name == file_name && m.m_loc.m_range.m_begin <= pos && pos <= m.m_loc.m_range.m_end;
+    return key(pos, in_range, m.m_level, m.m_id);
+}
+
+void info_index::add(info_manager const & infom, log_tree::node const & n, log_entry const & e) {
+    if (m_managers.count(e.get()))
+        return;
+    manager_entry const & m = m_managers.emplace(e.get(), manager_entry{e, n.get_location(), n.get_detail_level(),
+                                                                        m_next_id++}).first->second;
+    file_index & idx = m_files[infom.get_file_name()];
+    infom.get_line_info_sets().for_each([&](unsigned line, line_info_data_set const & S) {
+            S.for_each([&](unsigned col, list<info_data> const & ds) {
+                    key k = mk_key(pos_info(line, col), infom.get_file_name(), m);
+                    idx.m_records.emplace(k, ds);
+                    buffer<info_data> holes;
+                    for (info_data const & d : ds) {
+                        if (is_hole_info_data(d))
+                            holes.push_back(d);
+                    }
+                    if (!holes.empty())
+                        idx.m_holes.emplace(k, to_list(holes.begin(), holes.end()));
+                });
+        });
+}
+
+void info_index::remove(info_manager const & infom) {
+    auto it = m_managers.find(&infom);
+    if (it == m_managers.end())
+        return;
+    auto fit = m_files.find(infom.get_file_name());
+    if (fit != m_files.end()) {
+        file_index & idx = fit->second;
+        infom.get_line_info_sets().for_each([&](unsigned line, line_info_data_set const & S) {
+                S.for_each([&](unsigned col, list<info_data> const &) {
+                        key k = mk_key(pos_info(line, col), infom.get_file_name(), it->second);
+                        idx.m_records.erase(k);
+                        idx.m_holes.erase(k);
+                    });
+            });
+        if (idx.m_records.empty())
+            m_files.erase(fit);
+    }
+    m_managers.erase(it);
+}
+
+void info_index::on_event(std::vector<log_tree::event> const & events) {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto & e : events) {
+        auto infom = dynamic_cast<info_manager const *>(e.m_entry.get());
+        if (!infom)
+            continue;
+        switch (e.m_kind) {
+        case log_tree::event::EntryAdded:
+            /* The log tree delivers events after releasing its lock, so the entry may already
+               have been removed (and the corresponding EntryRemoved event processed). */
+            if (!e.m_node.is_detached()) {
+                for (log_entry const & e2 : e.m_node.get_entries()) {
+                    if (e2 == e.m_entry) {
+                        add(*infom, e.m_node, e.m_entry);
+                        break;
+                    }
+                }
+            }
+            break;
+        case log_tree::event::EntryRemoved:
+            remove(*infom);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void info_index::get_info(std::string const & file_name, pos_info const & pos, buffer<info_data> & r) const {
+    lock_guard<mutex> lock(m_mutex);
+    auto fit = m_files.find(file_name);
+    if (fit == m_files.end())
+        return;
+    records const & rs = fit->second.m_records;
+    for (auto it = rs.lower_bound(key(pos, false, 0, 0)); it != rs.end() && std::get<0>(it->first) == pos; ++it) {
+        for (info_data const & d : it->second)
+            r.push_back(d);
+    }
+}
+
+bool info_index::contains(std::string const & file_name, pos_info const & pos) const {
+    lock_guard<mutex> lock(m_mutex);
+    auto fit = m_files.find(file_name);
+    if (fit == m_files.end())
+        return false;
+    records const & rs = fit->second.m_records;
+    auto it = rs.lower_bound(key(pos, false, 0, 0));
+    return it != rs.end() && std::get<0>(it->first) == pos;
+}
+
+optional<info_data> info_index::find_hole(std::string const & file_name, pos_info const & pos) const {
+    lock_guard<mutex> lock(m_mutex);
+    auto fit = m_files.find(file_name);
+    if (fit == m_files.end())
+        return optional<info_data>();
+    records const & holes = fit->second.m_holes;
+    /* Visit the lines containing holes backwards, starting at pos.first.
+       The holes of each line are visited from left to right. */
+    auto end = holes.lower_bound(key(pos_info(pos.first + 1, 0), false, 0, 0));
+    while (end != holes.begin()) {
+        unsigned line = std::get<0>(std::prev(end)->first).first;
+        auto begin    = holes.lower_bound(key(pos_info(line, 0), false, 0, 0));
+        for (auto it = begin; it != end; ++it) {
+            optional<info_data> r;
+            for (info_data const & info : it->second) {
+                hole_info_data const & hole = to_hole_info_data(info);
+                pos_info const & b = hole.get_begin_pos();
+                pos_info const & e = hole.get_end_pos();
+                if (b <= pos && pos <= e)
+                    r = info;
+            }
+            if (r)
+                return r;
+        }
+        end = begin;
+    }
+    return optional<info_data>();
+}
+
+void info_index::get_holes(std::string const & file_name, buffer<info_data> & r) const {
+    lock_guard<mutex> lock(m_mutex);
+    auto fit = m_files.find(file_name);
+    if (fit == m_files.end())
+        return;
+    for (auto const & p : fit->second.m_holes) {
+        for (info_data const & d : p.second)
+            r.push_back(d);
+    }
+}
+
+#ifdef LEAN_JSON
+void info_index::get_info_record(environment const & env, options const & o, io_state const & ios,
+                                 std::string const & file_name, pos_info pos,
+                                 json & record, std::function<bool (info_data const &)> pred) const {
+    /* We do not report while holding the lock, reporting may evaluate tactic state thunks. */
+    buffer<info_data> ds;
+    get_info(file_name, pos, ds);
+    if (ds.empty())
+        return;
+    type_context tc(env, o);
+    io_state_stream out = regular(env, ios, tc).update_options(o);
+    for (info_data const & d : ds) {
+        if (!pred || pred(d))
+            d.report(out, record);
+    }
+}
+#endif
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <unordered_map>
+#include "util/log_tree.h"
+#include "frontends/lean/info_manager.h"
+
+namespace lean {
+/** \brief Index of the info records stored by the info_managers of a log tree.
+
+    The records are indexed by file name and position, and the index is kept up to date
+    by feeding it the log tree events (see #on_event). Thus, hover and hole queries
+    are answered without traversing the log tree or copying the info_managers. */
+class info_index {
+    /* The position, whether the position is in the range of the log tree node containing the
+       info_manager providing the records, the detail level of this node, and the id of the info_manager.
+       Records at the same position are reported in this order, i.e., the records produced by the command
+       containing the position are reported after stray records produced by other commands, and since
+       the detail level of a node is at least the one of its parent, the records produced by nested tasks
+       (e.g., the proof of a theorem) are reported after the ones produced by the enclosing command. */
+    typedef std::tuple<pos_info, bool, log_tree::detail_level, unsigned> key;
+    typedef std::map<key, list<info_data>> records;
+    struct file_index {
+        records m_records;
+        /* Subset of m_records containing only the hole records. */
+        records m_holes;
+    };
+    struct manager_entry {
+        log_entry              m_entry; /* keep the info_manager alive */
+        location               m_loc;   /* location of the log tree node containing the info_manager */
+        log_tree::detail_level m_level;
+        unsigned               m_id;
+    };
+    mutable mutex                                               m_mutex;
+    unsigned                                                    m_next_id = 0;
+    std::unordered_map<std::string, file_index>                 m_files;
+    std::unordered_map<log_entry_cell const *, manager_entry>   m_managers;
+
+    static key mk_key(pos_info const & pos, std::string const & file_name, manager_entry const & m);
+    void add(info_manager const & infom, log_tree::node const & n, log_entry const & e);
+    void remove(info_manager const & infom);
+    void get_info(std::string const & file_name, pos_info const & pos, buffer<info_data> & r) const;
+
+public:
+    void on_event(std::vector<log_tree::event> const & events);
+
+    /** \brief Return true if there are info records at \c pos in \c file_name. */
+    bool contains(std::string const & file_name, pos_info const & pos) const;
+
+    /** \brief Return the hole containing \c pos in \c file_name. The holes are searched backwards
+        starting at the line of \c pos. */
+    optional<info_data> find_hole(std::string const & file_name, pos_info const & pos) const;
+
+    /** \brief Store in \c r all holes in \c file_name. */
+    void get_holes(std::string const & file_name, buffer<info_data> & r) const;
+
+#ifdef LEAN_JSON
+    /** \brief Report the info records at \c pos in \c file_name (satisfying \c pred) to \c record.
+        See info_manager::get_info_record. */
+    void get_info_record(environment const & env, options const & o, io_state const & ios,
+                         std::string const & file_name, pos_info pos,
+                         json & record, std::function<bool (info_data const &)> pred = {}) const;
+#endif
+};
+}
@@ -112,7 +112,7 @@ void report_completions(environment const & env, options const & opts, pos_info
 
 void report_info(environment const & env, options const & opts, io_state const & ios,
                  search_path const & path, module_info const & m_mod_info,
-                 std::vector<info_manager> const & info_managers, pos_info const & pos,
+                 info_index const & infos, pos_info const & pos,
                  break_at_pos_exception const & e, json & j) {
     g_context = e.m_token_info.m_context;
     json record;
@@ -163,63 +163,28 @@ void report_info(environment const & env, options const & opts, io_state const &
         }
     }
 
-    for (auto & infom : info_managers) {
-        if (infom.get_file_name() == m_mod_info.m_id) {
-            if (e.m_goal_pos) {
-                infom.get_info_record(env, opts, ios, *e.m_goal_pos, record, [](info_data const & d) {
-                            return dynamic_cast<vm_obj_format_info const *>(d.raw());
-                        });
-            }
-            // first check for field infos inside token
-            for (name pre = tk.get_prefix(); !has_token_info && pre; pre = pre.get_prefix()) {
-                auto field_pos = e.m_token_info.m_pos;
-                field_pos.second += pre.utf8_size();
-                if (pos.second >= field_pos.second &&
-                    infom.get_line_info_set(field_pos.first).find(field_pos.second)) {
-                    infom.get_info_record(env, opts, ios, field_pos, record);
-                    has_token_info = true;
-                }
-            }
-            if (!has_token_info)
-                infom.get_info_record(env, opts, ios, e.m_token_info.m_pos, record);
+    std::string const & file_name = m_mod_info.m_id;
+    if (e.m_goal_pos) {
+        infos.get_info_record(env, opts, ios, file_name, *e.m_goal_pos, record, [](info_data const & d) {
+                return dynamic_cast<vm_obj_format_info const *>(d.raw());
+            });
+    }
+    // first check for field infos inside token
+    for (name pre = tk.get_prefix(); !has_token_info && pre; pre = pre.get_prefix()) {
+        auto field_pos = e.m_token_info.m_pos;
+        field_pos.second += pre.utf8_size();
+        if (pos.second >= field_pos.second && infos.contains(file_name, field_pos)) {
+            infos.get_info_record(env, opts, ios, file_name, field_pos, record);
+            has_token_info = true;
         }
     }
+    if (!has_token_info)
+        infos.get_info_record(env, opts, ios, file_name, e.m_token_info.m_pos, record);
 
     if (!record.is_null())
         j["record"] = record;
 }
 
-optional<info_data> find_hole(module_info const & m_mod_info,
-                              std::vector<info_manager> const & info_managers,
-                              pos_info const & pos) {
-    optional<info_data> r;
-    for (auto & infom : info_managers) {
-        if (infom.get_file_name() == m_mod_info.m_id) {
-            unsigned line = pos.first;
-            while (true) {
-                line_info_data_set S = infom.get_line_info_set(line);
-                S.for_each([&](unsigned, list<info_data> const & info_list) {
-                        if (r) return;
-                        for (info_data const & info : info_list) {
-                            if (hole_info_data const * hole = is_hole_info_data(info)) {
-                                pos_info const & begin = hole->get_begin_pos();
-                                pos_info const & end   = hole->get_end_pos();
-                                if ((pos.first > begin.first || (pos.first == begin.first && pos.second >= begin.second)) &&
-                                    (pos.first < end.first || (pos.first == end.first && pos.second <= end.second))) {
-                                    r = info;
-                                }
-                            }
-                        }
-                    });
-                if (r) break;
-                if (line == 0) break;
-                line--;
-            }
-        }
-    }
-    return r;
-}
-
 bool execute_hole_command(tactic_state s, name const & cmd_decl_name, expr const & args, json & j) {
     type_context ctx = mk_type_context_for(s);
     options opts     = s.get_options();
@@ -289,9 +254,9 @@ bool json_of_hole(hole_info_data const & hole, std::string const & file, json &
 }
 
 void get_hole_commands(module_info const & m_mod_info,
-                       std::vector<info_manager> const & info_managers,
+                       info_index const & infos,
                        pos_info const & pos, json & j) {
-    optional<info_data> info = find_hole(m_mod_info, info_managers, pos);
+    optional<info_data> info = infos.find_hole(m_mod_info.m_id, pos);
     if (!info) {
         j["message"] = "hole not found";
         return;
@@ -304,32 +269,23 @@ void get_hole_commands(module_info const & m_mod_info,
 }
 
 void get_all_hole_commands(module_info const & m_mod_info,
-                           std::vector<info_manager> const & info_managers,
+                           info_index const & infos,
                            json & j) {
     std::vector<json> holes;
-    for (auto & infom : info_managers) {
-        if (infom.get_file_name() == m_mod_info.m_id) {
-            infom.get_line_info_sets().for_each([&](unsigned, line_info_data_set const & S) {
-                S.for_each([&](unsigned, list<info_data> const & info_list) {
-                    for (info_data const & info : info_list) {
-                        if (hole_info_data const * hole = is_hole_info_data(info)) {
-                            json j;
-                            if (json_of_hole(*hole, m_mod_info.m_id, j)) {
-                                holes.push_back(j);
-                            }
-                        }
-                    }
-                });
-            });
-        }
+    buffer<info_data> hole_infos;
+    infos.get_holes(m_mod_info.m_id, hole_infos);
+    for (info_data const & info : hole_infos) {
+        json j;
+        if (json_of_hole(to_hole_info_data(info), m_mod_info.m_id, j))
+            holes.push_back(j);
     }
     j["holes"] = holes;
 }
 
 void execute_hole_command(module_info const & m_mod_info,
-                          std::vector<info_manager> const & info_managers,
+                          info_index const & infos,
                           pos_info const & pos, std::string const & action, json & j) {
-    optional<info_data> info = find_hole(m_mod_info, info_managers, pos);
+    optional<info_data> info = infos.find_hole(m_mod_info.m_id, pos);
     if (!info) {
         j["message"] = "hole not found";
         return;
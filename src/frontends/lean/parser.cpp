@@ -52,6 +52,7 @@ Author: Leonardo de Moura
 #include "kernel/scope_pos_info_provider.h"
 #include "library/type_context.h"
 #include "library/pattern_attribute.h"
+#include "library/persistent_instance_cache.h"
 #include "library/equations_compiler/equations.h"
 #include "frontends/lean/tokens.h"
 #include "frontends/lean/builtin_exprs.h"
@@ -2511,6 +2512,11 @@ void parser::process_imports() {
     m_env = update_fingerprint(m_env, fingerprint);
     m_env = activate_export_decls(m_env, {}); // explicitly activate exports in root namespace
     m_env = replay_export_decls_core(m_env, m_ios);
+    if (is_persistent_instance_cache_enabled(get_options()) && is_lean_file(m_file_name)) {
+        auto c = std::make_shared<persistent_instance_cache>();
+        c->load(instance_cache_of_lean(m_file_name));
+        m_env = set_persistent_instance_cache(m_env, c);
+    }
     m_imports_parsed = true;
 
     if (exception_during_scanning) std::rethrow_exception(exception_during_scanning);
@@ -49,7 +49,29 @@ declaration::~declaration() { if (m_ptr) m_ptr->dec_ref(); }
 declaration & declaration::operator=(declaration const & s) { LEAN_COPY_REF(s); }
 declaration & declaration::operator=(declaration && s) { LEAN_MOVE_REF(s); }
 
-bool declaration::is_definition() const    { return static_cast<bool>(m_ptr->m_value) || static_cast<bool>(m_ptr->m_proof); }
+/* Loading a declaration only happens once, so we use a small set of mutexes indexed by the cell address
+   instead of storing one in every declaration. */
+#define LEAN_NUM_DECL_LOAD_MUTEXES 32
+static mutex * g_load_mutexes = nullptr;
+
+void declaration::cell::load_core() const {
+    lock_guard<mutex> lock(g_load_mutexes[(reinterpret_cast<uintptr_t>(this) >> 4) % LEAN_NUM_DECL_LOAD_MUTEXES]);
+    if (m_loaded.load())
+        return;
+    pair<expr, optional<expr>> r = m_loader->load();
+    lean_assert(static_cast<bool>(r.second) == m_definition);
+    m_type = r.first;
+    if (m_definition) {
+        if (m_theorem)
+            m_proof = mk_pure_task(static_cast<expr const &>(*r.second));
+        else
+            m_value = r.second;
+    }
+    m_loader.reset();
+    m_loaded.store(true);
+}
+
+bool declaration::is_definition() const    { return m_ptr->m_definition; }
 bool declaration::is_constant_assumption() const { return !is_definition(); }
 bool declaration::is_axiom() const         { return is_constant_assumption() && m_ptr->m_theorem; }
 bool declaration::is_theorem() const       { return is_definition() && m_ptr->m_theorem; }
@@ -58,14 +80,16 @@ bool declaration::is_trusted() const       { return m_ptr->m_trusted; }
 name const & declaration::get_name() const { return m_ptr->m_name; }
 level_param_names const & declaration::get_univ_params() const { return m_ptr->m_params; }
 unsigned declaration::get_num_univ_params() const { return length(get_univ_params()); }
-expr const & declaration::get_type() const { return m_ptr->m_type; }
+expr const & declaration::get_type() const { m_ptr->load(); return m_ptr->m_type; }
 
 task<expr> const & declaration::get_value_task() const {
     lean_assert(is_theorem());
+    m_ptr->load();
     return m_ptr->m_proof;
 }
 expr const & declaration::get_value() const {
     lean_assert(is_definition());
+    m_ptr->load();
     if (m_ptr->m_proof) {
         return get(m_ptr->m_proof);
     } else {
@@ -109,6 +133,13 @@ declaration mk_axiom(name const & n, level_param_names const & params, expr cons
 declaration mk_constant_assumption(name const & n, level_param_names const & params, expr const & t, bool trusted) {
     return declaration(new declaration::cell(n, params, t, false, trusted));
 }
+declaration mk_lazy_declaration(name const & n, level_param_names const & params, bool is_definition,
+                                bool is_theorem_or_axiom, reducibility_hints const & hints, bool trusted,
+                                std::shared_ptr<declaration_loader const> const & loader) {
+    return declaration(new declaration::cell(n, params, is_definition, is_theorem_or_axiom,
+                                             is_definition && is_theorem_or_axiom ? reducibility_hints::mk_opaque() : hints,
+                                             trusted, loader));
+}
 
 bool use_untrusted(environment const & env, expr const & e) {
     bool found = false;
@@ -145,9 +176,11 @@ declaration mk_constant_assumption_inferring_trusted(environment const & env, na
 
 void initialize_declaration() {
     g_dummy = new declaration(mk_axiom(name(), level_param_names(), expr()));
+    g_load_mutexes = new mutex[LEAN_NUM_DECL_LOAD_MUTEXES];
 }
 
 void finalize_declaration() {
+    delete[] g_load_mutexes;
     delete g_dummy;
 }
 }
@@ -8,8 +8,11 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <string>
 #include <limits>
+#include <memory>
 #include "util/rc.h"
 #include "util/task.h"
+#include "util/thread.h"
+#include "util/pair.h"
 #include "kernel/expr.h"
 
 namespace lean {
@@ -67,34 +70,56 @@ public:
 
 int compare(reducibility_hints const & h1, reducibility_hints const & h2);
 
+/** \brief Deferred source for the type and value of a declaration.
+
+    Declarations imported from .olean files are only deserialized the first time
+    their type or value is requested. \see mk_lazy_declaration */
+class declaration_loader {
+public:
+    virtual ~declaration_loader() {}
+    /** \brief Return the type of the declaration, and its value if it is a definition or theorem. */
+    virtual pair<expr, optional<expr>> load() const = 0;
+};
+
 /** \brief Environment definitions, theorems, axioms and variable declarations. */
 class declaration {
     struct cell {
         MK_LEAN_RC();
         name               m_name;
         level_param_names  m_params;
-        expr               m_type;
+        mutable expr       m_type;
         bool               m_theorem;
-        optional<expr>     m_value;        // if none, then declaration is actually a postulate
-        task<expr>         m_proof;
+        bool               m_definition;
+        mutable optional<expr> m_value;    // if none, then declaration is actually a postulate
+        mutable task<expr> m_proof;
         reducibility_hints m_hints;
         /* Definitions are trusted by default, and nested macros are expanded when kernel is instantiated with
            trust level 0. When this flag is false, then we do not expand nested macros. We say the
            associated definitions are "untrusted". We use this feature to define tactical-definitions.
            The kernel type checker ensures trusted definitions do not use untrusted ones. */
         bool              m_trusted;
+        /* When m_loaded is false, m_type, m_value and m_proof have not been set yet, and
+           they must be obtained from m_loader. */
+        mutable atomic<bool> m_loaded;
+        mutable std::shared_ptr<declaration_loader const> m_loader;
         void dealloc() { delete this; }
+        void load() const { if (!atomic_load_explicit(&m_loaded, memory_order_acquire)) load_core(); }
+        void load_core() const;
 
         cell(name const & n, level_param_names const & params, expr const & t, bool is_axiom, bool trusted):
-            m_rc(1), m_name(n), m_params(params), m_type(t), m_theorem(is_axiom),
-            m_hints(reducibility_hints::mk_opaque()), m_trusted(trusted) {}
+            m_rc(1), m_name(n), m_params(params), m_type(t), m_theorem(is_axiom), m_definition(false),
+            m_hints(reducibility_hints::mk_opaque()), m_trusted(trusted), m_loaded(true) {}
         cell(name const & n, level_param_names const & params, expr const & t, expr const & v,
              reducibility_hints const & h, bool trusted):
-            m_rc(1), m_name(n), m_params(params), m_type(t), m_theorem(false),
-            m_value(v), m_hints(h), m_trusted(trusted) {}
+            m_rc(1), m_name(n), m_params(params), m_type(t), m_theorem(false), m_definition(true),
+            m_value(v), m_hints(h), m_trusted(trusted), m_loaded(true) {}
         cell(name const & n, level_param_names const & params, expr const & t, task<expr> const & v):
-            m_rc(1), m_name(n), m_params(params), m_type(t), m_theorem(true),
-            m_proof(v), m_hints(reducibility_hints::mk_opaque()), m_trusted(true) {}
+            m_rc(1), m_name(n), m_params(params), m_type(t), m_theorem(true), m_definition(true),
+            m_proof(v), m_hints(reducibility_hints::mk_opaque()), m_trusted(true), m_loaded(true) {}
+        cell(name const & n, level_param_names const & params, bool is_definition, bool is_theorem_or_axiom,
+             reducibility_hints const & h, bool trusted, std::shared_ptr<declaration_loader const> const & loader):
+            m_rc(1), m_name(n), m_params(params), m_theorem(is_theorem_or_axiom), m_definition(is_definition),
+            m_hints(h), m_trusted(trusted), m_loaded(false), m_loader(loader) {}
     };
     cell * m_ptr;
     explicit declaration(cell * ptr);
@@ -144,6 +169,9 @@ public:
     friend declaration mk_theorem(name const &, level_param_names const &, expr const &, task<expr> const &);
     friend declaration mk_axiom(name const & n, level_param_names const & params, expr const & t);
     friend declaration mk_constant_assumption(name const & n, level_param_names const & params, expr const & t, bool trusted);
+    friend declaration mk_lazy_declaration(name const & n, level_param_names const & params, bool is_definition,
+                                           bool is_theorem_or_axiom, reducibility_hints const & hints, bool trusted,
+                                           std::shared_ptr<declaration_loader const> const & loader);
 };
 
 inline optional<declaration> none_declaration() { return optional<declaration>(); }
@@ -158,6 +186,12 @@ declaration mk_theorem(name const & n, level_param_names const & params, expr co
 declaration mk_theorem(name const & n, level_param_names const & params, expr const & t, task<expr> const & v);
 declaration mk_axiom(name const & n, level_param_names const & params, expr const & t);
 declaration mk_constant_assumption(name const & n, level_param_names const & params, expr const & t, bool trusted = true);
+/** \brief Create a declaration whose type and value are only produced by \c loader when they are
+    first accessed. The remaining fields must be provided eagerly since they are used when the
+    declaration is added to an environment. */
+declaration mk_lazy_declaration(name const & n, level_param_names const & params, bool is_definition,
+                                bool is_theorem_or_axiom, reducibility_hints const & hints, bool trusted,
+                                std::shared_ptr<declaration_loader const> const & loader);
 
 /** \brief Return true iff \c e depends on meta-declarations */
 bool use_untrusted(environment const & env, expr const & e);
@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include <string>
 #include <algorithm>
 #include <limits>
+#include <unordered_map>
 #include "util/list_fn.h"
 #include "util/hash.h"
 #include "util/buffer.h"
@@ -94,7 +95,7 @@ expr_cell::expr_cell(expr_cell const & src):
     m_has_param_univ(src.m_has_param_univ),
     m_hash(src.m_hash),
     m_rc(0) {
-    unsigned flgs = src.m_flags;
+    unsigned flgs = src.m_flags & (1+2); // the copy is not in the global hash-consing table
     unsigned tag  = src.m_tag;
     m_flags = flgs;
     m_tag   = tag;
@@ -408,9 +409,69 @@ LEAN_THREAD_VALUE(bool, g_expr_cache_enabled, false);
 typedef typename std::unordered_set<expr, expr_hash, is_bi_equal_proc> expr_cache;
 MK_THREAD_LOCAL_GET_DEF(expr_cache, get_expr_cache);
 
+struct expr_cell_struct_hash { unsigned operator()(expr_cell * c) const { return c->hash(); } };
+/* Remark: we use an expr that does not own a reference to compare cells that may be being deallocated. */
+struct expr_cell_struct_eq {
+    bool operator()(expr_cell * c1, expr_cell * c2) const {
+        return is_bi_equal(*reinterpret_cast<expr const *>(&c1), *reinterpret_cast<expr const *>(&c2));
+    }
+};
+static_assert(sizeof(expr) == sizeof(expr_ptr), "unexpected expr size");
+typedef hash_cons_table<expr_cell, expr_cell_struct_hash, expr_cell_struct_eq> expr_table;
+static expr_table * g_expr_table = nullptr;
+
+static size_t get_cell_size(expr const & e) {
+    switch (e.kind()) {
+    case expr_kind::Var:      return sizeof(expr_var);
+    case expr_kind::Sort:     return sizeof(expr_sort);
+    case expr_kind::Constant: return sizeof(expr_const);
+    case expr_kind::Meta:     return sizeof(expr_mlocal);
+    case expr_kind::Local:    return sizeof(expr_local);
+    case expr_kind::App:      return sizeof(expr_app);
+    case expr_kind::Lambda:
+    case expr_kind::Pi:       return sizeof(expr_binding);
+    case expr_kind::Let:      return sizeof(expr_let);
+    case expr_kind::Macro:    return sizeof(expr_macro) + macro_num_args(e)*sizeof(expr const *);
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+/* Maximal sharing using the thread local cache, or the global hash-consing table when \c m_cache is nullptr. */
 struct cache_expr_insert_fn {
-    expr_cache & m_cache;
-    cache_expr_insert_fn(expr_cache & c):m_cache(c) {}
+    expr_cache * m_cache;
+    /* When using the global table, we also cache the result for shared subterms that are not
+       in the global table, otherwise they would be compared with the table entries again and again. */
+    std::unordered_map<expr_cell *, expr> m_visited;
+    cache_expr_insert_fn(expr_cache * c):m_cache(c) {}
+
+    static expr to_expr(expr_cell * r) {
+        expr e(r);
+        r->dec_ref(); // the global table incremented the reference counter of \c r
+        return e;
+    }
+
+    optional<expr> find(expr const & e) {
+        if (m_cache) {
+            auto it = m_cache->find(e);
+            if (it != m_cache->end())
+                return some_expr(*it);
+        } else if (e.raw()->is_hash_consed()) {
+            return some_expr(e);
+        } else if (expr_cell * r = g_expr_table->find(e.raw(), get_cell_size(e))) {
+            return some_expr(to_expr(r));
+        }
+        return none_expr();
+    }
+
+    expr add(expr const & e) {
+        if (m_cache) {
+            m_cache->insert(e);
+            return e;
+        }
+        expr_cell * r = g_expr_table->find_or_insert(e.raw(), get_cell_size(e),
+                                                     [](expr_cell * c) { c->set_hash_consed(); });
+        return r == e.raw() ? e : to_expr(r);
+    }
 
     expr insert_macro(expr const & e) {
         buffer<expr> new_args;
@@ -450,12 +511,23 @@ struct cache_expr_insert_fn {
 
     expr insert_constant(expr const & e) {
         /* TODO(Leo): similar insert for levels */
-        return e;
+        if (m_cache)
+            return e;
+        levels new_ls = map_reuse(const_levels(e), [](level const & l) { return hash_cons(l); },
+                                  [](level const & l1, level const & l2) { return is_eqp(l1, l2); });
+        if (is_eqp(new_ls, const_levels(e)))
+            return e;
+        return expr(new (get_const_allocator().allocate()) expr_const(const_name(e), new_ls, e.get_tag()));
     }
 
     expr insert_sort(expr const & e) {
         /* TODO(Leo): similar insert for levels */
-        return e;
+        if (m_cache)
+            return e;
+        level new_l = hash_cons(sort_level(e));
+        if (is_eqp(new_l, sort_level(e)))
+            return e;
+        return expr(new (get_sort_allocator().allocate()) expr_sort(new_l, e.get_tag()));
     }
 
     expr insert_app(expr const & e) {
@@ -491,9 +563,13 @@ struct cache_expr_insert_fn {
     }
 
     expr insert(expr const & e) {
-        auto it = m_cache.find(e);
-        if (it != m_cache.end()) {
-            return *it;
+        if (auto r = find(e))
+            return *r;
+        bool shared = !m_cache && is_shared(e);
+        if (shared) {
+            auto it = m_visited.find(e.raw());
+            if (it != m_visited.end())
+                return it->second;
         }
         expr new_e;
         switch (e.kind()) {
@@ -508,7 +584,9 @@ struct cache_expr_insert_fn {
         case expr_kind::Pi:        new_e = insert_binding(e);  break;
         case expr_kind::Let:       new_e = insert_let(e);      break;
         }
-        m_cache.insert(new_e);
+        new_e = add(new_e);
+        if (shared)
+            m_visited.insert(mk_pair(e.raw(), new_e));
         return new_e;
     }
 
@@ -516,11 +594,23 @@ struct cache_expr_insert_fn {
 };
 
 inline expr cache(expr const & e) {
-    if (g_expr_cache_enabled)
-        return cache_expr_insert_fn(get_expr_cache())(e);
+    if (g_expr_cache_enabled) {
+        if (is_global_hash_consing_enabled())
+            return cache_expr_insert_fn(nullptr)(e);
+        return cache_expr_insert_fn(&get_expr_cache())(e);
+    } else {
+        return e;
+    }
+}
+expr hash_cons(expr const & e) {
+    if (is_global_hash_consing_enabled())
+        return cache_expr_insert_fn(nullptr)(e);
     else
         return e;
 }
+hash_cons_stats get_expr_hash_cons_stats() {
+    return g_expr_table->get_stats();
+}
 bool enable_expr_caching(bool f) {
     DEBUG_CODE(bool r1 =) enable_level_caching(f);
     bool r2 = g_expr_cache_enabled;
@@ -535,6 +625,8 @@ bool enable_expr_caching(bool f) {
     return r2;
 }
 bool is_cached(expr const & e) {
+    if (is_global_hash_consing_enabled())
+        return e.raw()->is_hash_consed();
     return get_expr_cache().find(e) != get_expr_cache().end();
 }
 void flush_expr_cache() {
@@ -589,6 +681,8 @@ void expr_cell::dealloc() {
             atomic_fetch_sub_explicit(&g_num_live_exprs, 1u, memory_order_release);
             #endif
             lean_assert(it->get_rc() == 0);
+            if (it->is_hash_consed() && g_expr_table)
+                g_expr_table->erase(it);
             switch (it->kind()) {
             case expr_kind::Var:        static_cast<expr_var*>(it)->dealloc(); break;
             case expr_kind::Macro:      static_cast<expr_macro*>(it)->dealloc(todo); break;
@@ -931,6 +1025,7 @@ std::ostream & operator<<(std::ostream & out, expr_kind const & k) {
 }
 
 void initialize_expr() {
+    g_expr_table   = new expr_table();
     g_dummy        = new expr(mk_constant("__expr_for_default_constructor__"));
     g_default_name = new name("a");
     g_Type1        = new expr(mk_sort(mk_level_one()));
@@ -942,5 +1037,7 @@ void finalize_expr() {
     delete g_Type1;
     delete g_dummy;
     delete g_default_name;
+    delete g_expr_table;
+    g_expr_table = nullptr;
 }
 }
@@ -12,7 +12,7 @@ Author: Leonardo de Moura
 #include <tuple>
 #include <string>
 #include "util/thread.h"
-#include "util/rc.h"
+#include "util/biased_rc.h"
 #include "util/name.h"
 #include "util/hash.h"
 #include "util/buffer.h"
@@ -21,6 +21,7 @@ Author: Leonardo de Moura
 #include "util/serializer.h"
 #include "util/sexpr/format.h"
 #include "kernel/level.h"
+#include "kernel/hash_cons.h"
 #include "kernel/formatter.h"
 #include "kernel/expr_eq_fn.h"
 
@@ -50,6 +51,7 @@ class expr_cell {
 protected:
     // The bits of the following field mean:
     //    0-1  - term is an arrow (0 - not initialized, 1 - is arrow, 2 - is not arrow)
+    //    2    - cell is stored in the global hash-consing table
     // Remark: we use atomic_uchar because these flags are computed lazily (i.e., after the expression is created)
     atomic_uchar       m_flags;
     unsigned           m_kind:8;
@@ -60,7 +62,7 @@ protected:
     unsigned           m_hash;             // hash based on the structure of the expression (this is a good hash for structural equality)
     unsigned           m_hash_alloc;       // hash based on 'time' of allocation (this is a good hash for pointer-based equality)
     atomic_uint        m_tag;
-    MK_LEAN_RC(); // Declare m_rc counter
+    MK_LEAN_BIASED_RC(); // Declare m_rc counter
     void dealloc();
 
     optional<bool> is_arrow() const;
@@ -80,6 +82,8 @@ public:
     bool has_param_univ() const { return m_has_param_univ; }
     void set_tag(tag t);
     tag get_tag() const { return m_tag; }
+    bool is_hash_consed() const { return (m_flags & 4) != 0; }
+    void set_hash_consed() { m_flags |= 4; }
 };
 
 typedef expr_cell * expr_ptr;
@@ -531,6 +535,10 @@ struct scoped_expr_caching {
 /** \brief Return true iff \c e is in the cache */
 bool is_cached(expr const & e);
 void flush_expr_cache();
+/** \brief Return a maximally shared expression equal to \c e using the global hash-consing table.
+    It is the identity function if the global table is disabled (see enable_global_hash_consing). */
+expr hash_cons(expr const & e);
+hash_cons_stats get_expr_hash_cons_stats();
 // =======================================
 
 // =======================================
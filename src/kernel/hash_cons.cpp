@@ -0,0 +1,29 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <iomanip>
+#include "kernel/hash_cons.h"
+
+namespace lean {
+static atomic<bool> g_global_hash_consing(false);
+
+bool enable_global_hash_consing(bool f) {
+    return g_global_hash_consing.exchange(f);
+}
+
+bool is_global_hash_consing_enabled() {
+    return g_global_hash_consing.load();
+}
+
+std::ostream & operator<<(std::ostream & out, hash_cons_stats const & s) {
+    std::ios_base::fmtflags flags = out.flags();
+    out << "size: " << s.m_size << ", lookups: " << s.m_lookups << ", hits: " << s.m_hits
+        << " (" << std::fixed << std::setprecision(1) << s.hit_rate() * 100.0 << "%)"
+        << ", bytes saved: " << s.m_bytes_saved;
+    out.flags(flags);
+    return out;
+}
+}
@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <iostream>
+#include <unordered_set>
+#include "util/thread.h"
+#include "util/int64.h"
+
+namespace lean {
+/** \brief Statistics for a global hash-consing table. */
+struct hash_cons_stats {
+    uint64 m_lookups     = 0; // number of lookups
+    uint64 m_hits        = 0; // number of lookups that produced an existing cell
+    uint64 m_size        = 0; // number of cells currently stored in the table
+    uint64 m_bytes_saved = 0; // memory of the cells that were replaced with an existing one
+    double hit_rate() const { return m_lookups == 0 ? 0.0 : static_cast<double>(m_hits) / m_lookups; }
+};
+std::ostream & operator<<(std::ostream & out, hash_cons_stats const & s);
+
+/** \brief Enable/disable the global hash-consing tables for expressions and universe levels, and
+    return the previous value.
+
+    When the global tables are enabled, the expressions created while expression caching is enabled
+    (see scoped_expr_caching) are shared by all threads instead of a thread local table. Moreover,
+    the declarations imported from .olean files are hash-consed using the same tables.
+    This option should be set at initialization time. */
+bool enable_global_hash_consing(bool f);
+bool is_global_hash_consing_enabled();
+
+/** \brief Weak hash-consing table shared by all threads.
+
+    The table does not own references to its cells. A cell that is added to the table must be removed
+    using \c erase before it is deallocated. A cell whose reference counter is zero may still be in the table
+    while it is being deallocated, \c find and \c find_or_insert skip such cells.
+
+    The table is split into stripes, each one protected by its own lock. */
+template<typename Cell, typename Hash, typename Eq>
+class hash_cons_table {
+    static constexpr unsigned num_stripes = 64;
+    typedef std::unordered_set<Cell *, Hash, Eq> cell_set;
+    struct stripe {
+        mutex    m_mutex;
+        cell_set m_cells;
+    };
+    stripe         m_stripes[num_stripes];
+    atomic<uint64> m_lookups;
+    atomic<uint64> m_hits;
+    atomic<uint64> m_size;
+    atomic<uint64> m_bytes_saved;
+
+    stripe & get_stripe(Cell * c) { return m_stripes[(Hash()(c) >> 8) % num_stripes]; }
+
+public:
+    hash_cons_table():m_lookups(0), m_hits(0), m_size(0), m_bytes_saved(0) {}
+
+    /** \brief Return a cell equal to \c c that is stored in the table, or nullptr.
+        The reference counter of the resulting cell is incremented. */
+    Cell * find(Cell * c, size_t cell_size) {
+        stripe & s = get_stripe(c);
+        atomic_fetch_add_explicit(&m_lookups, static_cast<uint64>(1), memory_order_relaxed);
+        lock_guard<mutex> lock(s.m_mutex);
+        auto it = s.m_cells.find(c);
+        if (it != s.m_cells.end() && *it != c && (*it)->try_inc_ref()) {
+            atomic_fetch_add_explicit(&m_hits, static_cast<uint64>(1), memory_order_relaxed);
+            atomic_fetch_add_explicit(&m_bytes_saved, static_cast<uint64>(cell_size), memory_order_relaxed);
+            return *it;
+        }
+        return nullptr;
+    }
+
+    /** \brief Return a cell equal to \c c that is stored in the table, and insert \c c if there is none.
+        The reference counter of the result is incremented if it is not \c c.
+        \c mark is invoked on \c c if it is inserted. */
+    template<typename Mark>
+    Cell * find_or_insert(Cell * c, size_t cell_size, Mark && mark) {
+        stripe & s = get_stripe(c);
+        atomic_fetch_add_explicit(&m_lookups, static_cast<uint64>(1), memory_order_relaxed);
+        lock_guard<mutex> lock(s.m_mutex);
+        auto it = s.m_cells.find(c);
+        if (it != s.m_cells.end()) {
+            Cell * r = *it;
+            if (r == c)
+                return c;
+            if (r->try_inc_ref()) {
+                atomic_fetch_add_explicit(&m_hits, static_cast<uint64>(1), memory_order_relaxed);
+                atomic_fetch_add_explicit(&m_bytes_saved, static_cast<uint64>(cell_size), memory_order_relaxed);
+                return r;
+            }
+            /* r is being deallocated */
+            s.m_cells.erase(it);
+            atomic_fetch_sub_explicit(&m_size, static_cast<uint64>(1), memory_order_relaxed);
+        }
+        mark(c);
+        s.m_cells.insert(c);
+        atomic_fetch_add_explicit(&m_size, static_cast<uint64>(1), memory_order_relaxed);
+        return c;
+    }
+
+    /** \brief Remove \c c from the table, it is a noop if \c c has already been replaced by another cell. */
+    void erase(Cell * c) {
+        stripe & s = get_stripe(c);
+        lock_guard<mutex> lock(s.m_mutex);
+        auto it = s.m_cells.find(c);
+        if (it != s.m_cells.end() && *it == c) {
+            s.m_cells.erase(it);
+            atomic_fetch_sub_explicit(&m_size, static_cast<uint64>(1), memory_order_relaxed);
+        }
+    }
+
+    hash_cons_stats get_stats() const {
+        hash_cons_stats r;
+        r.m_lookups     = m_lookups;
+        r.m_hits        = m_hits;
+        r.m_size        = m_size;
+        r.m_bytes_saved = m_bytes_saved;
+        return r;
+    }
+};
+}
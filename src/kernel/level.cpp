@@ -10,7 +10,7 @@ Author: Leonardo de Moura
 #include <unordered_set>
 #include "util/safe_arith.h"
 #include "util/buffer.h"
-#include "util/rc.h"
+#include "util/biased_rc.h"
 #include "util/list.h"
 #include "util/debug.h"
 #include "util/hash.h"
@@ -28,10 +28,11 @@ level_cell const & to_cell(level const & l) {
 /** \brief Base class for representing universe level terms. */
 struct level_cell {
     void dealloc();
-    MK_LEAN_RC()
-    level_kind m_kind;
-    unsigned   m_hash;
-    level_cell(level_kind k, unsigned h):m_rc(0), m_kind(k), m_hash(h) {}
+    MK_LEAN_BIASED_RC()
+    level_kind  m_kind;
+    unsigned    m_hash;
+    atomic_bool m_hash_consed; // true if the cell is stored in the global hash-consing table
+    level_cell(level_kind k, unsigned h):m_rc(0), m_kind(k), m_hash(h), m_hash_consed(false) {}
 };
 
 struct level_composite : public level_cell {
@@ -116,7 +117,20 @@ name const & level_id(level const & l) {
     return to_param_core(l).m_id;
 }
 
+struct level_cell_hash { unsigned operator()(level_cell * c) const { return c->m_hash; } };
+/* Remark: we use a level that does not own a reference to compare cells that may be being deallocated. */
+struct level_cell_eq {
+    bool operator()(level_cell * c1, level_cell * c2) const {
+        return *reinterpret_cast<level const *>(&c1) == *reinterpret_cast<level const *>(&c2);
+    }
+};
+static_assert(sizeof(level) == sizeof(level_cell *), "unexpected level size"); // NOLINT
+typedef hash_cons_table<level_cell, level_cell_hash, level_cell_eq> level_table;
+static level_table * g_level_table = nullptr;
+
 void level_cell::dealloc() {
+    if (m_hash_consed && g_level_table)
+        g_level_table->erase(this);
     switch (m_kind) {
     case level_kind::Succ:
         delete static_cast<level_succ*>(this);
@@ -245,6 +259,8 @@ level const & mk_level_zero() { return *g_level_zero; }
 level const & mk_level_one() { return *g_level_one; }
 bool is_one(level const & l) { return l == mk_level_one(); }
 
+static level global_find_or_insert(level const & l);
+
 typedef typename std::unordered_set<level, level_hash> level_cache;
 LEAN_THREAD_VALUE(bool, g_level_cache_enabled, false);
 MK_THREAD_LOCAL_GET_DEF(level_cache, get_level_cache);
@@ -261,6 +277,8 @@ void flush_level_cache() {
 }
 level cache(level const & e) {
     if (g_level_cache_enabled) {
+        if (is_global_hash_consing_enabled())
+            return global_find_or_insert(e);
         level_cache & cache = get_level_cache();
         auto it = cache.find(e);
         if (it != cache.end()) {
@@ -272,9 +290,60 @@ level cache(level const & e) {
     return e;
 }
 bool is_cached(level const & e) {
+    if (is_global_hash_consing_enabled())
+        return to_cell(e).m_hash_consed;
     return get_level_cache().find(e) != get_level_cache().end();
 }
 
+static size_t get_cell_size(level const & l) {
+    switch (kind(l)) {
+    case level_kind::Zero:                         return sizeof(level_cell);
+    case level_kind::Succ:                         return sizeof(level_succ);
+    case level_kind::Max: case level_kind::IMax:   return sizeof(level_max_core);
+    case level_kind::Param: case level_kind::Meta: return sizeof(level_param_core);
+    }
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+static level global_find_or_insert(level const & l) {
+    level_cell * c = const_cast<level_cell *>(&to_cell(l));
+    level_cell * r = g_level_table->find_or_insert(c, get_cell_size(l),
+                                                   [](level_cell * c) { c->m_hash_consed = true; });
+    if (r == c)
+        return l;
+    level new_l(r);
+    r->dec_ref(); // find_or_insert incremented the reference counter of \c r
+    return new_l;
+}
+
+level hash_cons(level const & l) {
+    if (!is_global_hash_consing_enabled() || to_cell(l).m_hash_consed)
+        return l;
+    switch (kind(l)) {
+    case level_kind::Zero: case level_kind::Param: case level_kind::Meta:
+        return global_find_or_insert(l);
+    case level_kind::Succ: {
+        level new_l = hash_cons(succ_of(l));
+        if (is_eqp(new_l, succ_of(l)))
+            return global_find_or_insert(l);
+        return global_find_or_insert(level(new level_succ(new_l)));
+    }
+    case level_kind::Max: case level_kind::IMax: {
+        level const & lhs = to_max_core(l).m_lhs;
+        level const & rhs = to_max_core(l).m_rhs;
+        level new_lhs = hash_cons(lhs);
+        level new_rhs = hash_cons(rhs);
+        if (is_eqp(new_lhs, lhs) && is_eqp(new_rhs, rhs))
+            return global_find_or_insert(l);
+        return global_find_or_insert(level(new level_max_core(is_imax(l), new_lhs, new_rhs)));
+    }}
+    lean_unreachable(); // LCOV_EXCL_LINE
+}
+
+hash_cons_stats get_level_hash_cons_stats() {
+    return g_level_table->get_stats();
+}
+
 level::level():level(mk_level_zero()) {}
 level::level(level_cell * ptr):m_ptr(ptr) { if (m_ptr) m_ptr->inc_ref(); }
 level::level(level const & s):m_ptr(s.m_ptr) { if (m_ptr) m_ptr->inc_ref(); }
@@ -734,13 +803,16 @@ levels param_names_to_levels(level_param_names const & ps) {
 }
 
 void initialize_level() {
-    g_level_zero = new level(new level_cell(level_kind::Zero, 7u));
-    g_level_one  = new level(new level_succ(*g_level_zero));
+    g_level_table = new level_table();
+    g_level_zero  = new level(new level_cell(level_kind::Zero, 7u));
+    g_level_one   = new level(new level_succ(*g_level_zero));
 }
 
 void finalize_level() {
     delete g_level_one;
     delete g_level_zero;
+    delete g_level_table;
+    g_level_table = nullptr;
 }
 }
 void print(lean::level const & l) { std::cout << l << std::endl; }
@@ -13,6 +13,7 @@ Author: Leonardo de Moura
 #include "util/list.h"
 #include "util/sexpr/format.h"
 #include "util/sexpr/options.h"
+#include "kernel/hash_cons.h"
 
 namespace lean {
 class environment;
@@ -82,6 +83,10 @@ bool enable_level_caching(bool f);
 level cache(level const & l);
 bool is_cached(level const & l);
 void flush_level_cache();
+/** \brief Return a maximally shared universe level equal to \c l using the global hash-consing table.
+    It is the identity function if the global table is disabled (see enable_global_hash_consing). */
+level hash_cons(level const & l);
+hash_cons_stats get_level_hash_cons_stats();
 
 level const & mk_level_zero();
 level const & mk_level_one();
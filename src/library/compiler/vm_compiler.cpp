@@ -17,6 +17,7 @@ Author: Leonardo de Moura
 #include "library/quote.h"
 #include "library/replace_visitor.h"
 #include "library/vm/vm.h"
+#include "library/vm/vm_nat.h"
 #include "library/vm/optimize.h"
 #include "library/compiler/simp_inductive.h"
 #include "library/compiler/erase_irrelevant.h"
@@ -65,7 +66,10 @@ class vm_compiler_fn {
     void compile_global(vm_decl const & decl, unsigned nargs, expr const * args, unsigned bpz, name_map<unsigned> const & m) {
         compile_rev_args(nargs, args, bpz, m);
         if (decl.get_arity() <= nargs) {
-            if (decl.is_builtin())
+            optional<opcode> nat_op;
+            if (decl.is_cfun() && (nat_op = get_nat_opcode(decl.get_name())))
+                emit(mk_nat_instr(*nat_op));
+            else if (decl.is_builtin())
                 emit(mk_invoke_builtin_instr(decl.get_idx()));
             else if (decl.is_cfun())
                 emit(mk_invoke_cfun_instr(decl.get_idx()));
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "library/util.h"
+#include "library/decl_name_index.h"
+
+namespace lean {
+static unsigned mk_bigram(char c1, char c2) {
+    return (2u << 24) | (static_cast<unsigned char>(c1) << 8) | static_cast<unsigned char>(c2);
+}
+
+static unsigned mk_trigram(char c1, char c2, char c3) {
+    return (3u << 24) | (static_cast<unsigned char>(c1) << 16) | (static_cast<unsigned char>(c2) << 8) |
+        static_cast<unsigned char>(c3);
+}
+
+void decl_name_index::insert(buffer<name> const & ns) {
+    exclusive_lock lock(m_mutex);
+    for (name const & n : ns) {
+        if (is_internal_name(n) || !m_indexed.insert(n).second)
+            continue;
+        unsigned id = m_names.size();
+        m_names.push_back(n);
+        m_strings.push_back(n.to_string());
+        std::string const & s = m_strings.back();
+        auto add = [&](unsigned gram) {
+            std::vector<unsigned> & ps = m_postings[gram];
+            if (ps.empty() || ps.back() != id)
+                ps.push_back(id);
+        };
+        for (unsigned i = 0; i + 1 < s.size(); i++) {
+            add(mk_bigram(s[i], s[i+1]));
+            if (i + 2 < s.size())
+                add(mk_trigram(s[i], s[i+1], s[i+2]));
+        }
+    }
+}
+
+void decl_name_index::clear() {
+    exclusive_lock lock(m_mutex);
+    m_names.clear();
+    m_strings.clear();
+    m_indexed.clear();
+    m_postings.clear();
+}
+
+unsigned decl_name_index::size() const {
+    shared_lock lock(m_mutex);
+    return m_names.size();
+}
+
+std::vector<unsigned> const * decl_name_index::find_postings(unsigned gram) const {
+    auto it = m_postings.find(gram);
+    return it == m_postings.end() ? nullptr : &it->second;
+}
+
+bool decl_name_index::find_candidates(std::string const & pattern, unsigned k, buffer<name> & r) const {
+    unsigned num_pieces = k + 1;
+    unsigned sz         = pattern.size();
+    if (sz < 2 * num_pieces)
+        return false;
+    shared_lock lock(m_mutex);
+    std::vector<unsigned> ids;
+    unsigned offset = 0;
+    for (unsigned i = 0; i < num_pieces; i++) {
+        unsigned len      = sz / num_pieces + (i < sz % num_pieces ? 1 : 0);
+        std::string piece = pattern.substr(offset, len);
+        offset += len;
+        /* Use the shortest posting list of the grams in the piece, and then check whether the piece occurs in the
+           candidate. */
+        std::vector<unsigned> const * best = nullptr;
+        bool missing = false;
+        if (len == 2) {
+            best    = find_postings(mk_bigram(piece[0], piece[1]));
+            missing = best == nullptr;
+        } else {
+            for (unsigned j = 0; j + 2 < len; j++) {
+                std::vector<unsigned> const * ps = find_postings(mk_trigram(piece[j], piece[j+1], piece[j+2]));
+                if (!ps) {
+                    missing = true;
+                    break;
+                }
+                if (!best || ps->size() < best->size())
+                    best = ps;
+            }
+        }
+        if (missing)
+            continue;
+        for (unsigned id : *best) {
+            if (m_strings[id].find(piece) != std::string::npos)
+                ids.push_back(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    for (unsigned id : ids)
+        r.push_back(m_names[id]);
+    return true;
+}
+
+static decl_name_index * g_decl_name_index = nullptr;
+
+decl_name_index & get_decl_name_index() {
+    return *g_decl_name_index;
+}
+
+void initialize_decl_name_index() {
+    g_decl_name_index = new decl_name_index();
+}
+
+void finalize_decl_name_index() {
+    delete g_decl_name_index;
+}
+}
@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "util/buffer.h"
+#include "util/name_hash_set.h"
+#include "util/shared_mutex.h"
+
+namespace lean {
+/** \brief Index for approximate string matching over the (non-internal) declaration names of the
+    loaded modules. It is used to implement the server commands `complete` and `search`.
+
+    For each name, we store its string representation, and postings for all bigrams and trigrams occurring in it.
+    A pattern that occurs in a string with at most k errors (see bitap_fuzzy_search) can be split into k+1 pieces
+    such that at least one of them occurs in the string without errors. So, the candidates for a query are
+    the names that contain one of the pieces. */
+class decl_name_index {
+    mutable shared_mutex                                m_mutex;
+    std::vector<name>                                   m_names;
+    std::vector<std::string>                            m_strings;
+    name_hash_set                                       m_indexed;
+    std::unordered_map<unsigned, std::vector<unsigned>> m_postings;
+    std::vector<unsigned> const * find_postings(unsigned gram) const;
+public:
+    /** \brief Add the given names to the index, names that have already been indexed are ignored. */
+    void insert(buffer<name> const & ns);
+    void clear();
+    unsigned size() const;
+    bool empty() const { return size() == 0; }
+
+    /** \brief Store in \c r the indexed names whose string representation may contain \c pattern with at most
+        \c k errors. Return false if \c pattern is too short to be used for filtering, in this case the caller
+        must consider all names. */
+    bool find_candidates(std::string const & pattern, unsigned k, buffer<name> & r) const;
+};
+
+/** \brief Return the declaration name index shared by all module managers of this process. */
+decl_name_index & get_decl_name_index();
+
+void initialize_decl_name_index();
+void finalize_decl_name_index();
+}
@@ -36,6 +36,7 @@ Author: Leonardo de Moura
 #include "library/noncomputable.h"
 #include "library/aux_recursors.h"
 #include "library/type_context.h"
+#include "library/persistent_instance_cache.h"
 #include "library/local_context.h"
 #include "library/metavar_context.h"
 #include "library/attribute_manager.h"
@@ -53,6 +54,7 @@ Author: Leonardo de Moura
 #include "library/check.h"
 #include "library/parray.h"
 #include "library/profiling.h"
+#include "library/decl_name_index.h"
 
 namespace lean {
 void initialize_library_core_module() {
@@ -107,6 +109,7 @@ void initialize_library_module() {
     initialize_fun_info();
     initialize_unification_hint();
     initialize_type_context();
+    initialize_persistent_instance_cache();
     initialize_delayed_abstraction();
     initialize_mpq_macro();
     initialize_inverse();
@@ -117,9 +120,11 @@ void initialize_library_module() {
     initialize_check();
     initialize_congr_lemma();
     initialize_parray();
+    initialize_decl_name_index();
 }
 
 void finalize_library_module() {
+    finalize_decl_name_index();
     finalize_parray();
     finalize_congr_lemma();
     finalize_check();
@@ -130,6 +135,7 @@ void finalize_library_module() {
     finalize_inverse();
     finalize_mpq_macro();
     finalize_delayed_abstraction();
+    finalize_persistent_instance_cache();
     finalize_type_context();
     finalize_unification_hint();
     finalize_fun_info();
@@ -20,6 +20,9 @@ Author: Leonardo de Moura
 #include "util/interrupt.h"
 #include "util/name_map.h"
 #include "util/file_lock.h"
+#include "util/flet.h"
+#include "util/mapped_file.h"
+#include "util/timeit.h"
 #include "kernel/type_checker.h"
 #include "kernel/quotient/quotient.h"
 #include "library/module.h"
@@ -30,6 +33,7 @@ Author: Leonardo de Moura
 #include "library/unfold_macros.h"
 #include "library/module_mgr.h"
 #include "library/library_task_builder.h"
+#include "library/profiling.h"
 
 namespace lean {
 corrupted_file_exception::corrupted_file_exception(std::string const & fname):
@@ -66,6 +70,16 @@ list<name> const & get_curr_module_decl_names(environment const & env) {
     return get_extension(env).m_module_decls;
 }
 
+void get_introduced_decl_names(modification_list const & mods, buffer<name> & r) {
+    for (auto const & m : mods)
+        m->get_introduced_decl_names(r);
+}
+
+void get_curr_module_introduced_decl_names(environment const & env, buffer<name> & r) {
+    for (auto const & m : get_extension(env).m_modifications)
+        m->get_introduced_decl_names(r);
+}
+
 list<name> const & get_curr_module_univ_names(environment const & env) {
     return get_extension(env).m_module_univs;
 }
@@ -130,6 +144,9 @@ struct pos_info_mod : public modification {
         s << m_decl_name << m_pos_info.first << m_pos_info.second;
     }
 
+    /* Importing modules do not depend on the positions of the declarations. */
+    void serialize_interface(serializer &) const override {}
+
     static std::shared_ptr<modification const> deserialize(deserializer & d) {
         name decl_name; unsigned line, column;
         d >> decl_name >> line >> column;
@@ -187,11 +204,40 @@ deserializer & operator>>(deserializer & d, module_name & r) {
     return d;
 }
 
-static unsigned olean_hash(std::string const & data) {
-    return hash(data.size(), [&] (unsigned i) { return static_cast<unsigned char>(data[i]); });
+static uint64 olean_hash(char const * data, size_t sz, bool uses_sorry, olean_stamp const & stamp) {
+    uint64 h = hash_str64(sz, data);
+    h = hash(h, static_cast<uint64>(uses_sorry));
+    for (uint64 import_hash : stamp.m_import_hashes)
+        h = hash(h, import_hash);
+    return h;
 }
 
-void write_module(loaded_module const & mod, std::ostream & out) {
+uint64 get_olean_build_key(olean_stamp const & stamp) {
+    std::string version = get_version_string();
+    uint64 h = hash_str64(version.size(), version.data());
+    h = hash(h, stamp.m_src_hash);
+    for (uint64 import_hash : stamp.m_import_hashes)
+        h = hash(h, import_hash);
+    return h;
+}
+
+uint64 get_interface_hash(loaded_module const & mod, std::vector<uint64> const & import_hashes) {
+    std::ostringstream out(std::ios_base::binary);
+    {
+        serializer s(out);
+        for (auto p : mod.m_modifications) {
+            s << std::string(p->get_key());
+            p->serialize_interface(s);
+        }
+    }
+    std::string r = out.str();
+    uint64 h = hash_str64(r.size(), r.data());
+    for (uint64 import_hash : import_hashes)
+        h = hash(h, import_hash);
+    return h;
+}
+
+void write_module(loaded_module const & mod, olean_stamp const & stamp, std::ostream & out) {
     std::ostringstream out1(std::ios_base::binary);
     serializer s1(out1);
 
@@ -207,18 +253,23 @@ void write_module(loaded_module const & mod, std::ostream & out) {
     }
 
     std::string r = out1.str();
-    unsigned h    = olean_hash(r);
 
     bool uses_sorry = get(mod.m_uses_sorry);
+    uint64 h        = olean_hash(r.data(), r.size(), uses_sorry, stamp);
+    uint64 ih       = get_interface_hash(mod, stamp.m_import_hashes);
 
     serializer s2(out);
     s2 << g_olean_header << get_version_string();
-    s2 << h;
+    s2 << h << ih;
     s2 << uses_sorry;
     // store imported files
     s2 << static_cast<unsigned>(mod.m_imports.size());
     for (auto m : mod.m_imports)
         s2 << m;
+    // store the stamp
+    s2 << stamp.m_src_hash << static_cast<unsigned>(stamp.m_import_hashes.size());
+    for (uint64 import_hash : stamp.m_import_hashes)
+        s2 << import_hash;
     // store object code
     s2.write_blob(r);
 }
@@ -265,6 +316,41 @@ struct import_helper {
     }
 };
 
+/* The .olean file being parsed by parse_olean_modifications in the current thread.
+   It is used to create the lazy declarations stored in decl_modification. */
+LEAN_THREAD_PTR(olean_data const, g_curr_olean);
+
+/* Deserialize the type and value of a declaration stored in an .olean file.
+   The type and value are stored in a blob with its own sharing tables (see decl_modification::serialize),
+   so they can be read without deserializing any other part of the file. */
+class olean_declaration_loader : public declaration_loader {
+    std::shared_ptr<mapped_file const> m_file;
+    char const *                       m_begin;
+    unsigned                           m_size;
+    bool                               m_has_value;
+public:
+    olean_declaration_loader(std::shared_ptr<mapped_file const> const & file, char const * begin, unsigned size,
+                             bool has_value):
+        m_file(file), m_begin(begin), m_size(size), m_has_value(has_value) {}
+
+    pair<expr, optional<expr>> load() const override {
+        memory_istream in(m_begin, m_begin + m_size);
+        scoped_expr_caching enable_caching(false);
+        deserializer d(in, optional<std::string>(m_file->get_file_name()));
+        expr type = read_expr(d);
+        optional<expr> value;
+        if (m_has_value)
+            value = read_expr(d);
+        if (!in.good())
+            throw corrupted_file_exception(m_file->get_file_name());
+        /* share the terms with the ones loaded from other modules */
+        type = hash_cons(type);
+        if (value)
+            value = hash_cons(*value);
+        return mk_pair(type, value);
+    }
+};
+
 struct decl_modification : public modification {
     LEAN_MODIFICATION("decl")
 
@@ -293,13 +379,63 @@ struct decl_modification : public modification {
         env = import_helper::add_unchecked(env, decl);
     }
 
+    void get_introduced_decl_names(buffer<name> & r) const override {
+        r.push_back(m_decl.get_name());
+    }
+
+    /* We store the name, universe parameters, kind and reducibility hints of the declaration eagerly, since
+       they are needed when the declaration is added to the environment. The type and value are stored in a
+       blob that is only deserialized when the declaration is first used (see olean_declaration_loader). */
     void serialize(serializer & s) const override {
-        s << m_decl << m_trust_lvl;
+        char k = 0;
+        if (m_decl.is_definition())
+            k |= 1;
+        if (m_decl.is_theorem() || m_decl.is_axiom())
+            k |= 2;
+        if (m_decl.is_trusted())
+            k |= 4;
+        s << m_decl.get_name() << m_decl.get_univ_params() << k;
+        if (m_decl.is_definition() && !m_decl.is_theorem())
+            s << m_decl.get_hints();
+        s << m_trust_lvl;
+
+        std::ostringstream out(std::ios_base::binary);
+        {
+            serializer body(out);
+            body << m_decl.get_type();
+            if (m_decl.is_definition())
+                body << m_decl.get_value();
+        }
+        s.write_blob(out.str());
+    }
+
+    void serialize_interface(serializer & s) const override {
+        if (m_decl.is_theorem()) {
+            s << m_decl.get_name() << m_decl.get_univ_params() << m_decl.get_type();
+        } else {
+            serialize(s);
+        }
     }
 
     static std::shared_ptr<modification const> deserialize(deserializer & d) {
-        auto decl = read_declaration(d);
+        name n               = read_name(d);
+        level_param_names ps = read_level_params(d);
+        char k               = d.read_char();
+        bool has_value       = (k & 1) != 0;
+        bool is_th_ax        = (k & 2) != 0;
+        bool is_trusted      = (k & 4) != 0;
+        reducibility_hints hints = reducibility_hints::mk_opaque();
+        if (has_value && !is_th_ax)
+            hints = read_hints(d);
         unsigned trust_lvl; d >> trust_lvl;
+        auto body = d.skip_blob();
+        lean_assert(g_curr_olean);
+        if (body.first < 0 || static_cast<size_t>(body.first) + body.second > g_curr_olean->m_code_size)
+            throw corrupted_file_exception(g_curr_olean->m_file->get_file_name());
+        auto loader = std::make_shared<olean_declaration_loader>(g_curr_olean->m_file,
+                                                                 g_curr_olean->m_code + body.first, body.second,
+                                                                 has_value);
+        auto decl = mk_lazy_declaration(n, ps, has_value, is_th_ax, hints, is_trusted, loader);
         return std::make_shared<decl_modification>(std::move(decl), trust_lvl);
     }
 
@@ -357,6 +493,14 @@ struct inductive_modification : public modification {
         for (auto & i : m_decl.get_decl().m_intro_rules)
             es.push_back(mk_pure_task(i));
     }
+
+    void get_introduced_decl_names(buffer<name> & r) const override {
+        inductive::inductive_decl const & decl = m_decl.get_decl();
+        r.push_back(decl.m_name);
+        for (auto & i : decl.m_intro_rules)
+            r.push_back(inductive::intro_rule_name(i));
+        r.push_back(inductive::get_elim_name(decl.m_name));
+    }
 };
 
 struct quot_modification : public modification {
@@ -371,6 +515,13 @@ struct quot_modification : public modification {
     static std::shared_ptr<modification const> deserialize(deserializer &) {
         return std::make_shared<quot_modification>();
     }
+
+    void get_introduced_decl_names(buffer<name> & r) const override {
+        r.push_back(name("quot"));
+        r.push_back(name{"quot", "mk"});
+        r.push_back(name{"quot", "lift"});
+        r.push_back(name{"quot", "ind"});
+    }
 };
 
 namespace module {
@@ -488,14 +639,21 @@ environment add_inductive(environment                       env,
 }
 } // end of namespace module
 
-bool is_candidate_olean_file(std::string const & file_name) {
-    std::ifstream in(file_name);
-    deserializer d1(in, optional<std::string>(file_name));
+static olean_stamp read_olean_stamp(std::istream & in, deserializer & d) {
+    olean_stamp stamp;
+    d >> stamp.m_src_hash;
+    unsigned num_import_hashes = d.read_unsigned();
+    for (unsigned i = 0; i < num_import_hashes && in.good(); i++)
+        stamp.m_import_hashes.push_back(d.read_uint64());
+    return stamp;
+}
+
+static bool read_olean_version(deserializer & d) {
     std::string header, version;
-    d1 >> header;
+    d >> header;
     if (header != g_olean_header)
         return false;
-    d1 >> version;
+    d >> version;
 #ifndef LEAN_IGNORE_OLEAN_VERSION
     if (version != get_version_string())
         return false;
@@ -503,17 +661,51 @@ bool is_candidate_olean_file(std::string const & file_name) {
     return true;
 }
 
-olean_data parse_olean(std::istream & in, std::string const & file_name, bool check_hash) {
+bool is_candidate_olean_file(std::string const & file_name) {
+    std::ifstream in(file_name);
+    deserializer d1(in, optional<std::string>(file_name));
+    return read_olean_version(d1);
+}
+
+optional<pair<uint64, olean_stamp>> read_olean_header(std::string const & file_name) {
+    typedef optional<pair<uint64, olean_stamp>> result;
+    try {
+        std::ifstream in(file_name, std::ios_base::binary);
+        if (!in.good())
+            return result();
+        deserializer d1(in, optional<std::string>(file_name));
+        if (!read_olean_version(d1))
+            return result();
+        d1.read_uint64(); // hash
+        uint64 ih = d1.read_uint64();
+        d1.read_bool();   // uses_sorry
+        unsigned num_imports = d1.read_unsigned();
+        for (unsigned i = 0; i < num_imports && in.good(); i++) {
+            module_name r;
+            d1 >> r;
+        }
+        olean_stamp stamp = read_olean_stamp(in, d1);
+        if (!in.good())
+            return result();
+        return result(ih, stamp);
+    } catch (exception &) {
+        return result();
+    }
+}
+
+olean_data parse_olean(std::shared_ptr<mapped_file const> const & file, bool check_hash) {
     std::vector<module_name> imports;
     bool uses_sorry;
 
+    std::string const & file_name = file->get_file_name();
+    memory_istream in(file->data(), file->data() + file->size());
     deserializer d1(in, optional<std::string>(file_name));
     std::string header, version;
-    unsigned claimed_hash;
+    uint64 claimed_hash, interface_hash;
     d1 >> header;
     if (header != g_olean_header)
         throw exception(sstream() << "file '" << file_name << "' does not seem to be a valid object Lean file, invalid header");
-    d1 >> version >> claimed_hash;
+    d1 >> version >> claimed_hash >> interface_hash;
     // version has already been checked in `is_candidate_olean_file`
 
     d1 >> uses_sorry;
@@ -525,54 +717,122 @@ olean_data parse_olean(std::istream & in, std::string const & file_name, bool ch
         imports.push_back(r);
     }
 
-    auto code = d1.read_blob();
+    olean_stamp stamp = read_olean_stamp(in, d1);
 
-    if (!in.good()) {
+    auto code = d1.skip_blob();
+
+    if (!in.good() || code.first < 0 || static_cast<size_t>(code.first) + code.second > file->size()) {
         throw exception(sstream() << "file '" << file_name << "' has been corrupted");
     }
+    char const * code_begin = file->data() + code.first;
 
 //    if (m_senv.env().trust_lvl() <= LEAN_BELIEVER_TRUST_LEVEL) {
     if (check_hash) {
-        unsigned computed_hash = olean_hash(code);
+        uint64 computed_hash = olean_hash(code_begin, code.second, uses_sorry, stamp);
         if (claimed_hash != computed_hash)
             throw exception(sstream() << "file '" << file_name << "' has been corrupted, checksum mismatch");
     }
 
-    return { imports, code, uses_sorry };
+    return { imports, file, code_begin, code.second, uses_sorry, stamp, claimed_hash, interface_hash };
 }
 
-static void import_module(environment & env, std::string const & module_file_name, module_name const & ref,
-                          module_loader const & mod_ldr, buffer<import_error> & import_errors) {
-    try {
-        auto res = mod_ldr(module_file_name, ref);
+/* Imports are processed in two phases.
 
-        auto & ext0 = get_extension(env);
-        if (ext0.m_imported.contains(res->m_module_name)) return;
+   First we walk the import DAG and obtain the loaded module for each node, in depth-first post-order.
+   This is a deterministic topological order. Module loaders may deserialize the modifications of
+   each module on the task_queue workers (see module_mgr::build_module), so independent subtrees of the
+   DAG are deserialized in parallel while we walk it.
 
-        if (ext0.m_imported.empty() && res->m_env) {
-            env = get(res->m_env);
-        } else {
-            for (auto &dep : res->m_imports) {
-                import_module(env, res->m_module_name, dep, mod_ldr, import_errors);
+   Then the modifications are performed on the environment sequentially, in the order computed above.
+   When profiling is enabled, the time spent waiting for and performing each module is reported
+   in the current log_tree node. */
+class import_engine {
+    struct entry {
+        std::string                          m_importer;
+        module_name                          m_ref;
+        std::shared_ptr<loaded_module const> m_mod;
+        second_duration                      m_load_time;
+    };
+    module_loader const &  m_mod_ldr;
+    buffer<import_error> & m_import_errors;
+    environment            m_env;
+    name_set               m_visited;
+    std::vector<entry>     m_order;
+    bool                   m_profile;
+    second_duration        m_profile_threshold;
+
+    void mark_imported(std::string const & module_name) {
+        auto ext = get_extension(m_env);
+        ext.m_imported.insert(module_name);
+        m_env = update(m_env, ext);
+    }
+
+    void report_time(entry const & e, second_duration perform_time) {
+        if (!m_profile || !has_logtree() || e.m_load_time + perform_time < m_profile_threshold)
+            return;
+        report_message(message(logtree().get_location().m_file_name, logtree().get_location().m_range.m_begin,
+                               INFORMATION, (sstream() << "import of '" << e.m_mod->m_module_name << "' took "
+                                             << display_profiling_time{e.m_load_time + perform_time}
+                                             << " (loading: " << display_profiling_time{e.m_load_time} << ")\n").str()));
+    }
+
+public:
+    import_engine(environment const & env, module_loader const & mod_ldr, buffer<import_error> & import_errors):
+        m_mod_ldr(mod_ldr), m_import_errors(import_errors), m_env(env),
+        m_visited(get_extension(env).m_imported) {
+        options const & opts = get_global_ios().get_options();
+        m_profile           = get_profiler(opts);
+        m_profile_threshold = get_profiling_threshold(opts);
+    }
+
+    void collect(std::string const & module_file_name, module_name const & ref) {
+        try {
+            auto start = std::chrono::steady_clock::now();
+            auto res   = m_mod_ldr(module_file_name, ref);
+            second_duration load_time(std::chrono::steady_clock::now() - start);
+
+            if (m_visited.contains(res->m_module_name)) return;
+
+            if (m_visited.empty() && res->m_env) {
+                /* nothing has been imported yet, reuse the preimported environment of this module */
+                m_env     = get(res->m_env);
+                mark_imported(res->m_module_name);
+                m_visited = get_extension(m_env).m_imported;
+                return;
             }
-            import_module(res->m_modifications, res->m_module_name, env);
+
+            for (auto & dep : res->m_imports)
+                collect(res->m_module_name, dep);
+            m_visited.insert(res->m_module_name);
+            m_order.push_back({module_file_name, ref, res, load_time});
+        } catch (throwable) {
+            m_import_errors.push_back({module_file_name, ref, std::current_exception()});
         }
+    }
 
-        auto ext = get_extension(env);
-        ext.m_imported.insert(res->m_module_name);
-        env = update(env, ext);
-    } catch (throwable) {
-        import_errors.push_back({module_file_name, ref, std::current_exception()});
+    environment merge() {
+        for (entry const & e : m_order) {
+            try {
+                auto start = std::chrono::steady_clock::now();
+                import_module(e.m_mod->m_modifications, e.m_mod->m_module_name, m_env);
+                mark_imported(e.m_mod->m_module_name);
+                report_time(e, second_duration(std::chrono::steady_clock::now() - start));
+            } catch (throwable) {
+                m_import_errors.push_back({e.m_importer, e.m_ref, std::current_exception()});
+            }
+        }
+        m_order.clear();
+        return m_env;
     }
-}
+};
 
 environment import_modules(environment const & env0, std::string const & module_file_name,
                            std::vector<module_name> const & refs, module_loader const & mod_ldr,
                            buffer<import_error> & import_errors) {
-    environment env = env0;
-
+    import_engine engine(env0, mod_ldr, import_errors);
     for (auto & ref : refs)
-        import_module(env, module_file_name, ref, mod_ldr, import_errors);
+        engine.collect(module_file_name, ref);
+    environment env = engine.merge();
 
     module_ext ext = get_extension(env);
     ext.m_direct_imports = refs;
@@ -588,11 +848,11 @@ environment import_modules(environment const & env0, std::string const & module_
 }
 
 static environment mk_preimported_module(environment const & initial_env, loaded_module const & lm, module_loader const & mod_ldr) {
-    auto env = initial_env;
     buffer<import_error> import_errors;
-    for (auto & dep : lm.m_imports) {
-        import_module(env, lm.m_module_name, dep, mod_ldr, import_errors);
-    }
+    import_engine engine(initial_env, mod_ldr, import_errors);
+    for (auto & dep : lm.m_imports)
+        engine.collect(lm.m_module_name, dep);
+    auto env = engine.merge();
     if (!import_errors.empty()) std::rethrow_exception(import_errors.back().m_ex);
     import_module(lm.m_modifications, lm.m_module_name, env);
     return env;
@@ -613,9 +873,10 @@ std::shared_ptr<loaded_module const> cache_preimported_env(
     return lm;
 }
 
-modification_list parse_olean_modifications(std::string const & olean_code, std::string const & file_name) {
+modification_list parse_olean_modifications(olean_data const & olean, std::string const & file_name) {
     modification_list ms;
-    std::istringstream in(olean_code, std::ios_base::binary);
+    memory_istream in(olean.m_code, olean.m_code + olean.m_code_size);
+    flet<olean_data const *> set_olean(g_curr_olean, &olean);
     scoped_expr_caching enable_caching(false);
     deserializer d(in, optional<std::string>(file_name));
     object_readers & readers = get_object_readers();
@@ -659,9 +920,8 @@ module_loader mk_olean_loader(std::vector<std::string> const & path) {
     return[=] (std::string const & module_fn, module_name const & ref) {
         auto base_dir = dirname(module_fn);
         auto fn = find_file(path, base_dir, ref.m_relative, ref.m_name, ".olean");
-        std::ifstream in(fn, std::ios_base::binary);
-        auto parsed = parse_olean(in, fn, check_hash);
-        auto modifs = parse_olean_modifications(parsed.m_serialized_modifications, fn);
+        auto parsed = parse_olean(std::make_shared<mapped_file const>(fn), check_hash);
+        auto modifs = parse_olean_modifications(parsed, fn);
         return std::make_shared<loaded_module>(
                 loaded_module { fn, parsed.m_imports, modifs,
                                 mk_pure_task<bool>(parsed.m_uses_sorry), {} });
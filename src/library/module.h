@@ -11,6 +11,7 @@ Author: Leonardo de Moura
 #include <vector>
 #include "util/serializer.h"
 #include "util/optional.h"
+#include "util/mapped_file.h"
 #include "kernel/pos_info_provider.h"
 #include "kernel/inductive/inductive.h"
 #include "library/io_state.h"
@@ -47,6 +48,11 @@ module_loader mk_dummy_loader();
 
 /** \brief Return the list of declarations performed in the current module */
 list<name> const & get_curr_module_decl_names(environment const & env);
+/** \brief Store in \c r the names of the declarations added by the given modifications. Remark: in contrast to
+    get_curr_module_decl_names, it includes constructors and recursors of inductive datatypes. */
+void get_introduced_decl_names(modification_list const & mods, buffer<name> & r);
+/** \brief Store in \c r the names of all declarations added by the current module. */
+void get_curr_module_introduced_decl_names(environment const & env, buffer<name> & r);
 /** \brief Return the list of universes declared in the current module */
 list<name> const & get_curr_module_univ_names(environment const & env);
 /** \brief Return the list of modules directly imported by the current module */
@@ -84,9 +90,32 @@ optional<pos_info> get_decl_pos_info(environment const & env, name const & decl_
     .olean files. We use this function for attaching position information to temporary functions. */
 environment add_transient_decl_pos_info(environment const & env, name const & decl_name, pos_info const & pos);
 
+/** \brief Information stored in the header of an .olean file for deciding whether it is up to date,
+    i.e., whether it was produced from the current contents of the .lean file and imported .olean files. */
+struct olean_stamp {
+    /* Hash of the contents of the .lean file. */
+    uint64              m_src_hash = 0;
+    /* Interface hashes of the imported modules (see get_interface_hash), in the order of the imports. */
+    std::vector<uint64> m_import_hashes;
+};
+inline bool operator==(olean_stamp const & s1, olean_stamp const & s2) {
+    return s1.m_src_hash == s2.m_src_hash && s1.m_import_hashes == s2.m_import_hashes;
+}
+
+/** \brief Return the key identifying the .olean file produced by this version of Lean from a .lean file
+    and imported modules with the given hashes. */
+uint64 get_olean_build_key(olean_stamp const & stamp);
+
+/** \brief Return the interface hash of \c mod, given the interface hashes of its imports (in the order of
+    <tt>mod.m_imports</tt>). It only covers what modules importing \c mod depend on (see
+    modification::serialize_interface), e.g., the types of the declarations but not the proofs of the theorems.
+    Thus, importing modules do not need to be rebuilt when it does not change. */
+uint64 get_interface_hash(loaded_module const & mod, std::vector<uint64> const & import_hashes);
+
 /** \brief Store/Export module using \c env. */
 loaded_module export_module(environment const & env, std::string const & mod_name);
-void write_module(loaded_module const & mod, std::ostream & out);
+void write_module(loaded_module const & mod, olean_stamp const & stamp, std::ostream & out);
+inline void write_module(loaded_module const & mod, std::ostream & out) { write_module(mod, olean_stamp(), out); }
 
 std::shared_ptr<loaded_module const> cache_preimported_env(
         loaded_module &&, environment const & initial_env,
@@ -94,14 +123,30 @@ std::shared_ptr<loaded_module const> cache_preimported_env(
 
 /** \brief Check whether we should try to load the given .olean file according to its header and Lean version. */
 bool is_candidate_olean_file(std::string const & file_name);
+/** \brief Return the interface hash and the stamp stored in the header of the given .olean file,
+    or none if it is not a candidate .olean file. */
+optional<pair<uint64, olean_stamp>> read_olean_header(std::string const & file_name);
 
 struct olean_data {
     std::vector<module_name> m_imports;
-    std::string m_serialized_modifications;
+    /* Declarations are deserialized lazily from the .olean file, so the modifications
+       parsed from it keep it alive. */
+    std::shared_ptr<mapped_file const> m_file;
+    /* Location of the serialized modifications inside m_file. */
+    char const * m_code;
+    size_t m_code_size;
     bool m_uses_sorry;
+    olean_stamp m_stamp;
+    /* Hash of the serialized modifications, of m_uses_sorry and of the stamp's import hashes. */
+    uint64 m_hash;
+    /* See get_interface_hash. */
+    uint64 m_interface_hash;
 };
-olean_data parse_olean(std::istream & in, std::string const & file_name, bool check_hash = true);
-modification_list parse_olean_modifications(std::string const & serialized_modifications, std::string const & file_name);
+olean_data parse_olean(std::shared_ptr<mapped_file const> const & file, bool check_hash = true);
+/** \brief Deserialize the modifications stored in the given .olean file.
+    Declarations are not deserialized here, only an entry recording their name, kind and location
+    in the file. Their type and value are read the first time they are accessed. */
+modification_list parse_olean_modifications(olean_data const & olean, std::string const & file_name);
 void import_module(modification_list const & modifications, std::string const & file_name, environment & env);
 
 struct modification {
@@ -110,10 +155,16 @@ public:
     virtual const char * get_key() const = 0;
     virtual void perform(environment &) const = 0;
     virtual void serialize(serializer &) const = 0;
+    /* Serialize the information that importing modules depend on, used to compute the interface hash
+       (see get_interface_hash). This must not wait for the proofs of theorems. */
+    virtual void serialize_interface(serializer & s) const { serialize(s); }
     virtual void get_task_dependencies(buffer<gtask> &) const {}
 
     // Used to check for sorrys.
     virtual void get_introduced_exprs(std::vector<task<expr>> &) const {}
+
+    // Used to index the declarations of a module (see decl_name_index).
+    virtual void get_introduced_decl_names(buffer<name> &) const {}
 };
 
 #define LEAN_MODIFICATION(k) \
@@ -8,14 +8,19 @@ Author: Gabriel Ebner
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <cstdio>
 #include "util/utf8.h"
 #include "util/lean_path.h"
 #include "util/file_lock.h"
+#include "util/timeit.h"
+#include "util/sstream.h"
 #include "library/module_mgr.h"
 #include "library/module.h"
 #include "frontends/lean/pp.h"
 #include "frontends/lean/parser.h"
 #include "library/library_task_builder.h"
+#include "library/profiling.h"
+#include "library/decl_name_index.h"
 
 namespace lean {
 
@@ -41,17 +46,87 @@ environment module_info::get_latest_env() const {
     return environment();
 }
 
-void module_mgr::mark_out_of_date(module_id const & id) {
-    for (auto & mod : m_modules) {
-        if (!mod.second || mod.second->m_out_of_date) continue;
-        for (auto & dep : mod.second->m_deps) {
-            if (dep.m_id == id) {
-                mod.second->m_out_of_date = true;
-                mark_out_of_date(mod.first);
-                break;
+/* Return the interface hash of \c mod if it is available. If \c wait is true, we wait until the module
+   has been elaborated (but not until the proofs of its theorems have been checked). */
+static optional<uint64> get_interface_hash(module_info const & mod, bool wait) {
+    if (!mod.m_interface_hash)
+        return optional<uint64>();
+    if (wait) {
+        try {
+            get(mod.m_interface_hash);
+        } catch (...) {}
+    }
+    return peek(mod.m_interface_hash);
+}
+
+/* Return the interface hashes of the imports of \c lm (see get_interface_hash), \c deps are the dependencies
+   of the module producing \c lm. */
+static std::vector<uint64> get_import_hashes(loaded_module const & lm,
+                                             std::vector<module_info::dependency> const & deps) {
+    std::vector<uint64> hashes;
+    for (module_name const & import : lm.m_imports) {
+        module_info const * d_mod = nullptr;
+        for (auto & d : deps) {
+            if (d.m_mod_info && d.m_import_name.m_name == import.m_name &&
+                d.m_import_name.m_relative == import.m_relative)
+                d_mod = d.m_mod_info.get();
+        }
+        if (!d_mod || !d_mod->m_interface_hash)
+            throw exception(sstream() << "could not resolve import: " << import.m_name);
+        hashes.push_back(get(d_mod->m_interface_hash));
+    }
+    return hashes;
+}
+
+module_mgr::~module_mgr() {
+    lock_guard<recursive_mutex> lock(m_checker->m_mutex);
+    m_checker->m_mgr = nullptr;
+}
+
+/* Rebuild the modules importing \c id that were built using a version of \c id with a different interface hash.
+   Thus, the modules importing a module are not rebuilt when only the proof of a theorem has changed. */
+void module_mgr::check_dependents(module_id const & id) {
+    auto mod = m_modules[id];
+    if (!mod || !mod->m_interface_hash || !mod->m_interface_hash->peek_is_finished())
+        return; // the module has been rebuilt again, the new version will be checked when it is ready
+    auto new_hash = peek(mod->m_interface_hash);
+    buffer<module_id> to_rebuild;
+    for (auto & m : m_modules) {
+        if (!m.second || m.second->m_out_of_date) continue;
+        for (auto & d : m.second->m_deps) {
+            if (d.m_id != id || d.m_mod_info == mod) continue;
+            optional<uint64> old_hash;
+            if (d.m_mod_info)
+                old_hash = get_interface_hash(*d.m_mod_info, false);
+            if (!new_hash || !old_hash || *new_hash != *old_hash) {
+                m.second->m_out_of_date = true;
+                to_rebuild.push_back(m.first);
             }
+            break;
         }
     }
+    for (auto & i : to_rebuild) {
+        try {
+            build_module(i, true, {});
+        } catch (...) {}
+        check_dependents_when_ready(i);
+    }
+}
+
+void module_mgr::check_dependents_when_ready(module_id const & id) {
+    auto mod = m_modules[id];
+    if (!mod || !mod->m_interface_hash)
+        return;
+    auto checker = m_checker;
+    task_builder<unit>([checker, id] {
+        lock_guard<recursive_mutex> lock(checker->m_mutex);
+        if (module_mgr * mgr = checker->m_mgr) {
+            lock_guard<recursive_mutex> lock2(mgr->m_mutex);
+            mgr->check_dependents(id);
+        }
+        return unit();
+    }).depends_on(mod->m_interface_hash).wrap(library_scopes(log_tree::node()))
+      .set_cancellation_token(nullptr).build();
 }
 
 static module_loader mk_loader(module_id const & cur_mod, std::vector<module_info::dependency> const & deps) {
@@ -94,7 +169,48 @@ static module_loader mk_loader(module_id const & cur_mod, std::vector<module_inf
     };
 }
 
-static gtask compile_olean(std::shared_ptr<module_info const> const & mod, log_tree::node const & parsing_lt) {
+/* In server mode, the declarations of the loaded modules are indexed for the `complete` and `search` commands.
+   The index is updated before any module importing \c lm is processed. */
+static void index_decl_names(loaded_module const & lm) {
+    buffer<name> ns;
+    get_introduced_decl_names(lm.m_modifications, ns);
+    get_decl_name_index().insert(ns);
+}
+
+/* Return the name of the entry of the .olean cache \c cache_dir for an .olean file with the given stamp. */
+static std::string get_olean_cache_file(std::string const & cache_dir, olean_stamp const & stamp) {
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(get_olean_build_key(stamp)));
+    return cache_dir + get_dir_sep() + key + ".olean";
+}
+
+/* Copy the .olean file \c from to \c to. The caller must hold a lock on \c to.
+   Imported .olean files are memory mapped and their declarations are loaded lazily,
+   so we must never overwrite one in place. We write to a temporary file and rename it instead. */
+static void copy_olean(std::string const & from, std::string const & to) {
+    std::string contents = read_file(from, std::ios_base::binary);
+    auto tmp_fn = to + ".tmp";
+    std::ofstream out(tmp_fn, std::ios_base::binary);
+    out.write(contents.data(), contents.size());
+    out.close();
+    if (!out) throw exception(sstream() << "failed to write olean file '" << to << "'");
+#if defined(LEAN_WINDOWS) && !defined(LEAN_CYGWIN)
+    std::remove(to.c_str());
+#endif
+    if (std::rename(tmp_fn.c_str(), to.c_str()) != 0)
+        throw exception(sstream() << "failed to write olean file '" << to << "'");
+}
+
+/* Return the stamp of the .olean file for \c mod, producing \c lm. */
+static olean_stamp mk_olean_stamp(module_info const & mod, loaded_module const & lm) {
+    olean_stamp stamp;
+    stamp.m_src_hash      = hash_str64(mod.m_contents.size(), mod.m_contents.data());
+    stamp.m_import_hashes = get_import_hashes(lm, mod.m_deps);
+    return stamp;
+}
+
+static gtask compile_olean(std::shared_ptr<module_info const> const & mod, log_tree::node const & parsing_lt,
+                           optional<std::string> const & olean_cache) {
     auto errs = has_errors(parsing_lt);
 
     gtask mod_dep = mk_deep_dependency(mod->m_result, [] (buffer<gtask> & deps, module_info::parse_result const & res) {
@@ -104,23 +220,45 @@ static gtask compile_olean(std::shared_ptr<module_info const> const & mod, log_t
     });
 
     std::vector<gtask> olean_deps;
-    for (auto & dep : mod->m_deps)
-        if (dep.m_mod_info)
+    for (auto & dep : mod->m_deps) {
+        if (dep.m_mod_info) {
             olean_deps.push_back(dep.m_mod_info->m_olean_task);
+            olean_deps.push_back(dep.m_mod_info->m_interface_hash);
+        }
+    }
 
-    return add_library_task(task_builder<unit>([mod, errs] {
+    return add_library_task(task_builder<unit>([mod, errs, olean_cache] {
         if (mod->m_source != module_src::LEAN)
             throw exception("cannot build olean from olean");
         auto res = get(mod->m_result);
 
         if (get(errs)) throw exception("not creating olean file because of errors");
 
+        olean_stamp stamp = mk_olean_stamp(*mod, *res.m_loaded_module);
         auto olean_fn = olean_of_lean(mod->m_id);
         exclusive_file_lock output_lock(olean_fn);
-        std::ofstream out(olean_fn, std::ios_base::binary);
-        write_module(*res.m_loaded_module, out);
+        /* Imported .olean files are memory mapped and their declarations are loaded lazily,
+           so we must never overwrite one in place. We write to a temporary file and rename it instead. */
+        auto tmp_fn = olean_fn + ".tmp";
+        std::ofstream out(tmp_fn, std::ios_base::binary);
+        write_module(*res.m_loaded_module, stamp, out);
         out.close();
         if (!out) throw exception("failed to write olean file");
+#if defined(LEAN_WINDOWS) && !defined(LEAN_CYGWIN)
+        std::remove(olean_fn.c_str());
+#endif
+        if (std::rename(tmp_fn.c_str(), olean_fn.c_str()) != 0)
+            throw exception("failed to write olean file");
+        if (olean_cache) {
+            /* The cache is only an optimization, we do not report failures to update it. */
+            try {
+                auto cache_fn = get_olean_cache_file(*olean_cache, stamp);
+                exclusive_file_lock cache_lock(cache_fn);
+                copy_olean(olean_fn, cache_fn);
+            } catch (exception &) {}
+        }
+        if (res.m_instance_cache)
+            res.m_instance_cache->save(instance_cache_of_lean(mod->m_id));
         return unit();
     }).depends_on(mod_dep).depends_on(olean_deps).depends_on(errs), std::string("saving olean"));
 }
@@ -154,14 +292,18 @@ void module_mgr::build_module(module_id const & id, bool can_use_olean, name_set
     try {
         bool already_have_lean_version = m_modules[id] && m_modules[id]->m_source == module_src::LEAN;
 
-        auto mod = m_vfs->load_module(id, !already_have_lean_version && can_use_olean);
+        can_use_olean = can_use_olean && !already_have_lean_version;
+        auto mod = m_vfs->load_module(id, can_use_olean);
 
         if (mod->m_source == module_src::OLEAN) {
-            std::istringstream in2(mod->m_contents, std::ios_base::binary);
             auto olean_fn = olean_of_lean(id);
+            auto olean = mod->m_olean;
+            if (!olean)
+                olean = std::make_shared<mapped_file const>(olean_fn, std::move(mod->m_contents));
             bool check_hash = false;
-            auto parsed_olean = parse_olean(in2, olean_fn, check_hash);
-            // we never need to re-parse .olean files, so discard content
+            auto parsed_olean = parse_olean(olean, check_hash);
+            // declarations are loaded lazily from `olean`, which is kept alive by the parsed modifications
+            mod->m_olean = nullptr;
             mod->m_contents.clear();
 
             if (m_server_mode) {
@@ -173,35 +315,64 @@ void module_mgr::build_module(module_id const & id, bool can_use_olean, name_set
             }
 
             mod->m_lt = lt.get();
-            mod->m_trans_mtime = mod->m_mtime;
+            mod->m_interface_hash = mk_pure_task<uint64>(parsed_olean.m_interface_hash);
 
+            // stamp of an .olean file produced from the current versions of the imports
+            olean_stamp stamp;
+            stamp.m_src_hash = parsed_olean.m_stamp.m_src_hash;
+            bool know_import_hashes = true;
             for (auto & d : parsed_olean.m_imports) {
                 auto d_id = resolve(m_path, id, d);
                 build_module(d_id, true, module_stack);
 
                 auto & d_mod = m_modules[d_id];
                 mod->m_deps.push_back({ d_id, d, d_mod });
-                mod->m_trans_mtime = std::max(mod->m_trans_mtime, d_mod->m_trans_mtime);
+                /* If the import is being built from source, we wait until it has been elaborated, since
+                   this module does not need to be rebuilt when its interface did not change.
+                   We do not block the server. */
+                if (auto h = get_interface_hash(*d_mod, !m_server_mode))
+                    stamp.m_import_hashes.push_back(*h);
+                else
+                    know_import_hashes = false;
             }
 
-            if (mod->m_trans_mtime > mod->m_mtime)
+            if (!know_import_hashes || !(stamp == parsed_olean.m_stamp)) {
+                if (know_import_hashes && fetch_olean(id, stamp))
+                    return build_module(id, true, orig_module_stack);
                 return build_module(id, false, orig_module_stack);
+            }
 
-            module_info::parse_result res;
-
+            // The modifications are deserialized on a worker thread, so that independent modules in the
+            // import graph are deserialized in parallel. Importing modules wait for the result (see mk_loader).
             auto deps = mod->m_deps;
-            res.m_loaded_module = cache_preimported_env(
-                    { id, parsed_olean.m_imports,
-                      parse_olean_modifications(parsed_olean.m_serialized_modifications, id),
-                      mk_pure_task<bool>(parsed_olean.m_uses_sorry), {} },
-                    m_initial_env, [=] { return mk_loader(id, deps); });
-
-            mod->m_result = mk_pure_task<module_info::parse_result>(res);
+            auto initial_env = m_initial_env;
+            bool profile = get_profiler(m_ios.get_options());
+            auto profile_threshold = get_profiling_threshold(m_ios.get_options());
+            bool server_mode = m_server_mode;
+            mod->m_result = add_library_task(task_builder<module_info::parse_result>([=] {
+                xtimeit timer(profile_threshold, [&] (second_duration duration) {
+                    if (profile)
+                        report_message(message(id, {1, 0}, INFORMATION,
+                                               (sstream() << "deserialization of '" << olean_fn << "' took "
+                                                          << display_profiling_time{duration} << "\n").str()));
+                });
+                module_info::parse_result res;
+                res.m_loaded_module = cache_preimported_env(
+                        { id, parsed_olean.m_imports,
+                          parse_olean_modifications(parsed_olean, id),
+                          mk_pure_task<bool>(parsed_olean.m_uses_sorry), {} },
+                        initial_env, [=] { return mk_loader(id, deps); });
+                if (server_mode)
+                    index_decl_names(*res.m_loaded_module);
+                return res;
+            }).set_cancellation_token(nullptr), "deserializing olean");
 
             if (auto & old_mod = m_modules[id])
                 cancel(old_mod->m_cancel);
             m_modules[id] = mod;
         } else if (mod->m_source == module_src::LEAN) {
+            if (can_use_olean && fetch_olean(mod, module_stack))
+                return build_module(id, true, orig_module_stack);
             build_lean(mod, module_stack);
             m_modules[id] = mod;
         } else {
@@ -215,6 +386,53 @@ void module_mgr::build_module(module_id const & id, bool can_use_olean, name_set
     }
 }
 
+/* Copy the entry of the .olean cache for an .olean file with the given stamp to the .olean file of \c id.
+   Return true if there is such an entry. */
+bool module_mgr::fetch_olean(module_id const & id, olean_stamp const & stamp) {
+    if (!m_olean_cache || !m_save_olean)
+        return false;
+    try {
+        auto cache_fn = get_olean_cache_file(*m_olean_cache, stamp);
+        shared_file_lock cache_lock(cache_fn);
+        auto header = read_olean_header(cache_fn);
+        if (!header || !(header->second == stamp))
+            return false;
+        auto olean_fn = olean_of_lean(id);
+        exclusive_file_lock output_lock(olean_fn);
+        copy_olean(cache_fn, olean_fn);
+        return true;
+    } catch (exception &) {
+        return false;
+    }
+}
+
+/* Try to fetch the .olean file of \c mod (which has not been built yet) from the .olean cache.
+   This requires building its imports, and knowing their interface hashes. */
+bool module_mgr::fetch_olean(std::shared_ptr<module_info> const & mod, name_set const & module_stack) {
+    if (!m_olean_cache || !m_save_olean || mod->m_dirty || m_vfs->must_load_from_source(mod->m_id))
+        return false;
+    olean_stamp stamp;
+    stamp.m_src_hash = hash_str64(mod->m_contents.size(), mod->m_contents.data());
+    for (auto & d : get_direct_imports(mod->m_id, mod->m_contents)) {
+        module_id d_id;
+        try {
+            d_id = resolve(m_path, mod->m_id, d);
+            build_module(d_id, true, module_stack);
+        } catch (throwable &) {
+            // errors are reported when building the module from source
+            return false;
+        }
+        auto & d_mod = m_modules[d_id];
+        optional<uint64> h;
+        if (d_mod)
+            h = get_interface_hash(*d_mod, !m_server_mode);
+        if (!h)
+            return false;
+        stamp.m_import_hashes.push_back(*h);
+    }
+    return fetch_olean(mod->m_id, stamp);
+}
+
 void module_mgr::build_lean(std::shared_ptr<module_info> const & mod, name_set const & module_stack) {
     auto & lt = logtree();
     auto end_pos = find_end_pos(mod->m_contents);
@@ -223,7 +441,6 @@ void module_mgr::build_lean(std::shared_ptr<module_info> const & mod, name_set c
     auto imports = get_direct_imports(mod->m_id, mod->m_contents);
 
     mod->m_lt = logtree();
-    mod->m_trans_mtime = mod->m_mtime;
     mod->m_save_olean = !mod->m_dirty;
     for (auto & d : imports) {
         module_id d_id;
@@ -232,7 +449,6 @@ void module_mgr::build_lean(std::shared_ptr<module_info> const & mod, name_set c
             d_id = resolve(m_path, mod->m_id, d);
             build_module(d_id, true, module_stack);
             d_mod = m_modules[d_id];
-            mod->m_trans_mtime = std::max(mod->m_trans_mtime, d_mod->m_trans_mtime);
             mod->m_save_olean &= d_mod->m_save_olean;
         } catch (throwable & ex) {
             message_builder(m_initial_env, m_ios, mod->m_id, {1, 0}, ERROR).set_exception(ex).report();
@@ -271,6 +487,7 @@ void module_mgr::build_lean(std::shared_ptr<module_info> const & mod, name_set c
     }
 
     auto initial_env = m_initial_env;
+    bool server_mode = m_server_mode;
     mod->m_result = map<module_info::parse_result>(
         get_end(snapshots),
         [=](module_parser_result const & res) {
@@ -282,13 +499,27 @@ void module_mgr::build_lean(std::shared_ptr<module_info> const & mod, name_set c
                     initial_env, [=] { return ldr; });
 
             parse_res.m_opts = res.m_snapshot_at_end->m_options;
+            parse_res.m_instance_cache = get_persistent_instance_cache(res.m_snapshot_at_end->m_env);
+            if (server_mode)
+                index_decl_names(*parse_res.m_loaded_module);
 
             return parse_res;
         }).build();
 
+    std::vector<gtask> hash_deps;
+    for (auto & d : mod->m_deps)
+        if (d.m_mod_info)
+            hash_deps.push_back(d.m_mod_info->m_interface_hash);
+    auto result = mod->m_result;
+    auto deps_info = mod->m_deps;
+    mod->m_interface_hash = task_builder<uint64>([result, deps_info] {
+            loaded_module const & lm = *get(result).m_loaded_module;
+            return get_interface_hash(lm, get_import_hashes(lm, deps_info));
+        }).depends_on(result).depends_on(hash_deps).build();
+
     if (m_save_olean && mod->m_save_olean) {
         scope_log_tree_core lt3(&lt);
-        mod->m_olean_task = compile_olean(mod, lt2.get());
+        mod->m_olean_task = compile_olean(mod, lt2.get(), m_olean_cache);
     }
 }
 
@@ -336,6 +567,12 @@ module_mgr::build_lean_snapshots(std::shared_ptr<module_parser> const & mod_pars
     for (auto d : old_mod->m_deps) {
         if (!d.m_mod_info && !m_modules[d.m_id]) continue;
         if (d.m_mod_info && m_modules[d.m_id] && m_modules[d.m_id] == d.m_mod_info) continue;
+        if (d.m_mod_info && m_modules[d.m_id]) {
+            // the snapshots do not depend on the proofs in the imported module
+            auto old_hash = get_interface_hash(*d.m_mod_info, false);
+            auto new_hash = get_interface_hash(*m_modules[d.m_id], false);
+            if (old_hash && new_hash && *old_hash == *new_hash) continue;
+        }
 
         return rebuild();
     }
@@ -355,29 +592,26 @@ module_mgr::build_lean_snapshots(std::shared_ptr<module_parser> const & mod_pars
 }
 
 std::shared_ptr<module_info const> module_mgr::get_module(module_id const & id) {
-    unique_lock<mutex> lock(m_mutex);
+    unique_lock<recursive_mutex> lock(m_mutex);
     name_set module_stack;
     build_module(id, true, module_stack);
     return m_modules.at(id);
 }
 
 void module_mgr::invalidate(module_id const & id) {
-    unique_lock<mutex> lock(m_mutex);
+    unique_lock<recursive_mutex> lock(m_mutex);
 
-    bool rebuild_rdeps = true;
+    bool check_rdeps = true;
     if (auto & mod = m_modules[id]) {
         try {
             if (m_vfs->load_module(id, false)->m_contents == mod->m_contents) {
                 // content unchanged
-                rebuild_rdeps = false;
+                check_rdeps = false;
             }
         } catch (...) {}
 
         mod->m_out_of_date = true;
     }
-    if (rebuild_rdeps) {
-        mark_out_of_date(id);
-    }
 
     buffer<module_id> to_rebuild;
     to_rebuild.push_back(id);
@@ -390,6 +624,9 @@ void module_mgr::invalidate(module_id const & id) {
             build_module(i, true, {});
         } catch (...) {}
     }
+    // the modules importing it are rebuilt once we know whether its interface has changed
+    if (check_rdeps)
+        check_dependents_when_ready(id);
 }
 
 std::vector<module_name> module_mgr::get_direct_imports(module_id const & id, std::string const & contents) {
@@ -409,7 +646,7 @@ std::vector<module_name> module_mgr::get_direct_imports(module_id const & id, st
 }
 
 std::vector<std::shared_ptr<module_info const>> module_mgr::get_all_modules() {
-    unique_lock<mutex> lock(m_mutex);
+    unique_lock<recursive_mutex> lock(m_mutex);
 
     std::vector<std::shared_ptr<module_info const>> mods;
     for (auto & mod : m_modules) {
@@ -431,21 +668,28 @@ void module_mgr::cancel_all() {
 
 std::shared_ptr<module_info> fs_module_vfs::load_module(module_id const & id, bool can_use_olean) {
     auto lean_fn = id;
-    auto lean_mtime = get_mtime(lean_fn);
-
+    optional<std::string> contents;
     try {
-        auto olean_fn = olean_of_lean(lean_fn);
-        shared_file_lock olean_lock(olean_fn);
-        auto olean_mtime = get_mtime(olean_fn);
-        if (olean_mtime != -1 && olean_mtime >= lean_mtime &&
-            can_use_olean &&
-            !m_modules_to_load_from_source.count(id) &&
-            is_candidate_olean_file(olean_fn)) {
-            return std::make_shared<module_info>(id, read_file(olean_fn, std::ios_base::binary), module_src::OLEAN, olean_mtime);
-        }
-    } catch (exception) {}
+        contents = read_file(lean_fn);
+    } catch (file_not_found_exception &) {}
+
+    if (can_use_olean && !must_load_from_source(id)) {
+        try {
+            auto olean_fn = olean_of_lean(lean_fn);
+            shared_file_lock olean_lock(olean_fn);
+            auto header = read_olean_header(olean_fn);
+            // .olean files without a .lean file are always used
+            if (header && (!contents || header->second.m_src_hash == hash_str64(contents->size(), contents->data()))) {
+                auto mod = std::make_shared<module_info>(id, std::string(), module_src::OLEAN);
+                mod->m_olean = std::make_shared<mapped_file const>(olean_fn);
+                return mod;
+            }
+        } catch (exception) {}
+    }
 
-    return std::make_shared<module_info>(id, read_file(lean_fn), module_src::LEAN, lean_mtime);
+    if (!contents)
+        throw file_not_found_exception(lean_fn);
+    return std::make_shared<module_info>(id, *contents, module_src::LEAN);
 }
 
 environment get_combined_environment(environment const & env,
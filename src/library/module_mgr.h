@@ -16,8 +16,11 @@ Author: Gabriel Ebner
 #include "util/task.h"
 #include "library/io_state.h"
 #include "library/trace.h"
+#include "library/persistent_instance_cache.h"
+#include "library/module.h"
 #include "frontends/lean/parser.h"
 #include "util/lean_path.h"
+#include "util/mapped_file.h"
 
 namespace lean {
 
@@ -38,8 +41,11 @@ struct module_info {
 
     module_id m_id;
     std::string m_contents;
+    // .olean file mapped into memory, used instead of m_contents when m_source is module_src::OLEAN
+    std::shared_ptr<mapped_file const> m_olean;
     module_src m_source = module_src::LEAN;
-    time_t m_mtime = -1, m_trans_mtime = -1;
+    // see get_interface_hash, available once the module has been elaborated (without waiting for the proofs)
+    task<uint64> m_interface_hash;
 
     struct dependency {
         module_id m_id;
@@ -51,6 +57,7 @@ struct module_info {
     struct parse_result {
         options               m_opts;
         std::shared_ptr<loaded_module const> m_loaded_module;
+        persistent_instance_cache_ptr         m_instance_cache;
     };
     task<parse_result> m_result;
 
@@ -69,8 +76,8 @@ struct module_info {
 
     module_info() {}
 
-    module_info(module_id const & id, std::string const & contents, module_src src, time_t mtime)
-            : m_id(id), m_contents(contents), m_source(src), m_mtime(mtime) {}
+    module_info(module_id const & id, std::string const & contents, module_src src)
+            : m_id(id), m_contents(contents), m_source(src) {}
 };
 
 class module_vfs {
@@ -79,17 +86,25 @@ public:
     // need to support changed lean dependencies of olean files
     // need to support changed editor dependencies of olean files
     virtual std::shared_ptr<module_info> load_module(module_id const &, bool can_use_olean) = 0;
+    // true if the module must be built from source, even if an up-to-date .olean file is available
+    virtual bool must_load_from_source(module_id const &) const { return false; }
 };
 
+/** \brief Load modules from the file system. The .olean file of a module is used if it was produced
+    from the current contents of the .lean file (see olean_stamp). */
 class fs_module_vfs : public module_vfs {
 public:
     std::unordered_set<module_id> m_modules_to_load_from_source;
     std::shared_ptr<module_info> load_module(module_id const & id, bool can_use_olean) override;
+    bool must_load_from_source(module_id const & id) const override {
+        return m_modules_to_load_from_source.count(id) > 0;
+    }
 };
 
 class module_mgr {
     bool m_server_mode = false;
     bool m_save_olean = false;
+    optional<std::string> m_olean_cache;
 
     search_path m_path;
     environment m_initial_env;
@@ -97,11 +112,24 @@ class module_mgr {
     module_vfs * m_vfs;
     log_tree::node m_lt;
 
-    mutex m_mutex;
+    // recursive, since tasks checking the dependents of a module may be executed by the thread scheduling them
+    recursive_mutex m_mutex;
     std::unordered_map<module_id, std::shared_ptr<module_info>> m_modules;
 
-    void mark_out_of_date(module_id const & id);
+    /* State shared with the tasks checking the dependents of rebuilt modules, which must not
+       access the manager after it has been destroyed. */
+    struct dependents_checker {
+        recursive_mutex m_mutex;
+        module_mgr *    m_mgr;
+        dependents_checker(module_mgr * mgr):m_mgr(mgr) {}
+    };
+    std::shared_ptr<dependents_checker> m_checker;
+
+    void check_dependents(module_id const & id);
+    void check_dependents_when_ready(module_id const & id);
     void build_module(module_id const & id, bool can_use_olean, name_set module_stack);
+    bool fetch_olean(module_id const & id, olean_stamp const & stamp);
+    bool fetch_olean(std::shared_ptr<module_info> const & mod, name_set const & module_stack);
 
     std::vector<module_name> get_direct_imports(module_id const & id, std::string const & contents);
     void build_lean(std::shared_ptr<module_info> const & mod, name_set const & module_stack);
@@ -114,7 +142,9 @@ public:
     module_mgr(module_vfs * vfs, log_tree::node const & lt,
                search_path const & path,
                environment const & initial_env, io_state const & ios) :
-            m_path(path), m_initial_env(initial_env), m_ios(ios), m_vfs(vfs), m_lt(lt) {}
+            m_path(path), m_initial_env(initial_env), m_ios(ios), m_vfs(vfs), m_lt(lt),
+            m_checker(std::make_shared<dependents_checker>(this)) {}
+    ~module_mgr();
 
     void invalidate(module_id const & id);
 
@@ -130,6 +160,13 @@ public:
     void set_save_olean(bool save_olean) { m_save_olean = save_olean; }
     bool get_save_olean() const { return m_save_olean; }
 
+    /** \brief Use the given directory as a cache of .olean files shared by all projects (and checkouts).
+        The cache entries are indexed by the hashes of the .lean file and of the imported .olean files
+        (see get_olean_build_key). The .olean files saved by this manager are stored in the cache, and
+        before building a module from source, the manager copies the corresponding entry, if there is one,
+        to the .olean file of the module. */
+    void set_olean_cache(optional<std::string> const & dir) { m_olean_cache = dir; }
+
     environment get_initial_env() const { return m_initial_env; }
     options get_options() const { return m_ios.get_options(); }
     io_state get_io_state() const { return m_ios; }
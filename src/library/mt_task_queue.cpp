@@ -10,6 +10,7 @@ Author: Gabriel Ebner
 #include "library/mt_task_queue.h"
 #include "util/interrupt.h"
 #include "util/flet.h"
+#include "util/biased_rc.h"
 
 #if defined(LEAN_MULTI_THREAD)
 namespace lean {
@@ -113,6 +114,7 @@ void mt_task_queue::spawn_worker() {
                 notify_queue_changed();
                 lock.unlock();
                 execute(t);
+                process_biased_rc_queue();
                 lock.lock();
             }
             reset_heartbeat();
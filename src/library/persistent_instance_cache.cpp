@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include "util/sstream.h"
+#include "util/lean_path.h"
+#include "util/sexpr/option_declarations.h"
+#include "library/kernel_serializer.h"
+#include "library/class.h"
+#include "library/reducible.h"
+#include "library/util.h"
+#include "library/persistent_instance_cache.h"
+
+#ifndef LEAN_DEFAULT_PERSISTENT_INSTANCE_CACHE
+#define LEAN_DEFAULT_PERSISTENT_INSTANCE_CACHE false
+#endif
+
+namespace lean {
+static char const * g_icache_header = "icachefile";
+
+optional<expr> persistent_instance_cache::find(unsigned fingerprint, expr const & type) {
+    shared_lock lock(m_mutex);
+    auto it = m_entries.find(key(fingerprint, type));
+    if (it == m_entries.end())
+        return none_expr();
+    it->second.m_used = true;
+    return some_expr(it->second.m_instance);
+}
+
+void persistent_instance_cache::insert(unsigned fingerprint, expr const & type, expr const & inst) {
+    exclusive_lock lock(m_mutex);
+    auto r = m_entries.emplace(std::piecewise_construct, std::forward_as_tuple(fingerprint, type),
+                               std::forward_as_tuple(inst, true));
+    if (r.second)
+        m_dirty = true;
+    else
+        r.first->second.m_used = true;
+}
+
+void persistent_instance_cache::clear() {
+    exclusive_lock lock(m_mutex);
+    m_entries.clear();
+    m_dirty = true;
+}
+
+unsigned persistent_instance_cache::size() const {
+    shared_lock lock(m_mutex);
+    return m_entries.size();
+}
+
+void persistent_instance_cache::load(std::string const & fname) {
+    std::ifstream in(fname, std::ios_base::binary);
+    if (!in.good())
+        return;
+    entries new_entries;
+    try {
+        deserializer d(in, optional<std::string>(fname));
+        std::string header, version;
+        d >> header;
+        if (header != g_icache_header)
+            return;
+        d >> version;
+        if (version != get_version_string())
+            return;
+        unsigned n = d.read_unsigned();
+        for (unsigned i = 0; i < n; i++) {
+            unsigned fingerprint = d.read_unsigned();
+            expr type, inst;
+            d >> type >> inst;
+            new_entries.emplace(std::piecewise_construct, std::forward_as_tuple(fingerprint, type),
+                                std::forward_as_tuple(inst, false));
+        }
+    } catch (exception &) {
+        /* corrupted file, it will be overwritten */
+        return;
+    }
+    exclusive_lock lock(m_mutex);
+    m_entries.swap(new_entries);
+    m_dirty = false;
+}
+
+void persistent_instance_cache::save(std::string const & fname) {
+    shared_lock lock(m_mutex);
+    if (!m_dirty)
+        return;
+    /* We write to a temporary file and rename it, since other processes may be reading the file. */
+    std::string tmp_fname = fname + ".tmp";
+    {
+        std::ofstream out(tmp_fname, std::ios_base::binary);
+        serializer s(out);
+        s << g_icache_header << get_version_string();
+        unsigned n = 0;
+        for (auto const & p : m_entries)
+            if (p.second.m_used) n++;
+        s << n;
+        for (auto const & p : m_entries) {
+            if (p.second.m_used)
+                s << p.first.m_fingerprint << p.first.m_type << p.second.m_instance;
+        }
+        if (!out.good()) {
+            std::remove(tmp_fname.c_str());
+            throw exception(sstream() << "failed to write instance cache file '" << fname << "'");
+        }
+    }
+#if defined(LEAN_WINDOWS) && !defined(LEAN_CYGWIN)
+    std::remove(fname.c_str());
+#endif
+    if (std::rename(tmp_fname.c_str(), fname.c_str()) != 0)
+        throw exception(sstream() << "failed to write instance cache file '" << fname << "'");
+}
+
+unsigned get_persistent_instance_cache_fingerprint(environment const & env) {
+    return hash(get_instance_fingerprint(env), get_reducibility_fingerprint(env));
+}
+
+struct persistent_instance_cache_ext : public environment_extension {
+    persistent_instance_cache_ptr m_cache;
+};
+
+struct persistent_instance_cache_ext_reg {
+    unsigned m_ext_id;
+    persistent_instance_cache_ext_reg() {
+        m_ext_id = environment::register_extension(std::make_shared<persistent_instance_cache_ext>());
+    }
+};
+
+static persistent_instance_cache_ext_reg * g_ext = nullptr;
+static persistent_instance_cache_ext const & get_extension(environment const & env) {
+    return static_cast<persistent_instance_cache_ext const &>(env.get_extension(g_ext->m_ext_id));
+}
+static environment update(environment const & env, persistent_instance_cache_ext const & ext) {
+    return env.update(g_ext->m_ext_id, std::make_shared<persistent_instance_cache_ext>(ext));
+}
+
+environment set_persistent_instance_cache(environment const & env, persistent_instance_cache_ptr const & c) {
+    persistent_instance_cache_ext ext = get_extension(env);
+    ext.m_cache = c;
+    return update(env, ext);
+}
+
+persistent_instance_cache_ptr const & get_persistent_instance_cache(environment const & env) {
+    return get_extension(env).m_cache;
+}
+
+std::string instance_cache_of_lean(std::string const & lean_fn) {
+    std::string olean_fn = olean_of_lean(lean_fn);
+    return olean_fn.substr(0, olean_fn.size() - std::string(".olean").size()) + ".icache";
+}
+
+static name * g_persistent_instance_cache = nullptr;
+
+name const & get_persistent_instance_cache_opt_name() {
+    return *g_persistent_instance_cache;
+}
+
+bool is_persistent_instance_cache_enabled(options const & opts) {
+    return opts.get_bool(*g_persistent_instance_cache, LEAN_DEFAULT_PERSISTENT_INSTANCE_CACHE);
+}
+
+void initialize_persistent_instance_cache() {
+    g_ext = new persistent_instance_cache_ext_reg();
+    g_persistent_instance_cache = new name{"class", "persistent_instance_cache"};
+    register_bool_option(*g_persistent_instance_cache, LEAN_DEFAULT_PERSISTENT_INSTANCE_CACHE,
+                         "(class) store the solutions of closed type class resolution problems in a file "
+                         "next to the .olean file, and reuse them when the file is elaborated again "
+                         "(enabled by default with --make and --server)");
+}
+
+void finalize_persistent_instance_cache() {
+    delete g_persistent_instance_cache;
+    delete g_ext;
+}
+}
@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "util/thread.h"
+#include "util/shared_mutex.h"
+#include "kernel/environment.h"
+
+namespace lean {
+/** \brief Solutions of closed type class resolution problems, i.e., problems that do not contain
+    local constants nor metavariables, and that are solved without local instances.
+
+    The solutions are indexed by the problem and by the instance and reducibility fingerprints
+    of the environment. Thus, adding or removing instances (or changing reducibility annotations)
+    invalidates the solutions computed before the change. A cache is associated with a module: it is
+    loaded from a file next to the module's .olean file, it is shared by all threads elaborating the module,
+    and only the solutions that were used or produced in the current session are saved back. */
+class persistent_instance_cache {
+    struct key {
+        unsigned m_fingerprint;
+        expr     m_type;
+        key(unsigned fingerprint, expr const & type):m_fingerprint(fingerprint), m_type(type) {}
+    };
+    struct key_hash { unsigned operator()(key const & k) const { return hash(k.m_type.hash(), k.m_fingerprint); } };
+    struct key_eq {
+        bool operator()(key const & k1, key const & k2) const {
+            return k1.m_fingerprint == k2.m_fingerprint && k1.m_type == k2.m_type;
+        }
+    };
+    struct value {
+        expr                 m_instance;
+        mutable atomic<bool> m_used; /* true if the entry should be saved */
+        value(expr const & inst, bool used):m_instance(inst), m_used(used) {}
+    };
+    typedef std::unordered_map<key, value, key_hash, key_eq> entries;
+    mutable shared_mutex m_mutex;
+    entries              m_entries;
+    bool                 m_dirty{false};
+public:
+    /** \brief Return the solution for the problem \c type, when the environment fingerprint is \c fingerprint. */
+    optional<expr> find(unsigned fingerprint, expr const & type);
+    void insert(unsigned fingerprint, expr const & type, expr const & inst);
+    /** \brief Remove all solutions. */
+    void clear();
+    unsigned size() const;
+
+    /** \brief Load the solutions stored in the given file. Missing files, files produced by a different version
+        of Lean, and corrupted files are ignored. */
+    void load(std::string const & fname);
+    /** \brief Save the solutions that have been used or inserted since the cache was loaded, if there are new ones. */
+    void save(std::string const & fname);
+};
+
+typedef std::shared_ptr<persistent_instance_cache> persistent_instance_cache_ptr;
+
+/** \brief Return the hash used to index the solutions for the instances available in \c env. */
+unsigned get_persistent_instance_cache_fingerprint(environment const & env);
+
+/** \brief Associate the cache \c c with \c env and all environments derived from it. */
+environment set_persistent_instance_cache(environment const & env, persistent_instance_cache_ptr const & c);
+/** \brief Return the cache associated with \c env, or nullptr. */
+persistent_instance_cache_ptr const & get_persistent_instance_cache(environment const & env);
+
+/** \brief Return the name of the file storing the instance cache of the given .lean file. */
+std::string instance_cache_of_lean(std::string const & lean_fn);
+
+name const & get_persistent_instance_cache_opt_name();
+bool is_persistent_instance_cache_enabled(options const & opts);
+
+void initialize_persistent_instance_cache();
+void finalize_persistent_instance_cache();
+}
@@ -13,6 +13,7 @@ Author: Leonardo de Moura
 #include "kernel/error_msgs.h"
 #include "kernel/replace_fn.h"
 #include "kernel/for_each_fn.h"
+#include "kernel/find_fn.h"
 #include "kernel/inductive/inductive.h"
 #include "library/trace.h"
 #include "library/class.h"
@@ -32,6 +33,7 @@ Author: Leonardo de Moura
 #include "library/fun_info.h"
 #include "library/num.h"
 #include "library/quote.h"
+#include "library/persistent_instance_cache.h"
 
 #ifndef LEAN_DEFAULT_CLASS_INSTANCE_MAX_DEPTH
 #define LEAN_DEFAULT_CLASS_INSTANCE_MAX_DEPTH 32
@@ -3848,6 +3850,47 @@ struct instance_synthesizer {
 #endif
     }
 
+    /* Return true if the solution for \c type does not depend on the local context,
+       and can be stored in the persistent instance cache. */
+    bool is_closed_problem(expr const & type) const {
+        return empty(m_ctx.m_local_instances) && !has_local(type) && !has_metavar(type);
+    }
+
+    optional<expr> find_persistent(expr const & type) {
+        persistent_instance_cache_ptr const & c = get_persistent_instance_cache(env());
+        if (!c || !is_closed_problem(type))
+            return none_expr();
+        optional<expr> inst = c->find(get_persistent_instance_cache_fingerprint(env()), type);
+        if (!inst)
+            return none_expr();
+        /* The cache file may have been produced using different versions of the imported modules.
+           So, we type check the solution before using it. */
+        bool ok = !find(*inst, [&](expr const & e, unsigned) {
+                return is_constant(e) && !env().find(const_name(e));
+            });
+        try {
+            ok = ok && m_ctx.is_def_eq(m_ctx.infer(*inst), type);
+        } catch (exception &) {
+            ok = false;
+        }
+        lean_trace("class_instances",
+                   scope_trace_env scope(env(), m_ctx);
+                   if (ok)
+                       tout() << "persistent cached instance for " << type << "\n" << *inst << "\n";
+                   else
+                       tout() << "invalid persistent cached instance for " << type << "\n" << *inst << "\n";);
+        if (!ok)
+            return none_expr();
+        cache_result(type, inst);
+        return inst;
+    }
+
+    void insert_persistent(expr const & type, expr const & inst) {
+        persistent_instance_cache_ptr const & c = get_persistent_instance_cache(env());
+        if (c && is_closed_problem(type) && !has_local(inst) && !has_metavar(inst))
+            c->insert(get_persistent_instance_cache_fingerprint(env()), type, inst);
+    }
+
     optional<expr> ensure_no_meta(optional<expr> r) {
         while (true) {
             if (!r) {
@@ -3864,7 +3907,9 @@ struct instance_synthesizer {
                     expr type = m_ctx.infer(m_main_mvar);
                     if (!has_idx_metavar(type)) {
                         /* We only cache the result if it does not contain universe tmp metavars. */
-                        cache_result(type, some_expr(m_ctx.instantiate_mvars(*r)));
+                        expr inst = m_ctx.instantiate_mvars(*r);
+                        cache_result(type, some_expr(inst));
+                        insert_persistent(type, inst);
                     }
                     return r;
                 }
@@ -3893,6 +3938,8 @@ struct instance_synthesizer {
                     return it->second;
                 });
 #endif
+            if (auto r = find_persistent(type))
+                return r;
         }
         m_state          = state();
         m_main_mvar      = m_ctx.mk_tmp_mvar(type);
@@ -103,6 +103,8 @@ class live_vars_fn {
         case opcode::Apply: case opcode::InvokeGlobal:
         case opcode::InvokeBuiltin: case opcode::InvokeCFun:
         case opcode::Closure: case opcode::Expr: case opcode::LocalInfo:
+        case opcode::NatAdd: case opcode::NatSub: case opcode::NatMul: case opcode::NatDiv:
+        case opcode::NatMod: case opcode::NatDecEq: case opcode::NatDecLt: case opcode::NatDecLe:
             s = collect(pc+1);
             break;
         case opcode::Push: case opcode::Move:
@@ -8,6 +8,9 @@ Author: Leonardo de Moura
 #include <string>
 #include <algorithm>
 #include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
 #include <unordered_map>
 #include <unordered_set>
 #include <iomanip>
@@ -27,6 +30,7 @@ Author: Leonardo de Moura
 #include "library/util.h"
 #include "library/vm/vm.h"
 #include "library/vm/vm_name.h"
+#include "library/vm/vm_nat.h"
 #include "library/vm/vm_option.h"
 #include "library/vm/vm_expr.h"
 #include "library/normalize.h"
@@ -37,6 +41,11 @@ Author: Leonardo de Moura
 #define LEAN_DEFAULT_PROFILER_FREQ 1
 #endif
 
+/* Maximum number of functions displayed in the allocation summary of the profiler */
+#ifndef LEAN_PROFILER_ALLOC_ENTRIES
+#define LEAN_PROFILER_ALLOC_ENTRIES 20
+#endif
+
 namespace lean {
 void vm_obj_cell::dec_ref(vm_obj & o, buffer<vm_obj_cell*> & todelete) {
     if (LEAN_VM_IS_PTR(o.m_data)) {
@@ -573,6 +582,14 @@ void vm_instr::display(std::ostream & out) const {
         out << "pexpr " << *m_expr; break;
     case opcode::LocalInfo:
         out << "localinfo " << m_local_info->first << " @ " << m_local_idx; break;
+    case opcode::NatAdd:        out << "nat_add"; break;
+    case opcode::NatSub:        out << "nat_sub"; break;
+    case opcode::NatMul:        out << "nat_mul"; break;
+    case opcode::NatDiv:        out << "nat_div"; break;
+    case opcode::NatMod:        out << "nat_mod"; break;
+    case opcode::NatDecEq:      out << "nat_dec_eq"; break;
+    case opcode::NatDecLt:      out << "nat_dec_lt"; break;
+    case opcode::NatDecLe:      out << "nat_dec_le"; break;
     }
 }
 
@@ -693,6 +710,11 @@ vm_instr mk_unreachable_instr() { return vm_instr(opcode::Unreachable); }
 
 vm_instr mk_apply_instr() { return vm_instr(opcode::Apply); }
 
+vm_instr mk_nat_instr(opcode op) {
+    lean_assert(op >= opcode::NatAdd && op <= opcode::NatDecLe);
+    return vm_instr(op);
+}
+
 vm_instr mk_nat_cases_instr(unsigned pc1, unsigned pc2) {
     vm_instr r(opcode::NatCases);
     r.m_pc[0] = pc1;
@@ -821,6 +843,10 @@ void vm_instr::copy_args(vm_instr const & i) {
         break;
     case opcode::Ret:         case opcode::Destruct:
     case opcode::Unreachable: case opcode::Apply:
+    case opcode::NatAdd:      case opcode::NatSub:
+    case opcode::NatMul:      case opcode::NatDiv:
+    case opcode::NatMod:      case opcode::NatDecEq:
+    case opcode::NatDecLt:    case opcode::NatDecLe:
         break;
     }
 }
@@ -926,6 +952,10 @@ void vm_instr::serialize(serializer & s, std::function<name(unsigned)> const & i
         break;
     case opcode::Ret:         case opcode::Destruct:
     case opcode::Unreachable: case opcode::Apply:
+    case opcode::NatAdd:      case opcode::NatSub:
+    case opcode::NatMul:      case opcode::NatDiv:
+    case opcode::NatMod:      case opcode::NatDecEq:
+    case opcode::NatDecLt:    case opcode::NatDecLe:
         break;
     }
 }
@@ -1005,10 +1035,104 @@ static vm_instr read_vm_instr(deserializer & d) {
         return mk_unreachable_instr();
     case opcode::Apply:
         return mk_apply_instr();
+    case opcode::NatAdd:   case opcode::NatSub:
+    case opcode::NatMul:   case opcode::NatDiv:
+    case opcode::NatMod:   case opcode::NatDecEq:
+    case opcode::NatDecLt: case opcode::NatDecLe:
+        return mk_nat_instr(op);
     }
     lean_unreachable();
 }
 
+/* Compact form of vm_instr used by vm_state::run_threaded. The operands that are not stored in m_a and m_b
+   (e.g., numerals, expressions and the targets of casesn) are retrieved from the original instruction. */
+struct vm_decoded_instr {
+    unsigned m_op; /* opcode or decoded_opcode */
+    unsigned m_a;
+    unsigned m_b;
+};
+
+#if defined(LEAN_THREADED_VM)
+/* Opcodes of the threaded interpreter. The first ones coincide with the opcodes of vm_instr,
+   the remaining ones are superinstructions, i.e., a sequence of two instructions executed without dispatching
+   in between. A superinstruction replaces its first instruction only, and the second one is still decoded
+   since it may be a jump target. */
+enum class decoded_opcode {
+    PushPush = static_cast<unsigned>(opcode::NatDecLe) + 1,  /* push a; push b */
+    PushProj,                                                 /* push a; proj b */
+    PushInvokeGlobal,                                         /* push a; ginvoke */
+    PushInvokeBuiltin                                         /* push a; builtin */
+};
+
+static void decode_vm_code(unsigned code_sz, vm_instr const * code, vm_decoded_instr * r) {
+    for (unsigned i = 0; i < code_sz; i++) {
+        vm_instr const & instr = code[i];
+        vm_decoded_instr & d   = r[i];
+        d.m_op = static_cast<unsigned>(instr.op());
+        d.m_a  = 0;
+        d.m_b  = 0;
+        switch (instr.op()) {
+        case opcode::Push: case opcode::Move: case opcode::Proj:
+            d.m_a = instr.get_idx();
+            break;
+        case opcode::Drop:
+            d.m_a = instr.get_num();
+            break;
+        case opcode::Goto:
+            d.m_a = instr.get_goto_pc();
+            break;
+        case opcode::SConstructor:
+            d.m_a = instr.get_cidx();
+            break;
+        case opcode::Constructor:
+            d.m_a = instr.get_cidx();
+            d.m_b = instr.get_nfields();
+            break;
+        case opcode::Closure:
+            d.m_a = instr.get_fn_idx();
+            d.m_b = instr.get_nargs();
+            break;
+        case opcode::Cases2: case opcode::NatCases:
+            d.m_a = instr.get_cases2_pc(0);
+            d.m_b = instr.get_cases2_pc(1);
+            break;
+        case opcode::BuiltinCases:
+            d.m_a = instr.get_cases_idx();
+            break;
+        case opcode::InvokeGlobal: case opcode::InvokeBuiltin: case opcode::InvokeCFun:
+            d.m_a = instr.get_fn_idx();
+            break;
+        case opcode::Ret: case opcode::Destruct: case opcode::CasesN: case opcode::Apply:
+        case opcode::Unreachable: case opcode::Num: case opcode::Expr: case opcode::LocalInfo:
+        case opcode::NatAdd: case opcode::NatSub: case opcode::NatMul: case opcode::NatDiv:
+        case opcode::NatMod: case opcode::NatDecEq: case opcode::NatDecLt: case opcode::NatDecLe:
+            break;
+        }
+        if (instr.op() == opcode::Push && i + 1 < code_sz) {
+            vm_instr const & next = code[i+1];
+            switch (next.op()) {
+            case opcode::Push:
+                d.m_op = static_cast<unsigned>(decoded_opcode::PushPush);
+                d.m_b  = next.get_idx();
+                break;
+            case opcode::Proj:
+                d.m_op = static_cast<unsigned>(decoded_opcode::PushProj);
+                d.m_b  = next.get_idx();
+                break;
+            case opcode::InvokeGlobal:
+                d.m_op = static_cast<unsigned>(decoded_opcode::PushInvokeGlobal);
+                break;
+            case opcode::InvokeBuiltin:
+                d.m_op = static_cast<unsigned>(decoded_opcode::PushInvokeBuiltin);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+#endif
+
 vm_decl_cell::vm_decl_cell(name const & n, unsigned idx, unsigned arity, vm_function fn):
     m_rc(0), m_kind(vm_decl_kind::Builtin), m_name(n), m_idx(idx), m_arity(arity), m_fn(fn) {}
 
@@ -1024,11 +1148,19 @@ vm_decl_cell::vm_decl_cell(name const & n, unsigned idx, unsigned arity, unsigne
     m_code = new vm_instr[code_sz];
     for (unsigned i = 0; i < code_sz; i++)
         m_code[i] = code[i];
+#if defined(LEAN_THREADED_VM)
+    m_decoded = new vm_decoded_instr[code_sz];
+    decode_vm_code(code_sz, m_code, m_decoded);
+#else
+    m_decoded = nullptr;
+#endif
 }
 
 vm_decl_cell::~vm_decl_cell() {
-    if (m_kind == vm_decl_kind::Bytecode)
+    if (m_kind == vm_decl_kind::Bytecode) {
         delete[] m_code;
+        delete[] m_decoded;
+    }
 }
 
 void vm_decl_cell::dealloc() {
@@ -1385,6 +1517,14 @@ bool get_debugger(options const & opts) {
     return opts.get_bool(*g_debugger, false);
 }
 
+#if defined(LEAN_THREADED_VM)
+static name * g_vm_threaded = nullptr;
+
+static bool get_vm_threaded(options const & opts) {
+    return opts.get_bool(*g_vm_threaded, true);
+}
+#endif
+
 static bool has_monitor(environment const & env) {
     return !get_extension(env).m_monitor.is_anonymous();
 }
@@ -1397,8 +1537,12 @@ vm_state::vm_state(environment const & env, options const & opts):
     m_builtin_cases_map(get_extension(m_env).m_cases),
     m_builtin_cases_vector(get_vm_index_bound()),
     m_code(nullptr),
+    m_decoded(nullptr),
     m_fn_idx(g_null_fn_idx),
     m_bp(0) {
+#if defined(LEAN_THREADED_VM)
+    m_threaded = get_vm_threaded(opts);
+#endif
     if (get_debugger(opts) && has_monitor(env)) {
         debugger_init();
     }
@@ -1520,18 +1664,12 @@ void vm_state::stack_pop_back() {
 }
 
 void vm_state::invoke_builtin(vm_decl const & d) {
-    if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        push_frame_core(0, 0, d.get_idx());
-    }
+    if (m_profiling) push_native_frame(d);
     unsigned saved_bp = m_bp;
     unsigned sz = m_stack.size();
     m_bp = sz;
     d.get_fn()(*this);
-    if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        m_call_stack.pop_back();
-    }
+    if (m_profiling) pop_native_frame();
     lean_assert(m_stack.size() == sz + 1);
     m_bp = saved_bp;
     sz = m_stack.size();
@@ -2133,35 +2271,28 @@ vm_obj vm_state::invoke(vm_obj const & fn, unsigned nargs, vm_obj const * args)
 
 optional<vm_obj> vm_state::try_invoke_catch(vm_obj const & fn, unsigned nargs, vm_obj const * args) {
     auto     code           = m_code;
+    auto     decoded        = m_decoded;
     unsigned fn_idx         = m_fn_idx;
     unsigned pc             = m_pc;
     unsigned bp             = m_bp;
     unsigned next_frame_idx = m_next_frame_idx;
     unsigned stack_sz       = m_stack.size();
     unsigned stack_info_sz  = m_stack_info.size();
-    unsigned call_stack_sz;
-    if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        call_stack_sz       = m_call_stack.size();
-    } else {
-        call_stack_sz       = m_call_stack.size();
-    }
+    unsigned call_stack_sz  = m_call_stack.size();
     try {
         return optional<vm_obj>(invoke(fn, nargs, args));
     } catch (throwable const & ex) {
+        if (m_profiling) count_allocs();
         m_code           = code;
+        m_decoded        = decoded;
         m_fn_idx         = fn_idx;
         m_pc             = pc;
         m_bp             = bp;
         m_next_frame_idx = next_frame_idx;
         m_stack.resize(stack_sz);
         m_stack_info.resize(stack_info_sz);
-        if (m_profiling) {
-            unique_lock<mutex> lk(m_call_stack_mtx);
-            while (m_call_stack.size() > call_stack_sz) m_call_stack.pop_back();
-        } else {
-            while (m_call_stack.size() > call_stack_sz) m_call_stack.pop_back();
-        }
+        while (m_call_stack.size() > call_stack_sz) m_call_stack.pop_back();
+        if (m_profiling) update_profiler_stack();
         return optional<vm_obj>();
     }
 }
@@ -2704,22 +2835,64 @@ void vm_state::push_local_info(unsigned idx, vm_local_info const & info) {
     m_stack_info[m_bp+idx] = info;
 }
 
-void vm_state::push_frame_core(unsigned num, unsigned next_pc, unsigned next_fn_idx) {
-    m_call_stack.emplace_back(m_code, m_fn_idx, num, next_pc, m_bp, next_fn_idx, m_next_frame_idx);
-    m_next_frame_idx++;
-    m_fn_idx = next_fn_idx;
+/* Lock-free copy of the function indices stored in vm_state::m_call_stack. The VM thread is the only writer,
+   and it never waits for the profiler thread. A sample taken while the stack is being modified may be
+   slightly inaccurate. Frames beyond the capacity are not recorded. */
+struct vm_state::profiler_stack {
+    static constexpr unsigned capacity = 16384;
+    atomic<unsigned> m_size;
+    atomic<unsigned> m_fn_idx[capacity];
+    profiler_stack():m_size(0) {}
+};
+
+/* Attribute the VM objects allocated since the last update to the function being executed. */
+void vm_state::count_allocs() {
+    size_t n = get_vm_allocator().get_num_allocations();
+    if (m_fn_idx != g_null_fn_idx) {
+        if (m_fn_idx >= m_alloc_counts.size())
+            m_alloc_counts.resize(m_fn_idx + 1, 0);
+        m_alloc_counts[m_fn_idx] += n - m_num_allocs;
+    }
+    m_num_allocs = n;
+}
+
+void vm_state::update_profiler_stack() {
+    profiler_stack & s = *m_profiler_stack;
+    unsigned sz  = m_call_stack.size();
+    unsigned cap = profiler_stack::capacity;
+    for (unsigned i = 0; i < sz && i < cap; i++)
+        s.m_fn_idx[i].store(m_call_stack[i].m_curr_fn_idx, memory_order_relaxed);
+    s.m_size.store(sz, memory_order_release);
+}
+
+void vm_state::start_profiling() {
+    if (!m_profiler_stack)
+        m_profiler_stack.reset(new profiler_stack());
+    update_profiler_stack();
+    m_alloc_counts.clear();
+    m_num_allocs = get_vm_allocator().get_num_allocations();
+    m_profiling  = true;
+}
+
+void vm_state::stop_profiling() {
+    count_allocs();
+    m_profiling = false;
 }
 
 void vm_state::push_frame(unsigned num, unsigned next_pc, unsigned next_fn_idx) {
+    if (m_profiling) count_allocs();
+    m_call_stack.emplace_back(m_code, m_decoded, m_fn_idx, num, next_pc, m_bp, next_fn_idx, m_next_frame_idx);
+    m_next_frame_idx++;
+    m_fn_idx = next_fn_idx;
     if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        push_frame_core(num, next_pc, next_fn_idx);
-    } else {
-        push_frame_core(num, next_pc, next_fn_idx);
+        unsigned sz = m_call_stack.size();
+        if (sz <= profiler_stack::capacity)
+            m_profiler_stack->m_fn_idx[sz - 1].store(next_fn_idx, memory_order_relaxed);
+        m_profiler_stack->m_size.store(sz, memory_order_release);
     }
 }
 
-unsigned vm_state::pop_frame_core() {
+unsigned vm_state::pop_frame() {
     lean_assert(!m_call_stack.empty());
     frame const & fr = m_call_stack.back();
     unsigned sz      = m_stack.size();
@@ -2735,27 +2908,34 @@ unsigned vm_state::pop_frame_core() {
         m_cache_vector[curr_fidx] = m_stack.back();
     }
     if (m_debugging) shrink_stack_info();
-    m_code   = fr.m_code;
-    m_fn_idx = fr.m_fn_idx;
-    m_pc     = fr.m_pc;
-    m_bp     = fr.m_bp;
+    if (m_profiling) count_allocs();
+    m_code    = fr.m_code;
+    m_decoded = fr.m_decoded;
+    m_fn_idx  = fr.m_fn_idx;
+    m_pc      = fr.m_pc;
+    m_bp      = fr.m_bp;
     unsigned stack_sz = m_call_stack.size();
     m_call_stack.pop_back();
+    if (m_profiling) m_profiler_stack->m_size.store(stack_sz - 1, memory_order_release);
     return stack_sz;
 }
 
-unsigned vm_state::pop_frame() {
-    if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        return pop_frame_core();
-    } else {
-        return pop_frame_core();
-    }
+/* When profiling, the builtin and C functions also get a frame, so that they are visible in the samples. */
+void vm_state::push_native_frame(vm_decl const & d) {
+    push_frame(0, 0, d.get_idx());
+}
+
+void vm_state::pop_native_frame() {
+    count_allocs();
+    m_fn_idx = m_call_stack.back().m_fn_idx;
+    m_call_stack.pop_back();
+    m_profiler_stack->m_size.store(m_call_stack.size(), memory_order_release);
 }
 
 void vm_state::invoke_global(vm_decl const & d) {
     push_frame(d.get_arity(), m_pc+1, d.get_idx());
     m_code            = d.get_code();
+    m_decoded         = d.get_decoded_code();
     m_pc              = 0;
     m_bp              = m_stack.size() - d.get_arity();
     if (m_debugging) {
@@ -2783,15 +2963,9 @@ void vm_state::invoke_global(vm_decl const & d) {
 }
 
 void vm_state::invoke_cfun(vm_decl const & d) {
-    if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        push_frame_core(0, 0, d.get_idx());
-    }
+    if (m_profiling) push_native_frame(d);
     invoke_fn(d.get_cfn(), d.get_arity());
-    if (m_profiling) {
-        unique_lock<mutex> lk(m_call_stack_mtx);
-        m_call_stack.pop_back();
-    }
+    if (m_profiling) pop_native_frame();
 }
 
 void vm_state::invoke(vm_decl const & d) {
@@ -2833,8 +3007,140 @@ void vm_state::display_registers(std::ostream & out) const {
     out << "pc: " << m_pc << ", bp: " << m_bp << "\n";
 }
 
+/** \brief Execute the 'apply' instruction at m_pc, see comment at opcode::Apply in vm_state::run */
+void vm_state::execute_apply() {
+    unsigned sz       = m_stack.size();
+    vm_obj closure    = m_stack.back();
+    stack_pop_back();
+    // TODO(Leo): remove redundant code. The following two branches in the if-then-else statement are very similar.
+    if (is_simple(closure)) {
+        lean_vm_check(cidx(closure) == 0);
+        stack_pop_back();
+        m_stack.push_back(closure);
+        m_pc++;
+        return;
+    } else if (is_native_closure(closure)) {
+        vm_native_closure const * c = to_native_closure(closure);
+        unsigned arity              = c->get_arity();
+        unsigned nargs              = c->get_num_args() + 1;
+        lean_assert(nargs <= arity);
+        /* Keep consuming 'apply' instructions while nargs < arity */
+        while (nargs < arity && m_code[m_pc+1].op() == opcode::Apply) {
+            nargs++;
+            m_pc++;
+        }
+        /* Copy closure data to the top of the stack */
+        std::copy(c->get_args(), c->get_args() + c->get_num_args(), std::back_inserter(m_stack));
+        if (nargs < arity) {
+            /* Case 1) We don't have sufficient arguments. So, we create a new closure */
+            sz = m_stack.size();
+            vm_obj new_value = update_native_closure(closure, nargs, m_stack.data() + sz - nargs);
+            m_stack.resize(sz - nargs + 1);
+            swap(m_stack.back(), new_value);
+            if (m_debugging) shrink_stack_info();
+            m_pc++;
+            return;
+        } else {
+            lean_assert(nargs == arity);
+            buffer<vm_obj> args;
+            /* Case 2 */
+            invoke_fn(c->get_fn(), arity);
+            return;
+        }
+    } else {
+        unsigned fn_idx   = cfn_idx(closure);
+        vm_decl d         = get_decl(fn_idx);
+        unsigned csz      = csize(closure);
+        unsigned arity    = d.get_arity();
+        lean_vm_check(csz < arity);
+        unsigned nargs    = csz + 1;
+        lean_vm_check(nargs <= arity);
+        /* Keep consuming 'apply' instructions while nargs < arity */
+        while (nargs < arity && m_code[m_pc+1].op() == opcode::Apply) {
+            nargs++;
+            m_pc++;
+        }
+        /* Copy closure data to the top of the stack */
+        std::copy(cfields(closure), cfields(closure) + csz, std::back_inserter(m_stack));
+        if (nargs < arity) {
+            /* Case 1) We don't have sufficient arguments. So, we create a new closure */
+            sz = m_stack.size();
+            vm_obj new_value = mk_vm_closure(fn_idx, nargs, m_stack.data() + sz - nargs);
+            m_stack.resize(sz - nargs + 1);
+            swap(m_stack.back(), new_value);
+            if (m_debugging) shrink_stack_info();
+            m_pc++;
+            return;
+        } else {
+            lean_assert(nargs == arity);
+            /* Case 2 */
+            invoke(d);
+            return;
+        }
+    }
+}
+
+/* Result of applying the nat builtin implemented by \c op to \c a1 and \c a2. */
+static LEAN_ALWAYS_INLINE inline vm_obj eval_nat_instr(opcode op, vm_obj const & a1, vm_obj const & a2) {
+    if (LEAN_LIKELY(is_simple(a1) && is_simple(a2))) {
+        /* Remark: v1 and v2 are smaller than LEAN_MAX_SMALL_NAT = 2^31, so v1 + v2 does not wrap around */
+        unsigned v1 = cidx(a1);
+        unsigned v2 = cidx(a2);
+        switch (op) {
+        case opcode::NatAdd:
+            if (LEAN_LIKELY(v1 + v2 < LEAN_MAX_SMALL_NAT))
+                return mk_vm_simple(v1 + v2);
+            break;
+        case opcode::NatSub:
+            return mk_vm_simple(v2 > v1 ? 0 : v1 - v2);
+        case opcode::NatMul: {
+            uint64 r = static_cast<uint64>(v1) * static_cast<uint64>(v2);
+            if (LEAN_LIKELY(r < LEAN_MAX_SMALL_NAT))
+                return mk_vm_simple(static_cast<unsigned>(r));
+            break;
+        }
+        case opcode::NatDiv:   return mk_vm_simple(v2 == 0 ? 0 : v1 / v2);
+        case opcode::NatMod:   return mk_vm_simple(v2 == 0 ? v1 : v1 % v2);
+        case opcode::NatDecEq: return mk_vm_bool(v1 == v2);
+        case opcode::NatDecLt: return mk_vm_bool(v1 < v2);
+        case opcode::NatDecLe: return mk_vm_bool(v1 <= v2);
+        default:               lean_unreachable();
+        }
+    }
+    /* big numbers or overflow */
+    switch (op) {
+    case opcode::NatAdd:   return nat_add(a1, a2);
+    case opcode::NatSub:   return nat_sub(a1, a2);
+    case opcode::NatMul:   return nat_mul(a1, a2);
+    case opcode::NatDiv:   return nat_div(a1, a2);
+    case opcode::NatMod:   return nat_mod(a1, a2);
+    case opcode::NatDecEq: return nat_decidable_eq(a1, a2);
+    case opcode::NatDecLt: return nat_decidable_lt(a1, a2);
+    case opcode::NatDecLe: return nat_decidable_le(a1, a2);
+    default:               lean_unreachable();
+    }
+}
+
+/** \brief Execute the nat instruction \c op at m_pc, see comment at opcode::NatAdd in vm_state::run.
+    The callers provide \c op as a constant to make sure the switches in eval_nat_instr are eliminated. */
+LEAN_ALWAYS_INLINE inline void vm_state::execute_nat_instr(opcode op) {
+    unsigned sz = m_stack.size();
+    lean_vm_check(sz >= 2);
+    vm_obj r = eval_nat_instr(op, m_stack[sz - 1], m_stack[sz - 2]);
+    m_stack.pop_back();
+    swap(m_stack.back(), r);
+    if (m_debugging) shrink_stack_info();
+    m_pc++;
+}
+
 void vm_state::run() {
     lean_assert(m_code);
+#if defined(LEAN_THREADED_VM)
+    if (m_threaded && m_decoded && !m_debugging) {
+        run_threaded();
+        return;
+    }
+#endif
     unsigned init_call_stack_sz = m_call_stack.size();
     m_pc = 0;
     while (true) {
@@ -3173,75 +3479,8 @@ void vm_state::run() {
                Case 2) arity of fn = n + m
                Then, see InvokeGlobal (if fn is global) and InvokeBuiltin (if fn is builtin)
             */
-            unsigned sz       = m_stack.size();
-            vm_obj closure    = m_stack.back();
-            stack_pop_back();
-            // TODO(Leo): remove redundant code. The following two branches in the if-then-else statement are very similar.
-            if (is_simple(closure)) {
-                lean_vm_check(cidx(closure) == 0);
-                stack_pop_back();
-                m_stack.push_back(closure);
-                m_pc++;
-                goto main_loop;
-            } else if (is_native_closure(closure)) {
-                vm_native_closure const * c = to_native_closure(closure);
-                unsigned arity              = c->get_arity();
-                unsigned nargs              = c->get_num_args() + 1;
-                lean_assert(nargs <= arity);
-                /* Keep consuming 'apply' instructions while nargs < arity */
-                while (nargs < arity && m_code[m_pc+1].op() == opcode::Apply) {
-                    nargs++;
-                    m_pc++;
-                }
-                /* Copy closure data to the top of the stack */
-                std::copy(c->get_args(), c->get_args() + c->get_num_args(), std::back_inserter(m_stack));
-                if (nargs < arity) {
-                    /* Case 1) We don't have sufficient arguments. So, we create a new closure */
-                    sz = m_stack.size();
-                    vm_obj new_value = update_native_closure(closure, nargs, m_stack.data() + sz - nargs);
-                    m_stack.resize(sz - nargs + 1);
-                    swap(m_stack.back(), new_value);
-                    if (m_debugging) shrink_stack_info();
-                    m_pc++;
-                    goto main_loop;
-                } else {
-                    lean_assert(nargs == arity);
-                    buffer<vm_obj> args;
-                    /* Case 2 */
-                    invoke_fn(c->get_fn(), arity);
-                    goto main_loop;
-                }
-            } else {
-                unsigned fn_idx   = cfn_idx(closure);
-                vm_decl d         = get_decl(fn_idx);
-                unsigned csz      = csize(closure);
-                unsigned arity    = d.get_arity();
-                lean_vm_check(csz < arity);
-                unsigned nargs    = csz + 1;
-                lean_vm_check(nargs <= arity);
-                /* Keep consuming 'apply' instructions while nargs < arity */
-                while (nargs < arity && m_code[m_pc+1].op() == opcode::Apply) {
-                    nargs++;
-                    m_pc++;
-                }
-                /* Copy closure data to the top of the stack */
-                std::copy(cfields(closure), cfields(closure) + csz, std::back_inserter(m_stack));
-                if (nargs < arity) {
-                    /* Case 1) We don't have sufficient arguments. So, we create a new closure */
-                    sz = m_stack.size();
-                    vm_obj new_value = mk_vm_closure(fn_idx, nargs, m_stack.data() + sz - nargs);
-                    m_stack.resize(sz - nargs + 1);
-                    swap(m_stack.back(), new_value);
-                    if (m_debugging) shrink_stack_info();
-                    m_pc++;
-                    goto main_loop;
-                } else {
-                    lean_assert(nargs == arity);
-                    /* Case 2 */
-                    invoke(d);
-                    goto main_loop;
-                }
-            }
+            execute_apply();
+            goto main_loop;
         }
         case opcode::InvokeGlobal: {
             check_interrupted();
@@ -3312,10 +3551,286 @@ void vm_state::run() {
             vm_decl decl = get_decl(instr.get_fn_idx());
             invoke_cfun(decl);
             goto main_loop;
-        }}
+        }
+        case opcode::NatAdd:
+            /**
+               Instruction: nat_add
+
+               stack before          after
+               ...                   ...
+               v         ==>         v
+               a_2                   (nat.add a_1 a_2)
+               a_1
+
+               The instructions nat_sub, nat_mul, nat_div, nat_mod, nat_dec_eq, nat_dec_lt and nat_dec_le
+               are similar, they implement the builtins nat.sub, ..., nat.decidable_le.
+               They do not check for interruptions since they do not loop.
+            */
+            execute_nat_instr(opcode::NatAdd);
+            goto main_loop;
+        case opcode::NatSub:
+            execute_nat_instr(opcode::NatSub);
+            goto main_loop;
+        case opcode::NatMul:
+            execute_nat_instr(opcode::NatMul);
+            goto main_loop;
+        case opcode::NatDiv:
+            execute_nat_instr(opcode::NatDiv);
+            goto main_loop;
+        case opcode::NatMod:
+            execute_nat_instr(opcode::NatMod);
+            goto main_loop;
+        case opcode::NatDecEq:
+            execute_nat_instr(opcode::NatDecEq);
+            goto main_loop;
+        case opcode::NatDecLt:
+            execute_nat_instr(opcode::NatDecLt);
+            goto main_loop;
+        case opcode::NatDecLe:
+            execute_nat_instr(opcode::NatDecLe);
+            goto main_loop;
+        }
     }
 }
 
+#if defined(LEAN_THREADED_VM)
+/** \brief Execute m_decoded using computed gotos, i.e., each instruction jumps directly to the code of the next one.
+    The semantics of each instruction is described at vm_state::run. This interpreter is not used
+    when the debugger is active. */
+void vm_state::run_threaded() {
+    /* The order must match the one in opcode and decoded_opcode */
+    static void * const s_labels[] = {
+        &&L_Push, &&L_Move, &&L_Ret, &&L_Drop, &&L_Goto,
+        &&L_SConstructor, &&L_Constructor, &&L_Num,
+        &&L_Destruct, &&L_Cases2, &&L_CasesN, &&L_NatCases, &&L_BuiltinCases, &&L_Proj,
+        &&L_Apply, &&L_InvokeGlobal, &&L_InvokeBuiltin, &&L_InvokeCFun,
+        &&L_Closure, &&L_Unreachable, &&L_Expr, &&L_LocalInfo,
+        &&L_NatAdd, &&L_NatSub, &&L_NatMul, &&L_NatDiv,
+        &&L_NatMod, &&L_NatDecEq, &&L_NatDecLt, &&L_NatDecLe,
+        &&L_PushPush, &&L_PushProj, &&L_PushInvokeGlobal, &&L_PushInvokeBuiltin
+    };
+    lean_assert(m_decoded);
+    unsigned init_call_stack_sz = m_call_stack.size();
+    m_pc = 0;
+#define DISPATCH() goto *s_labels[m_decoded[m_pc].m_op]
+    DISPATCH();
+  L_Push:
+    m_stack.push_back(m_stack[m_bp + m_decoded[m_pc].m_a]);
+    m_pc++;
+    DISPATCH();
+  L_Move: {
+        unsigned off = m_bp + m_decoded[m_pc].m_a;
+        lean_vm_check(off < m_stack.size());
+        m_stack.push_back(mk_vm_unit());
+        swap(m_stack.back(), m_stack[off]);
+        m_pc++;
+        DISPATCH();
+    }
+  L_Drop: {
+        unsigned num = m_decoded[m_pc].m_a;
+        unsigned sz  = m_stack.size();
+        lean_vm_check(sz > num);
+        swap(m_stack[sz - num - 1], m_stack[sz - 1]);
+        m_stack.resize(sz - num);
+        m_pc++;
+        DISPATCH();
+    }
+  L_Goto:
+    m_pc = m_decoded[m_pc].m_a;
+    DISPATCH();
+  L_SConstructor:
+    m_stack.push_back(mk_vm_simple(m_decoded[m_pc].m_a));
+    m_pc++;
+    DISPATCH();
+  L_Constructor: {
+        vm_decoded_instr const & instr = m_decoded[m_pc];
+        unsigned nfields = instr.m_b;
+        unsigned sz      = m_stack.size();
+        lean_vm_check(nfields <= sz);
+        vm_obj new_value = mk_vm_constructor(instr.m_a, nfields, m_stack.data() + sz - nfields);
+        m_stack.resize(sz - nfields + 1);
+        swap(m_stack.back(), new_value);
+        m_pc++;
+        DISPATCH();
+    }
+  L_Closure: {
+        vm_decoded_instr const & instr = m_decoded[m_pc];
+        unsigned nargs   = instr.m_b;
+        unsigned sz      = m_stack.size();
+        lean_vm_check(nargs <= sz);
+        vm_obj new_value = mk_vm_closure(instr.m_a, nargs, m_stack.data() + sz - nargs);
+        m_stack.resize(sz - nargs + 1);
+        swap(m_stack.back(), new_value);
+        m_pc++;
+        DISPATCH();
+    }
+  L_Num:
+    m_stack.push_back(mk_vm_mpz(m_code[m_pc].get_mpz()));
+    m_pc++;
+    DISPATCH();
+  L_Expr:
+    m_stack.push_back(to_obj(m_code[m_pc].get_expr()));
+    m_pc++;
+    DISPATCH();
+  L_LocalInfo:
+    m_pc++;
+    DISPATCH();
+  L_Destruct: {
+        vm_obj top(std::move(m_stack.back()));
+        m_stack.pop_back();
+        push_fields(top);
+        m_pc++;
+        DISPATCH();
+    }
+  L_Cases2: {
+        vm_obj top(std::move(m_stack.back()));
+        m_stack.pop_back();
+        unsigned c = cidx(top);
+        lean_vm_check(c < 2);
+        /* Values such as booleans are boxed scalars, and do not have fields */
+        if (!is_simple(top))
+            push_fields(top);
+        m_pc = c == 0 ? m_decoded[m_pc].m_a : m_decoded[m_pc].m_b;
+        DISPATCH();
+    }
+  L_NatCases: {
+        vm_obj & top = m_stack.back();
+        if (is_simple(top)) {
+            unsigned val = cidx(top);
+            if (val == 0) {
+                m_stack.pop_back();
+                m_pc++;
+            } else {
+                vm_obj new_value = mk_vm_simple(val - 1);
+                swap(top, new_value);
+                m_pc = m_decoded[m_pc].m_b;
+            }
+        } else {
+            mpz const & val = to_mpz(top);
+            if (val == 0) {
+                m_stack.pop_back();
+                m_pc++;
+            } else {
+                vm_obj new_value = mk_vm_mpz(val - 1);
+                swap(top, new_value);
+                m_pc = m_decoded[m_pc].m_b;
+            }
+        }
+        DISPATCH();
+    }
+  L_CasesN: {
+        vm_obj top(std::move(m_stack.back()));
+        m_stack.pop_back();
+        push_fields(top);
+        m_pc = m_code[m_pc].get_casesn_pc(cidx(top));
+        DISPATCH();
+    }
+  L_BuiltinCases: {
+        vm_obj top(std::move(m_stack.back()));
+        m_stack.pop_back();
+        vm_cases_function fn = get_builtin_cases(m_decoded[m_pc].m_a);
+        buffer<vm_obj> data;
+        unsigned cidx = fn(top, data);
+        std::copy(data.begin(), data.end(), std::back_inserter(m_stack));
+        m_pc = m_code[m_pc].get_casesn_pc(cidx);
+        DISPATCH();
+    }
+  L_Proj: {
+        vm_obj & top = m_stack.back();
+        top = cfield(top, m_decoded[m_pc].m_a);
+        m_pc++;
+        DISPATCH();
+    }
+  L_Unreachable:
+    throw exception("VM unreachable instruction has been reached");
+  L_Ret:
+    if (pop_frame() == init_call_stack_sz)
+        return;
+    DISPATCH();
+  L_Apply:
+    execute_apply();
+    DISPATCH();
+  L_InvokeGlobal: {
+        check_interrupted();
+        check_heartbeat();
+        check_memory("vm");
+        vm_decl const & decl = get_decl(m_decoded[m_pc].m_a);
+        /* If d is 0-ary, then check if value is cached */
+        if (decl.get_arity() == 0 && decl.get_idx() < m_cache_vector.size()) {
+            if (auto r = m_cache_vector[decl.get_idx()]) {
+                m_stack.push_back(*r);
+                m_pc++;
+                DISPATCH();
+            }
+        }
+        invoke_global(decl);
+        DISPATCH();
+    }
+  L_InvokeBuiltin: {
+        check_interrupted();
+        check_heartbeat();
+        check_memory("vm");
+        vm_decl decl = get_decl(m_decoded[m_pc].m_a);
+        invoke_builtin(decl);
+        DISPATCH();
+    }
+  L_InvokeCFun: {
+        check_interrupted();
+        check_heartbeat();
+        check_memory("vm");
+        vm_decl decl = get_decl(m_decoded[m_pc].m_a);
+        invoke_cfun(decl);
+        DISPATCH();
+    }
+  L_NatAdd:
+    execute_nat_instr(opcode::NatAdd);
+    DISPATCH();
+  L_NatSub:
+    execute_nat_instr(opcode::NatSub);
+    DISPATCH();
+  L_NatMul:
+    execute_nat_instr(opcode::NatMul);
+    DISPATCH();
+  L_NatDiv:
+    execute_nat_instr(opcode::NatDiv);
+    DISPATCH();
+  L_NatMod:
+    execute_nat_instr(opcode::NatMod);
+    DISPATCH();
+  L_NatDecEq:
+    execute_nat_instr(opcode::NatDecEq);
+    DISPATCH();
+  L_NatDecLt:
+    execute_nat_instr(opcode::NatDecLt);
+    DISPATCH();
+  L_NatDecLe:
+    execute_nat_instr(opcode::NatDecLe);
+    DISPATCH();
+  L_PushPush: {
+        vm_decoded_instr const & instr = m_decoded[m_pc];
+        m_stack.push_back(m_stack[m_bp + instr.m_a]);
+        m_stack.push_back(m_stack[m_bp + instr.m_b]);
+        m_pc += 2;
+        DISPATCH();
+    }
+  L_PushProj: {
+        vm_decoded_instr const & instr = m_decoded[m_pc];
+        m_stack.push_back(cfield(m_stack[m_bp + instr.m_a], instr.m_b));
+        m_pc += 2;
+        DISPATCH();
+    }
+  L_PushInvokeGlobal:
+    m_stack.push_back(m_stack[m_bp + m_decoded[m_pc].m_a]);
+    m_pc++;
+    goto L_InvokeGlobal;
+  L_PushInvokeBuiltin:
+    m_stack.push_back(m_stack[m_bp + m_decoded[m_pc].m_a]);
+    m_pc++;
+    goto L_InvokeBuiltin;
+#undef DISPATCH
+}
+#endif
+
 void vm_state::invoke_fn(name const & fn) {
     auto idx = get_vm_index(fn);
     if (m_decl_map.contains(idx)) {
@@ -3356,9 +3871,19 @@ vm_obj vm_state::get_constant(name const & cname) {
     }
 }
 
-void vm_state::execute(vm_instr const * code) {
+void vm_state::execute(unsigned code_sz, vm_instr const * code) {
+#if defined(LEAN_THREADED_VM)
+    buffer<vm_decoded_instr> decoded;
+    decoded.resize(code_sz);
+    decode_vm_code(code_sz, code, decoded.data());
+#endif
     push_frame(0, m_pc, g_null_fn_idx);
     m_code            = code;
+#if defined(LEAN_THREADED_VM)
+    m_decoded         = decoded.data();
+#else
+    m_decoded         = nullptr;
+#endif
     m_pc              = 0;
     m_bp              = m_stack.size();
     run();
@@ -3369,7 +3894,7 @@ void vm_state::apply(unsigned n) {
     for (unsigned i = 0; i < n; i++)
         code.push_back(mk_apply_instr());
     code.push_back(mk_ret_instr());
-    execute(code.data());
+    execute(code.size(), code.data());
 }
 
 void vm_state::display(std::ostream & out, vm_obj const & o) const {
@@ -3398,13 +3923,31 @@ unsigned get_profiler_freq(options const & opts) {
 }
 #endif
 
+static name * g_profiler_output = nullptr;
+
+static std::string get_profiler_output(options const & opts) {
+    return opts.get_string(*g_profiler_output, "");
+}
+
 vm_state::profiler::profiler(vm_state & s, options const & opts):
     m_state(s),
     m_stop(false),
+    m_owner(false),
 #if defined(LEAN_MULTI_THREAD)
     m_freq_ms(get_profiler_freq(opts)),
-    m_thread_ptr(get_profiler(opts) ?
-        new interruptible_thread([&]() {
+#else
+    m_freq_ms(0),
+#endif
+    m_output(get_profiler_output(opts)) {
+#if defined(LEAN_MULTI_THREAD)
+    if (!get_profiler(opts))
+        return;
+    if (!m_state.m_profiling) {
+        m_owner = true;
+        m_state.start_profiling();
+    }
+    m_thread_ptr.reset(new interruptible_thread([this]() {
+                profiler_stack const & ps = *m_state.m_profiler_stack;
                 chrono::milliseconds d(m_freq_ms);
                 bool first = true;
                 auto start = chrono::steady_clock::now();
@@ -3412,30 +3955,22 @@ vm_state::profiler::profiler(vm_state & s, options const & opts):
                     if (first) {
                         first = false;
                     } else {
-                        unique_lock<mutex> lk(m_state.m_call_stack_mtx);
                         auto curr = chrono::steady_clock::now();
                         m_snapshots.push_back(snapshot_core());
                         snapshot_core & s = m_snapshots.back();
                         s.m_duration = chrono::duration_cast<chrono::milliseconds>(curr - start);
-                        for (frame const & fr : m_state.m_call_stack) {
-                            if (fr.m_curr_fn_idx != g_null_fn_idx &&
-                                (s.m_stack.empty() || s.m_stack.back().first != fr.m_curr_fn_idx)) {
-                                s.m_stack.emplace_back(fr.m_curr_fn_idx, fr.m_frame_idx);
-                            }
+                        unsigned sz  = ps.m_size.load(memory_order_acquire);
+                        unsigned cap = profiler_stack::capacity;
+                        for (unsigned i = 0; i < sz && i < cap; i++) {
+                            unsigned fn_idx = ps.m_fn_idx[i].load(memory_order_relaxed);
+                            if (fn_idx != g_null_fn_idx && (s.m_stack.empty() || s.m_stack.back() != fn_idx))
+                                s.m_stack.push_back(fn_idx);
                         }
                     }
                     start = chrono::steady_clock::now();
                     this_thread::sleep_for(d);
                 }
-            }) :
-        nullptr)
-#else
-    m_freq_ms(0),
-    m_thread_ptr(nullptr)
-#endif
-{
-#if defined(LEAN_MULTI_THREAD)
-    m_state.m_profiling = get_profiler(opts);
+            }));
 #endif
 }
 
@@ -3443,7 +3978,8 @@ void vm_state::profiler::stop() {
     if (!m_stop && m_thread_ptr) {
         m_stop = true;
         m_thread_ptr->join();
-        m_state.m_profiling = false;
+        if (m_owner)
+            m_state.stop_profiling();
     }
 }
 
@@ -3451,10 +3987,39 @@ vm_state::profiler::~profiler() {
     stop();
 }
 
+/* Name of the declaration \c decl_name used in the profiler reports. */
+static name get_profiler_decl_name(environment const & env, name decl_name) {
+    /* Remove unnecessary suffixes. */
+    while (true) {
+        if (decl_name.is_atomic()) break;
+        if (!decl_name.is_string()) break;
+        char const * str = decl_name.get_string();
+        if (str[0] != '_') break;
+        if (strncmp(str, "_lambda", 7) == 0) break;
+        decl_name = decl_name.get_prefix();
+    }
+    if (auto prv = hidden_to_user_name(env, decl_name))
+        decl_name = *prv;
+    return decl_name;
+}
+
+static mutex * g_profiler_output_mutex = nullptr;
+
 auto vm_state::profiler::get_snapshots() -> snapshots {
     stop();
     snapshots r;
     r.m_total_time = chrono::milliseconds(0);
+    std::unordered_map<unsigned, name> decl_names;
+    auto get_name = [&](unsigned idx) {
+        auto it = decl_names.find(idx);
+        if (it != decl_names.end())
+            return it->second;
+        vm_decl const * decl = m_state.m_decl_map.find(idx);
+        lean_assert(decl);
+        name n = get_profiler_decl_name(m_state.env(), decl->get_name());
+        decl_names.insert(mk_pair(idx, n));
+        return n;
+    };
     std::unordered_map<name, chrono::milliseconds, name_hash> cum_times;
     for (snapshot_core const & s : m_snapshots) {
         snapshot new_s;
@@ -3462,23 +4027,10 @@ auto vm_state::profiler::get_snapshots() -> snapshots {
         r.m_total_time += s.m_duration;
         auto & new_stack = new_s.m_stack;
         std::unordered_set<name, name_hash> decl_already_seen_in_this_stack;
-        for (auto const & p : s.m_stack) {
-            vm_decl const * decl = m_state.m_decl_map.find(p.first);
-            lean_assert(decl);
-            name decl_name = decl->get_name();
-            /* Remove unnecessary suffixes. */
-            while (true) {
-                if (decl_name.is_atomic()) break;
-                if (!decl_name.is_string()) break;
-                char const * str = decl_name.get_string();
-                if (str[0] != '_') break;
-                if (strncmp(str, "_lambda", 7) == 0) break;
-                decl_name = decl_name.get_prefix();
-            }
-            if (auto prv = hidden_to_user_name(m_state.env(), decl_name))
-                decl_name = *prv;
-            if (new_stack.empty() || decl_name != new_stack.back().first)
-                new_stack.emplace_back(decl_name, p.second);
+        for (unsigned idx : s.m_stack) {
+            name decl_name = get_name(idx);
+            if (new_stack.empty() || decl_name != new_stack.back())
+                new_stack.push_back(decl_name);
 
             if (decl_already_seen_in_this_stack.insert(decl_name).second) {
                 // not seen before in this stack
@@ -3493,19 +4045,26 @@ auto vm_state::profiler::get_snapshots() -> snapshots {
               [] (pair<name, chrono::milliseconds> & a, pair<name, chrono::milliseconds> & b) {
                   return b.second < a.second; });
 
-    return r;
-}
+    std::unordered_map<name, uint64, name_hash> allocs;
+    for (unsigned idx = 0; idx < m_state.m_alloc_counts.size(); idx++) {
+        if (uint64 n = m_state.m_alloc_counts[idx])
+            allocs[get_name(idx)] += n;
+    }
+    for (auto & alloc_entry : allocs) r.m_allocs.push_back(alloc_entry);
+    std::sort(r.m_allocs.begin(), r.m_allocs.end(),
+              [] (pair<name, uint64> const & a, pair<name, uint64> const & b) {
+                  return b.second < a.second; });
 
-#if 0
-static bool equal_fns(vm_state::profiler::snapshot const & s1, vm_state::profiler::snapshot const & s2) {
-    if (s1.m_stack.size() != s2.m_stack.size()) return false;
-    for (unsigned i = 0; i < s1.m_stack.size(); i++) {
-        if (s1.m_stack[i].first != s2.m_stack[i].first)
-            return false;
+    if (!m_output.empty()) {
+        /* several threads may be profiling at the same time */
+        lock_guard<mutex> lock(*g_profiler_output_mutex);
+        std::ofstream out(m_output, std::ios_base::app);
+        if (!out)
+            throw exception(sstream() << "failed to write profiler output to '" << m_output << "'");
+        r.display_collapsed(out);
     }
-    return true;
+    return r;
 }
-#endif
 
 void vm_state::profiler::snapshots::display(std::ostream & out) const {
     for (auto & cum_time : m_cum_times) {
@@ -3514,25 +4073,31 @@ void vm_state::profiler::snapshots::display(std::ostream & out) const {
             << (100.0f * cum_time.second.count()) / m_total_time.count() << "%   "
             << cum_time.first << "\n";
     }
-#if 0
-    unsigned i = 0;
-    while (i < m_snapshots.size()) {
-        snapshot const & s = m_snapshots[i];
-        unsigned j = i+1;
-        auto d = s.m_duration;
-        for (; j < m_snapshots.size(); j++) {
-            if (!equal_fns(s, m_snapshots[j]))
-                break;
-            d += m_snapshots[j].m_duration;
+    if (!m_allocs.empty()) {
+        out << "allocations\n";
+        for (unsigned i = 0; i < m_allocs.size() && i < LEAN_PROFILER_ALLOC_ENTRIES; i++) {
+            out << std::setw(10) << m_allocs[i].second << "   " << m_allocs[i].first << "\n";
         }
-        i = j;
-        out << d.count() << ":";
-        for (auto const & p : s.m_stack) {
-            out << " " << p.first;
+    }
+}
+
+void vm_state::profiler::snapshots::display_collapsed(std::ostream & out) const {
+    std::map<std::string, chrono::milliseconds> stacks;
+    for (snapshot const & s : m_snapshots) {
+        if (s.m_stack.empty()) continue;
+        std::ostringstream stack;
+        bool first = true;
+        for (name const & n : s.m_stack) {
+            if (!first) stack << ";";
+            first = false;
+            stack << n;
         }
-        out << "\n";
+        stacks[stack.str()] += s.m_duration;
+    }
+    for (auto const & p : stacks) {
+        if (p.second.count() > 0)
+            out << p.first << " " << p.second.count() << "\n";
     }
-#endif
 }
 
 bool vm_state::profiler::snapshots::display(std::string const &what, options const &opts, std::ostream &out) const {
@@ -3728,8 +4293,18 @@ void initialize_vm() {
     g_profiler_freq  = new name{"profiler", "freq"};
     register_unsigned_option(*g_profiler_freq, LEAN_DEFAULT_PROFILER_FREQ, "(profiler) sampling frequency in milliseconds");
 #endif
+    g_profiler_output       = new name{"profiler", "output"};
+    g_profiler_output_mutex = new mutex();
+    register_string_option(*g_profiler_output, "",
+                           "(profiler) append the VM call stack samples to the given file using the collapsed stack "
+                           "format (supported by flamegraph.pl and speedscope)");
     g_debugger       = new name{"debugger"};
     register_bool_option(*g_debugger, false, "(debugger) debug code using VM monitors");
+#if defined(LEAN_THREADED_VM)
+    g_vm_threaded    = new name{"vm", "threaded"};
+    register_bool_option(*g_vm_threaded, true,
+                         "(vm) execute bytecode using the threaded interpreter, the switch-based one is used otherwise");
+#endif
     /* TODO(Leo): move to .lean after we add primitives for creating new options on .lean files */
     register_bool_option(name({"debugger", "autorun"}), false,
                          "(debugger) skip debugger startup messages and initial prompt");
@@ -3743,7 +4318,12 @@ void finalize_vm() {
 #if defined(LEAN_MULTI_THREAD)
     delete g_profiler_freq;
 #endif
+    delete g_profiler_output;
+    delete g_profiler_output_mutex;
     delete g_debugger;
+#if defined(LEAN_THREADED_VM)
+    delete g_vm_threaded;
+#endif
 }
 }
 
@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include <vector>
 #include <string>
 #include "util/debug.h"
+#include "util/int64.h"
 #include "util/compiler_hints.h"
 #include "util/rc.h"
 #include "util/interrupt.h"
@@ -319,7 +320,9 @@ enum class opcode {
     SConstructor, Constructor, Num,
     Destruct, Cases2, CasesN, NatCases, BuiltinCases, Proj,
     Apply, InvokeGlobal, InvokeBuiltin, InvokeCFun,
-    Closure, Unreachable, Expr, LocalInfo
+    Closure, Unreachable, Expr, LocalInfo,
+    /* Arithmetic and comparison on natural numbers, see mk_nat_instr. */
+    NatAdd, NatSub, NatMul, NatDiv, NatMod, NatDecEq, NatDecLt, NatDecLe
 };
 
 /** \brief VM instructions */
@@ -358,7 +361,7 @@ class vm_instr {
             vm_local_info * m_local_info;
         };
     };
-    /* Apply, Ret, Destruct and Unreachable do not have arguments */
+    /* Apply, Ret, Destruct, Unreachable and the Nat* instructions do not have arguments */
     friend vm_instr mk_push_instr(unsigned idx);
     friend vm_instr mk_move_instr(unsigned idx);
     friend vm_instr mk_drop_instr(unsigned n);
@@ -375,6 +378,7 @@ class vm_instr {
     friend vm_instr mk_casesn_instr(unsigned num_pc, unsigned const * pcs);
     friend vm_instr mk_builtin_cases_instr(unsigned cases_idx, unsigned num_pc, unsigned const * pcs);
     friend vm_instr mk_apply_instr();
+    friend vm_instr mk_nat_instr(opcode op);
     friend vm_instr mk_invoke_global_instr(unsigned fn_idx);
     friend vm_instr mk_invoke_cfun_instr(unsigned fn_idx);
     friend vm_instr mk_invoke_builtin_instr(unsigned fn_idx);
@@ -516,6 +520,11 @@ vm_instr mk_cases2_instr(unsigned pc1, unsigned pc2);
 vm_instr mk_casesn_instr(unsigned num_pc, unsigned const * pcs);
 vm_instr mk_builtin_cases_instr(unsigned cases_idx, unsigned num_pc, unsigned const * pcs);
 vm_instr mk_apply_instr();
+/** \brief Create an instruction implementing one of the nat builtins (nat.add, nat.decidable_lt, ...).
+    The two arguments are on the top of the stack in reverse order, as for the builtins.
+    The instruction does not allocate memory when the arguments and the result are small numbers,
+    and it uses GMP numerals otherwise. */
+vm_instr mk_nat_instr(opcode op);
 vm_instr mk_invoke_global_instr(unsigned fn_idx);
 vm_instr mk_invoke_cfun_instr(unsigned fn_idx);
 vm_instr mk_invoke_builtin_instr(unsigned fn_idx);
@@ -525,6 +534,8 @@ vm_instr mk_local_info_instr(unsigned idx, name const & n, optional<expr> const
 
 class vm_state;
 class vm_instr;
+/** \brief Compact pre-decoded instruction used by the threaded interpreter (see LEAN_THREADED_VM). */
+struct vm_decoded_instr;
 
 enum class vm_decl_kind { Bytecode, Builtin, CFun };
 
@@ -540,8 +551,9 @@ struct vm_decl_cell {
     optional<std::string> m_olean;
     union {
         struct {
-            unsigned   m_code_size;
-            vm_instr * m_code;
+            unsigned           m_code_size;
+            vm_instr *         m_code;
+            vm_decoded_instr * m_decoded; /* nullptr if LEAN_THREADED_VM is not defined */
         };
         vm_function   m_fn;
         vm_cfunction  m_cfn;
@@ -589,6 +601,7 @@ public:
     unsigned get_arity() const { lean_assert(m_ptr); return m_ptr->m_arity; }
     unsigned get_code_size() const { lean_assert(is_bytecode()); return m_ptr->m_code_size; }
     vm_instr const * get_code() const { lean_assert(is_bytecode()); return m_ptr->m_code; }
+    vm_decoded_instr const * get_decoded_code() const { lean_assert(is_bytecode()); return m_ptr->m_decoded; }
     vm_function get_fn() const { lean_assert(is_builtin()); return m_ptr->m_fn; }
     vm_cfunction get_cfn() const { lean_assert(is_cfun()); return m_ptr->m_cfn; }
     list<vm_local_info> const & get_args_info() const { lean_assert(is_bytecode()); return m_ptr->m_args_info; }
@@ -611,14 +624,17 @@ class vm_state {
     builtin_cases_map           m_builtin_cases_map;
     builtin_cases_vector        m_builtin_cases_vector;
     vm_instr const *            m_code;   /* code of the current function being executed */
+    vm_decoded_instr const *    m_decoded; /* pre-decoded m_code, nullptr if not available */
     unsigned                    m_fn_idx; /* function idx being executed */
     unsigned                    m_pc;     /* program counter */
     unsigned                    m_bp;     /* base pointer */
     unsigned                    m_next_frame_idx{0};
     bool                        m_profiling{false};
     bool                        m_debugging{false};
+    bool                        m_threaded{false}; /* use run_threaded when m_decoded is available */
     struct frame {
         vm_instr const *        m_code;
+        vm_decoded_instr const * m_decoded;
         unsigned                m_fn_idx;
         unsigned                m_num;
         unsigned                m_pc;
@@ -626,15 +642,21 @@ class vm_state {
         unsigned                m_curr_fn_idx;
         /* The following two fields are only used for profiling the code */
         unsigned                m_frame_idx;
-        frame(vm_instr const * code, unsigned fn_idx, unsigned num, unsigned pc, unsigned bp,
-              unsigned curr_fn_idx, unsigned frame_idx):
-            m_code(code), m_fn_idx(fn_idx), m_num(num), m_pc(pc), m_bp(bp),
+        frame(vm_instr const * code, vm_decoded_instr const * decoded, unsigned fn_idx, unsigned num, unsigned pc,
+              unsigned bp, unsigned curr_fn_idx, unsigned frame_idx):
+            m_code(code), m_decoded(decoded), m_fn_idx(fn_idx), m_num(num), m_pc(pc), m_bp(bp),
             m_curr_fn_idx(curr_fn_idx), m_frame_idx(frame_idx) {}
     };
     std::vector<vm_obj>         m_stack;
     std::vector<vm_local_info>  m_stack_info;
     std::vector<frame>          m_call_stack;
-    mutex                       m_call_stack_mtx; /* used only when profiling */
+    /* The following fields are only used when profiling. The profiler thread samples m_profiler_stack,
+       a lock-free copy of the function indices in m_call_stack. The allocations of VM objects are attributed to
+       the function being executed (m_fn_idx) whenever a frame is pushed or popped. */
+    struct profiler_stack;
+    std::unique_ptr<profiler_stack> m_profiler_stack;
+    std::vector<uint64>         m_alloc_counts;
+    size_t                      m_num_allocs{0}; /* number of allocations when m_alloc_counts was updated */
     struct debugger_state;
     typedef std::unique_ptr<debugger_state> debugger_state_ptr;
     debugger_state_ptr          m_debugger_state_ptr;
@@ -646,17 +668,24 @@ class vm_state {
     void shrink_stack_info();
     void stack_pop_back();
     void push_fields(vm_obj const & obj);
-    void push_frame_core(unsigned num, unsigned next_pc, unsigned next_fn_idx);
+    void count_allocs();
+    void update_profiler_stack();
+    void start_profiling();
+    void stop_profiling();
     void push_frame(unsigned num, unsigned next_pc, unsigned next_fn_idx);
-    unsigned pop_frame_core();
     unsigned pop_frame();
+    void push_native_frame(vm_decl const & d);
+    void pop_native_frame();
     void invoke_builtin(vm_decl const & d);
     void invoke_fn(vm_cfunction fn, unsigned arity);
     void invoke_cfun(vm_decl const & d);
     void invoke_global(vm_decl const & d);
     void invoke(vm_decl const & d);
+    void execute_apply();
+    void execute_nat_instr(opcode op);
     void run();
-    void execute(vm_instr const * code);
+    void run_threaded();
+    void execute(unsigned code_sz, vm_instr const * code);
     vm_obj invoke_closure(vm_obj const & fn, unsigned nargs);
 
     vm_decl const & get_decl(unsigned idx) const;
@@ -795,33 +824,44 @@ public:
     }
     vm_obj get_constant(name const & cname);
 
+    /** \brief Sampling profiler, it is enabled by the option `profiler`.
+
+        A separate thread samples the VM call stack (including the builtin and C functions) every
+        `profiler.freq` milliseconds without blocking the VM. The samples are reported in the collapsed stack
+        format used by flamegraph.pl and speedscope when `profiler.output` is set. */
     class profiler {
         typedef std::unique_ptr<interruptible_thread> thread_ptr;
         struct snapshot_core {
-            chrono::milliseconds                  m_duration;
-            std::vector<pair<unsigned, unsigned>> m_stack;
+            chrono::milliseconds  m_duration;
+            std::vector<unsigned> m_stack;
         };
         vm_state &                 m_state;
         atomic<bool>               m_stop;
+        bool                       m_owner; /* true if this profiler enabled profiling at m_state */
         unsigned                   m_freq_ms;
-        thread_ptr                 m_thread_ptr;
+        std::string                m_output;
         std::vector<snapshot_core> m_snapshots;
+        thread_ptr                 m_thread_ptr;
         void stop();
     public:
         profiler(vm_state & s, options const & opts);
         ~profiler();
 
         struct snapshot {
-            chrono::milliseconds              m_duration;
-            std::vector<pair<name, unsigned>> m_stack;
+            chrono::milliseconds m_duration;
+            std::vector<name>    m_stack; /* outermost function first */
         };
 
         struct snapshots {
             std::vector<snapshot>                         m_snapshots;
             std::vector<pair<name, chrono::milliseconds>> m_cum_times;
+            std::vector<pair<name, uint64>>               m_allocs; /* VM objects allocated by each function */
             chrono::milliseconds                          m_total_time;
             bool display(std::string const & what, options const & opts, std::ostream & out) const;
             void display(std::ostream & out) const;
+            /** \brief Write the samples in the collapsed stack format: one line per call stack,
+                with the function names separated by ';', followed by the time in milliseconds. */
+            void display_collapsed(std::ostream & out) const;
         };
         bool enabled() const { return m_thread_ptr.get() != nullptr; }
         snapshots get_snapshots();
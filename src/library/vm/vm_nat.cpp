@@ -5,7 +5,9 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <iostream>
+#include "util/name_map.h"
 #include "library/vm/vm.h"
+#include "library/vm/vm_nat.h"
 #include "library/vm/vm_string.h"
 
 namespace lean {
@@ -324,6 +326,15 @@ vm_obj nat_repeat(vm_obj const &, vm_obj const & f, vm_obj const & n, vm_obj con
     }
 }
 
+static name_map<opcode> * g_nat_opcodes = nullptr;
+
+optional<opcode> get_nat_opcode(name const & fn) {
+    if (opcode const * op = g_nat_opcodes->find(fn))
+        return optional<opcode>(*op);
+    else
+        return optional<opcode>();
+}
+
 void initialize_vm_nat() {
     DECLARE_VM_BUILTIN(name({"nat", "succ"}),             nat_succ);
     DECLARE_VM_BUILTIN(name({"nat", "add"}),              nat_add);
@@ -352,8 +363,19 @@ void initialize_vm_nat() {
     declare_vm_builtin(name({"nat", "rec_on"}),            "nat_rec",          4, nat_rec);
     declare_vm_builtin(name({"nat", "no_confusion"}),      "nat_no_confusion", 5, nat_no_confusion);
     declare_vm_builtin(name({"nat", "no_confusion_type"}), "nat_no_confusion", 3, nat_no_confusion);
+
+    g_nat_opcodes = new name_map<opcode>();
+    g_nat_opcodes->insert(name({"nat", "add"}),          opcode::NatAdd);
+    g_nat_opcodes->insert(name({"nat", "sub"}),          opcode::NatSub);
+    g_nat_opcodes->insert(name({"nat", "mul"}),          opcode::NatMul);
+    g_nat_opcodes->insert(name({"nat", "div"}),          opcode::NatDiv);
+    g_nat_opcodes->insert(name({"nat", "mod"}),          opcode::NatMod);
+    g_nat_opcodes->insert(name({"nat", "decidable_eq"}), opcode::NatDecEq);
+    g_nat_opcodes->insert(name({"nat", "decidable_lt"}), opcode::NatDecLt);
+    g_nat_opcodes->insert(name({"nat", "decidable_le"}), opcode::NatDecLe);
 }
 
 void finalize_vm_nat() {
+    delete g_nat_opcodes;
 }
 }
@@ -13,6 +13,20 @@ unsigned to_unsigned(vm_obj const & o);
 optional<unsigned> try_to_unsigned(vm_obj const & o);
 unsigned force_to_unsigned(vm_obj const & o, unsigned def = std::numeric_limits<unsigned>::max());
 size_t force_to_size_t(vm_obj const & o, size_t def = std::numeric_limits<size_t>::max());
+
+vm_obj nat_add(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_sub(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_mul(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_div(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_mod(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_decidable_eq(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_decidable_lt(vm_obj const & a1, vm_obj const & a2);
+vm_obj nat_decidable_le(vm_obj const & a1, vm_obj const & a2);
+
+/** \brief Return the opcode of the instruction implementing the nat builtin \c fn (e.g., nat.add), if there is one.
+    \see mk_nat_instr */
+optional<opcode> get_nat_opcode(name const & fn);
+
 void initialize_vm_nat();
 void finalize_vm_nat();
 }
@@ -0,0 +1,580 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Gabriel Ebner
+*/
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#include <memory>
+#include "util/interrupt.h"
+#include "util/flet.h"
+#include "util/log_tree.h"
+#include "library/ws_task_queue.h"
+
+#if defined(LEAN_MULTI_THREAD)
+namespace lean {
+
+/* Number of priority lanes, see get_lane. */
+constexpr unsigned g_num_lanes = 4;
+/* Number of locks protecting the state transitions of the tasks. */
+constexpr unsigned g_num_stripes = 64;
+/* Maximum number of worker threads, including the workers spawned to replace workers blocked in wait_for_finish. */
+constexpr unsigned g_max_workers = 1024;
+/* Maximum nesting depth of tasks that a worker executes directly when it waits for them. */
+constexpr unsigned g_max_inline_depth = 16;
+constexpr chrono::milliseconds g_worker_max_idle_time = chrono::milliseconds(1000);
+
+/* The priorities used by the server are the detail levels of the log tree nodes. */
+static unsigned get_lane(unsigned prio) {
+    if (prio < log_tree::DefaultLevel)
+        return 0;
+    else if (prio <= log_tree::ElaborationLevel)
+        return 1;
+    else if (prio < log_tree::CrossModuleLintLevel)
+        return 2;
+    else
+        return 3;
+}
+
+LEAN_THREAD_PTR(gtask, g_current_task);
+struct scoped_current_task : flet<gtask *> {
+    scoped_current_task(gtask * t) : flet(g_current_task, t) {}
+};
+
+LEAN_THREAD_PTR(ws_task_queue, g_current_queue);
+LEAN_THREAD_VALUE(unsigned, g_worker_idx, 0);
+LEAN_THREAD_VALUE(unsigned, g_inline_depth, 0);
+
+/* Chase-Lev work-stealing deque, using the memory orderings of
+   Le et al., "Correct and efficient work-stealing for weak memory models", PPoPP 2013.
+
+   Only the owner pushes and pops at the bottom, other threads steal from the top.
+   The elements are heap-allocated references to the tasks, the stale ones are discarded by ws_task_queue::take.
+   Rings are never deallocated while the deque is alive, since a thief may still read from a ring that
+   has been replaced. */
+class ws_deque {
+    struct ring {
+        std::int64_t                       m_mask;
+        std::unique_ptr<atomic<gtask *>[]> m_items;
+
+        explicit ring(std::int64_t capacity) : m_mask(capacity - 1), m_items(new atomic<gtask *>[capacity]) {}
+        std::int64_t capacity() const { return m_mask + 1; }
+        gtask * get(std::int64_t i) const { return m_items[i & m_mask].load(memory_order_relaxed); }
+        void put(std::int64_t i, gtask * t) { m_items[i & m_mask].store(t, memory_order_relaxed); }
+    };
+
+    atomic<std::int64_t>               m_top;
+    atomic<std::int64_t>               m_bottom;
+    atomic<ring *>                     m_ring;
+    std::vector<std::unique_ptr<ring>> m_rings; // only accessed by the owner
+
+public:
+    ws_deque() : m_top(0), m_bottom(0) {
+        m_rings.emplace_back(new ring(64));
+        m_ring.store(m_rings.back().get());
+    }
+
+    ~ws_deque() {
+        while (gtask * t = pop()) delete t;
+    }
+
+    /* Remark: the result is only a hint if the deque is concurrently modified. */
+    bool empty() const {
+        return m_bottom.load(memory_order_relaxed) <= m_top.load(memory_order_relaxed);
+    }
+
+    void push(gtask * t) {
+        std::int64_t b   = m_bottom.load(memory_order_relaxed);
+        std::int64_t top = m_top.load(memory_order_acquire);
+        ring * r = m_ring.load(memory_order_relaxed);
+        if (b - top > r->capacity() - 1) {
+            ring * new_r = new ring(2 * r->capacity());
+            for (std::int64_t i = top; i < b; i++)
+                new_r->put(i, r->get(i));
+            m_rings.emplace_back(new_r);
+            m_ring.store(new_r, memory_order_release);
+            r = new_r;
+        }
+        r->put(b, t);
+        atomic_thread_fence(memory_order_release);
+        m_bottom.store(b + 1, memory_order_relaxed);
+    }
+
+    gtask * pop() {
+        std::int64_t b = m_bottom.load(memory_order_relaxed) - 1;
+        ring * r = m_ring.load(memory_order_relaxed);
+        m_bottom.store(b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        std::int64_t top = m_top.load(memory_order_relaxed);
+        if (top > b) {
+            m_bottom.store(b + 1, memory_order_relaxed);
+            return nullptr;
+        }
+        gtask * t = r->get(b);
+        if (top == b) {
+            /* last element, race against the thieves */
+            if (!m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+                t = nullptr;
+            m_bottom.store(b + 1, memory_order_relaxed);
+        }
+        return t;
+    }
+
+    /* Remark: may return nullptr if the deque is not empty, but we lost a race against another thread. */
+    gtask * steal() {
+        std::int64_t top = m_top.load(memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+        std::int64_t b = m_bottom.load(memory_order_acquire);
+        if (top >= b)
+            return nullptr;
+        ring * r = m_ring.load(memory_order_acquire);
+        gtask * t = r->get(top);
+        if (!m_top.compare_exchange_strong(top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+            return nullptr;
+        return t;
+    }
+};
+
+struct ws_task_queue::worker {
+    ws_deque                 m_lanes[g_num_lanes];
+    std::unique_ptr<lthread> m_thread;
+    bool                     m_alive = false; // protected by m_workers_mutex
+};
+
+/* State shared by the tasks whose addresses are mapped to the same stripe.
+   The mutex protects the transitions between the states Created, Waiting, Queued and Running,
+   as well as the scheduling information of the tasks. */
+struct ws_task_queue::stripe {
+    mutex                     m_mutex;
+    std::unordered_set<gtask> m_pending; // tasks in the states Waiting and Queued, used by evacuate
+};
+
+struct ws_task_queue::ws_sched_info : public scheduling_info {
+    struct reverse_dep {
+        gtask                             m_task;
+        std::shared_ptr<atomic<unsigned>> m_num_deps;
+    };
+
+    unsigned m_prio;
+    std::vector<reverse_dep> m_reverse_deps;
+    /* Number of unfinished dependencies, plus one while the dependencies are being registered.
+       The counter is shared with the reverse dependency lists of the dependencies, since the
+       task might be cancelled (and its scheduling information deleted) before they finish. */
+    std::shared_ptr<atomic<unsigned>> m_num_deps;
+
+    ws_sched_info(unsigned prio) : m_prio(prio), m_num_deps(std::make_shared<atomic<unsigned>>(1)) {}
+};
+
+ws_task_queue::ws_task_queue(unsigned num_workers) :
+    m_num_workers(num_workers), m_workers(g_max_workers), m_num_slots(0), m_num_alive(0), m_num_blocked(0),
+    m_shutting_down(false), m_inject(g_num_lanes), m_inject_size(0), m_num_sleeping(0), m_num_waiters(0),
+    m_num_active(0), m_stripes(new stripe[g_num_stripes]) {}
+
+ws_task_queue::~ws_task_queue() {
+    join();
+    {
+        lock_guard<mutex> lock(m_sleep_mutex);
+        m_shutting_down = true;
+        m_wake_up_worker.notify_all();
+    }
+    unique_lock<mutex> lock(m_workers_mutex);
+    unsigned num_slots = m_num_slots.load();
+    m_shut_down_cv.wait(lock, [&] {
+            for (unsigned i = 0; i < num_slots; i++) {
+                if (m_workers[i]->m_alive) return false;
+            }
+            return true;
+        });
+    for (unsigned i = 0; i < num_slots; i++) {
+        if (m_workers[i]->m_thread)
+            m_workers[i]->m_thread->join();
+    }
+}
+
+ws_task_queue::stripe & ws_task_queue::get_stripe(gtask const & t) {
+    std::uintptr_t h = reinterpret_cast<std::uintptr_t>(t.get());
+    return m_stripes[(h >> 6) % g_num_stripes];
+}
+
+ws_task_queue::ws_sched_info & ws_task_queue::get_sched_info(gtask const & t) {
+    return static_cast<ws_sched_info &>(*get_data(t)->m_sched_info);
+}
+
+ws_task_queue::worker * ws_task_queue::get_current_worker() {
+    return g_current_queue == this ? m_workers[g_worker_idx].get() : nullptr;
+}
+
+unsigned ws_task_queue::get_default_prio() {
+    if (g_current_task && get_data(*g_current_task) && get_data(*g_current_task)->m_sched_info) {
+        return get_sched_info(*g_current_task).m_prio;
+    } else {
+        return 0;
+    }
+}
+
+void ws_task_queue::submit(gtask const & t, unsigned prio) {
+    if (!t || get_state(t).load() >= task_state::Running) return;
+    submit_core(t, prio);
+}
+
+void ws_task_queue::submit(gtask const & t) {
+    submit(t, get_default_prio());
+}
+
+void ws_task_queue::submit_core(gtask const & t, unsigned prio) {
+    if (!t) return;
+    check_stack("ws_task_queue::submit_core");
+    bool is_new = false, requeue = false;
+    buffer<gtask> deps;
+    {
+        stripe & s = get_stripe(t);
+        lock_guard<mutex> lock(s.m_mutex);
+        switch (get_state(t).load()) {
+        case task_state::Created:
+            get_data(t)->m_sched_info.reset(new ws_sched_info(prio));
+            get_state(t) = task_state::Waiting;
+            s.m_pending.insert(t);
+            m_num_active++;
+            is_new = true;
+            break;
+        case task_state::Waiting:
+            if (prio >= get_sched_info(t).m_prio) return;
+            get_sched_info(t).m_prio = prio;
+            break;
+        case task_state::Queued:
+            if (prio >= get_sched_info(t).m_prio) return;
+            /* The task is pushed again to a lower lane, the old entry is discarded when it is dequeued. */
+            get_sched_info(t).m_prio = prio;
+            requeue = true;
+            break;
+        case task_state::Running: case task_state::Failed: case task_state::Success:
+            return;
+        }
+        if (!requeue) {
+            try {
+                get_data(t)->m_imp->get_dependencies(deps);
+            } catch (...) {}
+        }
+    }
+    if (is_new) {
+        register_deps(t, deps, prio);
+    } else if (requeue) {
+        push(t, prio);
+    } else {
+        /* propagate the new priority to the dependencies */
+        for (auto & dep : deps)
+            submit_core(dep, prio);
+    }
+}
+
+void ws_task_queue::register_deps(gtask const & t, buffer<gtask> const & deps, unsigned prio) {
+    std::shared_ptr<atomic<unsigned>> num_deps;
+    {
+        lock_guard<mutex> lock(get_stripe(t).m_mutex);
+        if (get_state(t).load() != task_state::Waiting) return; // cancelled
+        num_deps = get_sched_info(t).m_num_deps;
+    }
+    for (auto & dep : deps) {
+        if (!dep) continue;
+        submit_core(dep, prio);
+        lock_guard<mutex> lock(get_stripe(dep).m_mutex);
+        switch (get_state(dep).load()) {
+        case task_state::Waiting: case task_state::Queued: case task_state::Running:
+            (*num_deps)++;
+            get_sched_info(dep).m_reverse_deps.push_back({t, num_deps});
+            break;
+        default:
+            break;
+        }
+    }
+    if (--(*num_deps) == 0)
+        make_ready(t);
+}
+
+void ws_task_queue::make_ready(gtask const & t) {
+    unsigned prio;
+    {
+        lock_guard<mutex> lock(get_stripe(t).m_mutex);
+        if (get_state(t).load() != task_state::Waiting) return; // cancelled
+        get_state(t) = task_state::Queued;
+        prio = get_sched_info(t).m_prio;
+    }
+    push(t, prio);
+}
+
+void ws_task_queue::push(gtask const & t, unsigned prio) {
+    unsigned lane = get_lane(prio);
+    if (worker * w = get_current_worker()) {
+        w->m_lanes[lane].push(new gtask(t));
+    } else {
+        lock_guard<mutex> lock(m_inject_mutex);
+        m_inject[lane].push_back(t);
+        m_inject_size++;
+    }
+    wake_up_workers();
+}
+
+bool ws_task_queue::claim(gtask const & t) {
+    stripe & s = get_stripe(t);
+    lock_guard<mutex> lock(s.m_mutex);
+    if (get_state(t).load() != task_state::Queued) return false;
+    get_state(t) = task_state::Running;
+    s.m_pending.erase(t);
+    return true;
+}
+
+void ws_task_queue::run(gtask const & t) {
+    reset_heartbeat();
+    {
+        scoped_current_task scope_cur_task(const_cast<gtask *>(&t));
+        execute(t);
+    }
+    reset_heartbeat();
+    handle_finished(t);
+}
+
+void ws_task_queue::handle_finished(gtask const & t) {
+    lean_always_assert(get_state(t).load() > task_state::Running);
+    std::vector<ws_sched_info::reverse_dep> rdeps;
+    bool submitted = false;
+    {
+        stripe & s = get_stripe(t);
+        lock_guard<mutex> lock(s.m_mutex);
+        if (get_data(t) && get_data(t)->m_sched_info) {
+            submitted = true;
+            std::swap(rdeps, get_sched_info(t).m_reverse_deps);
+            s.m_pending.erase(t);
+            clear(t);
+        }
+    }
+    for (auto & rdep : rdeps) {
+        if (--(*rdep.m_num_deps) == 0)
+            make_ready(rdep.m_task);
+    }
+    if (submitted)
+        m_num_active--;
+    notify_finished();
+}
+
+void ws_task_queue::notify_finished() {
+    if (m_num_waiters.load() > 0) {
+        lock_guard<mutex> lock(m_finished_mutex);
+        m_finished_cv.notify_all();
+    }
+}
+
+void ws_task_queue::wait_for_finish(gtask const & t) {
+    if (!t || get_state(t).load() > task_state::Running) return;
+    submit_core(t, get_default_prio());
+    worker * w = get_current_worker();
+    if (w && g_inline_depth < g_max_inline_depth && claim(t)) {
+        /* Nobody has started the task yet, execute it in this thread instead of blocking the worker. */
+        flet<unsigned> inc_depth(g_inline_depth, g_inline_depth + 1);
+        run(t);
+    } else if (get_state(t).load() <= task_state::Running) {
+        if (w) {
+            /* make sure that there are still m_num_workers workers that are not blocked */
+            m_num_blocked++;
+            wake_up_workers();
+        }
+        {
+            unique_lock<mutex> lock(m_finished_mutex);
+            m_num_waiters++;
+            m_finished_cv.wait(lock, [&] { return get_state(t).load() > task_state::Running; });
+            m_num_waiters--;
+        }
+        if (w) m_num_blocked--;
+    }
+    switch (get_state(t).load()) {
+        case task_state::Failed: case task_state::Success: return;
+        default: throw exception("invalid task state");
+    }
+}
+
+void ws_task_queue::cancel_core(gtask const & t) {
+    if (!t) return;
+    {
+        stripe & s = get_stripe(t);
+        lock_guard<mutex> lock(s.m_mutex);
+        switch (get_state(t).load()) {
+        case task_state::Created: case task_state::Waiting: case task_state::Queued:
+            fail(t, std::make_exception_ptr(cancellation_exception()));
+            break;
+        default:
+            return;
+        }
+    }
+    handle_finished(t);
+}
+
+void ws_task_queue::fail_and_dispose(gtask const & t) {
+    cancel_core(t);
+}
+
+void ws_task_queue::evacuate() {
+    buffer<gtask> to_cancel;
+    for (unsigned i = 0; i < g_num_stripes; i++) {
+        lock_guard<mutex> lock(m_stripes[i].m_mutex);
+        for (auto & t : m_stripes[i].m_pending)
+            to_cancel.push_back(t);
+    }
+    for (auto & t : to_cancel)
+        cancel_core(t);
+}
+
+void ws_task_queue::join() {
+    unique_lock<mutex> lock(m_finished_mutex);
+    m_num_waiters++;
+    m_finished_cv.wait(lock, [&] { return m_num_active.load() == 0; });
+    m_num_waiters--;
+}
+
+bool ws_task_queue::has_work() {
+    if (m_inject_size.load() > 0) return true;
+    unsigned num_slots = m_num_slots.load(memory_order_acquire);
+    for (unsigned i = 0; i < num_slots; i++) {
+        for (auto & lane : m_workers[i]->m_lanes) {
+            if (!lane.empty()) return true;
+        }
+    }
+    return false;
+}
+
+/* Take ownership of the deque entry, and try to claim its task. */
+bool ws_task_queue::take(gtask * entry, gtask & result) {
+    std::unique_ptr<gtask> t(entry);
+    if (!claim(*t)) return false; // stale entry
+    result = std::move(*t);
+    return true;
+}
+
+bool ws_task_queue::find_task(unsigned idx, gtask & result) {
+    worker & self = *m_workers[idx];
+    unsigned num_slots = m_num_slots.load(memory_order_acquire);
+    for (unsigned lane = 0; lane < g_num_lanes; lane++) {
+        while (gtask * e = self.m_lanes[lane].pop()) {
+            if (take(e, result)) return true;
+        }
+        while (m_inject_size.load() > 0) {
+            gtask t;
+            {
+                lock_guard<mutex> lock(m_inject_mutex);
+                if (m_inject[lane].empty()) break;
+                t = std::move(m_inject[lane].front());
+                m_inject[lane].pop_front();
+                m_inject_size--;
+            }
+            if (claim(t)) {
+                result = std::move(t);
+                return true;
+            }
+        }
+        for (unsigned i = 1; i < num_slots; i++) {
+            worker & victim = *m_workers[(idx + i) % num_slots];
+            while (gtask * e = victim.m_lanes[lane].steal()) {
+                if (take(e, result)) return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Called after a task has been pushed, or a worker got blocked. */
+void ws_task_queue::wake_up_workers() {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (m_num_alive.load() - m_num_blocked.load() < static_cast<int>(m_num_workers)) {
+        lock_guard<mutex> lock(m_workers_mutex);
+        if (!m_shutting_down && m_num_alive.load() - m_num_blocked.load() < static_cast<int>(m_num_workers)) {
+            spawn_worker();
+            return;
+        }
+    }
+    if (m_num_sleeping.load() > 0) {
+        lock_guard<mutex> lock(m_sleep_mutex);
+        m_wake_up_epoch++;
+        m_wake_up_worker.notify_one();
+    }
+}
+
+/* Remark: m_workers_mutex must be held. */
+void ws_task_queue::spawn_worker() {
+    unsigned num_slots = m_num_slots.load();
+    unsigned idx = 0;
+    while (idx < num_slots && m_workers[idx]->m_alive) idx++;
+    if (idx == num_slots) {
+        if (num_slots == g_max_workers) return;
+        m_workers[idx].reset(new worker);
+        m_num_slots.store(num_slots + 1, memory_order_release);
+    }
+    worker & w = *m_workers[idx];
+    if (w.m_thread) {
+        /* the previous thread of this slot has already exited its main loop */
+        w.m_thread->join();
+    }
+    w.m_alive = true;
+    m_num_alive++;
+    w.m_thread.reset(new lthread([this, idx]() { worker_main(idx); }));
+}
+
+/* Wait until new tasks are pushed. Return false if the worker has been idle for too long. */
+bool ws_task_queue::sleep() {
+    m_num_sleeping++;
+    bool woken_up = true;
+    {
+        unique_lock<mutex> lock(m_sleep_mutex);
+        if (!m_shutting_down && !has_work()) {
+            unsigned epoch = m_wake_up_epoch;
+            woken_up = m_wake_up_worker.wait_for(lock, g_worker_max_idle_time,
+                                                 [&] { return m_wake_up_epoch != epoch || m_shutting_down; });
+        }
+    }
+    m_num_sleeping--;
+    return woken_up;
+}
+
+/* Try to stop an idle worker. It keeps running if tasks were pushed in the meantime. */
+bool ws_task_queue::retire() {
+    lock_guard<mutex> lock(m_workers_mutex);
+    m_num_alive--;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!m_shutting_down && has_work()) {
+        m_num_alive++;
+        return false;
+    }
+    return true;
+}
+
+void ws_task_queue::worker_main(unsigned idx) {
+    save_stack_info(false);
+    g_current_queue = this;
+    g_worker_idx    = idx;
+
+    while (true) {
+        if (m_shutting_down) {
+            lock_guard<mutex> lock(m_workers_mutex);
+            m_num_alive--;
+            break;
+        }
+        gtask t;
+        if (find_task(idx, t)) {
+            run(t);
+        } else if (!sleep() && retire()) {
+            break;
+        }
+    }
+
+    // We need to run the finalizers while the lock is held,
+    // otherwise we risk a race condition at the end of the program.
+    // We would finalize in the thread, while we call the finalize() function.
+    lock_guard<mutex> lock(m_workers_mutex);
+    run_thread_finalizers();
+    run_post_thread_finalizers();
+    g_current_queue = nullptr;
+    m_workers[idx]->m_alive = false;
+    m_shut_down_cv.notify_all();
+}
+
+}
+#endif
@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Gabriel Ebner
+*/
+#pragma once
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+#include "util/task.h"
+
+namespace lean {
+
+#if defined(LEAN_MULTI_THREAD)
+
+/** \brief Work-stealing task queue.
+
+    Every worker thread owns one lock-free deque per priority lane. Tasks that become ready on a worker
+    are pushed to its own deques, and idle workers steal from the deques of the other workers.
+    Tasks submitted by other threads go through a small injection queue.
+
+    Each task waits for an atomic counter of unfinished dependencies, and the state transitions of a
+    task are protected by one of a fixed number of striped locks. Thus there is no global lock on the
+    path of a task from submission to completion.
+
+    Priorities are grouped into lanes (see get_lane in ws_task_queue.cpp). Ready tasks in lower lanes
+    are always executed first, tasks in the same lane are executed in no particular order. */
+class ws_task_queue : public task_queue {
+    struct worker;
+    struct stripe;
+    struct ws_sched_info;
+
+    unsigned m_num_workers;
+
+    /* Slots of the worker threads. A slot is never deallocated before the queue is destroyed, so
+       other workers can steal from the slots [0, m_num_slots) without taking m_workers_mutex. */
+    std::vector<std::unique_ptr<worker>> m_workers;
+    atomic<unsigned> m_num_slots;
+    mutex m_workers_mutex;
+    condition_variable m_shut_down_cv;
+    atomic<int> m_num_alive;
+    atomic<int> m_num_blocked;
+    atomic<bool> m_shutting_down;
+
+    /* tasks submitted from outside of the worker threads */
+    mutex m_inject_mutex;
+    std::vector<std::deque<gtask>> m_inject;
+    atomic<unsigned> m_inject_size;
+
+    /* idle workers */
+    mutex m_sleep_mutex;
+    condition_variable m_wake_up_worker;
+    unsigned m_wake_up_epoch = 0;
+    atomic<unsigned> m_num_sleeping;
+
+    /* threads waiting in wait_for_finish and join */
+    mutex m_finished_mutex;
+    condition_variable m_finished_cv;
+    atomic<unsigned> m_num_waiters;
+
+    /* number of submitted tasks that have not finished yet */
+    atomic<unsigned> m_num_active;
+
+    std::unique_ptr<stripe[]> m_stripes;
+    stripe & get_stripe(gtask const & t);
+
+    ws_sched_info & get_sched_info(gtask const & t);
+    unsigned get_default_prio();
+    worker * get_current_worker();
+
+    void submit_core(gtask const & t, unsigned prio);
+    void register_deps(gtask const & t, buffer<gtask> const & deps, unsigned prio);
+    void make_ready(gtask const & t);
+    void push(gtask const & t, unsigned prio);
+    bool claim(gtask const & t);
+    void run(gtask const & t);
+    void handle_finished(gtask const & t);
+    void cancel_core(gtask const & t);
+    void notify_finished();
+
+    bool has_work();
+    bool find_task(unsigned idx, gtask & result);
+    bool take(gtask * entry, gtask & result);
+    void wake_up_workers();
+    void spawn_worker();
+    bool sleep();
+    bool retire();
+    void worker_main(unsigned idx);
+
+public:
+    ws_task_queue(unsigned num_workers);
+    ~ws_task_queue();
+
+    void wait_for_finish(gtask const & t) override;
+    void fail_and_dispose(gtask const & t) override;
+
+    void submit(gtask const & t, unsigned prio) override;
+    void submit(gtask const & t) override;
+
+    void evacuate() override;
+
+    void join() override;
+};
+
+#endif
+
+}
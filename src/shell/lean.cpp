@@ -32,6 +32,7 @@ Author: Leonardo de Moura
 #include "kernel/formatter.h"
 #include "library/st_task_queue.h"
 #include "library/mt_task_queue.h"
+#include "library/ws_task_queue.h"
 #include "library/module_mgr.h"
 #include "kernel/standard_kernel.h"
 #include "library/module.h"
@@ -48,6 +49,7 @@ Author: Leonardo de Moura
 #include "library/native_compiler/options.h"
 #include "library/native_compiler/native_compiler.h"
 #include "library/trace.h"
+#include "library/persistent_instance_cache.h"
 #include "init/init.h"
 #include "shell/simple_pos_info_provider.h"
 #include "shell/leandoc.h"
@@ -100,7 +102,10 @@ static void display_help(std::ostream & out) {
 #if defined(LEAN_MULTI_THREAD)
     std::cout << "  --threads=num -j   number of threads used to process lean files\n";
     std::cout << "  --tstack=num -s    thread stack size in Kb\n";
+    std::cout << "  --work-stealing    use the work-stealing task scheduler\n";
 #endif
+    std::cout << "  --hash-cons        share terms between threads and imported modules using global\n"
+              << "                     hash-consing tables\n";
     std::cout << "  --deps             just print dependencies of a Lean input\n";
 #if defined(LEAN_JSON)
     std::cout << "  --path             display the path used for finding Lean libraries and extensions\n";
@@ -135,6 +140,7 @@ static struct option g_long_options[] = {
     {"threads",      required_argument, 0, 'j'},
     {"quiet",        no_argument,       0, 'q'},
     {"deps",         no_argument,       0, 'd'},
+    {"hash-cons",    no_argument,       0, 'H'},
     {"test-suite",   no_argument,       0, 'e'},
 #if defined(LEAN_USE_ALPHA)
     {"compile",      optional_argument, 0, 'C'},
@@ -148,6 +154,7 @@ static struct option g_long_options[] = {
     {"doc",          required_argument, 0, 'r'},
 #if defined(LEAN_MULTI_THREAD)
     {"tstack",       required_argument, 0, 's'},
+    {"work-stealing", no_argument,      0, 'W'},
 #endif
 #ifdef LEAN_DEBUG
     {"debug",        required_argument, 0, 'B'},
@@ -350,6 +357,7 @@ int main(int argc, char ** argv) {
     bool only_deps          = false;
     bool test_suite         = false;
     unsigned num_threads    = 0;
+    bool work_stealing      = false;
 #if defined(LEAN_MULTI_THREAD)
     num_threads = hardware_concurrency();
 #endif
@@ -392,6 +400,9 @@ int main(int argc, char ** argv) {
         case 's':
             lean::lthread::set_thread_stack_size(static_cast<size_t>((atoi(optarg)/4)*4)*static_cast<size_t>(1024));
             break;
+        case 'W':
+            work_stealing = true;
+            break;
         case 'm':
             make_mode = true;
             recursive = true;
@@ -425,6 +436,9 @@ int main(int argc, char ** argv) {
         case 'd':
             only_deps = true;
             break;
+        case 'H':
+            enable_global_hash_consing(true);
+            break;
         case 'D':
             try {
                 opts = set_config_option(opts, optarg);
@@ -495,6 +509,9 @@ int main(int argc, char ** argv) {
         set_max_heartbeat_thousands(timeout);
     }
 
+    if (make_mode || opts.get_bool("server"))
+        opts = opts.update_if_undef(get_persistent_instance_cache_opt_name(), true);
+
     environment env = mk_environment(trust_lvl);
 
     io_state ios(opts, lean::mk_pretty_formatter_factory());
@@ -515,7 +532,7 @@ int main(int argc, char ** argv) {
             std::cin.rdbuf(file_in->rdbuf());
         }
 
-        server(num_threads, path.get_path(), env, ios).run();
+        server(num_threads, path.get_path(), env, ios, work_stealing).run();
         return 0;
     }
 #endif
@@ -556,6 +573,8 @@ int main(int argc, char ** argv) {
 #if defined(LEAN_MULTI_THREAD)
         if (num_threads == 0) {
             tq = std::make_shared<st_task_queue>();
+        } else if (work_stealing) {
+            tq = std::make_shared<ws_task_queue>(num_threads);
         } else {
             tq = std::make_shared<mt_task_queue>(num_threads);
         }
@@ -593,6 +612,7 @@ int main(int argc, char ** argv) {
         }
 
         mod_mgr.set_save_olean(make_mode);
+        mod_mgr.set_olean_cache(get_olean_cache_from_env());
 
         std::vector<std::string> args(argv + optind, argv + argc);
         if (recursive) {
@@ -650,6 +670,11 @@ int main(int argc, char ** argv) {
 
         taskq().wait_for_finish(lt.get_root().wait_for_finish());
 
+        if (is_global_hash_consing_enabled() && opts.get_bool("profiler", false)) {
+            std::cerr << "hash-consing expressions: " << get_expr_hash_cons_stats() << "\n";
+            std::cerr << "hash-consing levels: " << get_level_hash_cons_stats() << "\n";
+        }
+
         for (auto & mod : mods) {
             if (test_suite) {
                 std::ofstream out(mod.m_id + ".test_suite.out");
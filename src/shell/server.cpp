@@ -12,6 +12,7 @@ Authors: Gabriel Ebner, Leonardo de Moura, Sebastian Ullrich
 #endif
 
 #include <list>
+#include <map>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -23,10 +24,11 @@ Authors: Gabriel Ebner, Leonardo de Moura, Sebastian Ullrich
 #include "util/timer.h"
 #include "library/mt_task_queue.h"
 #include "library/st_task_queue.h"
+#include "library/ws_task_queue.h"
 #include "library/attribute_manager.h"
 #include "library/tactic/tactic_state.h"
 #include "frontends/lean/parser.h"
-#include "frontends/lean/info_manager.h"
+#include "frontends/lean/info_index.h"
 #include "frontends/lean/interactive.h"
 #include "frontends/lean/completion.h"
 #include "shell/server.h"
@@ -47,6 +49,27 @@ struct all_messages_msg {
     }
 };
 
+/* Response of the delta message protocol, see server::message_handler::set_delta_mode. */
+struct messages_delta_msg {
+    std::vector<pair<unsigned, message>> m_added;
+    std::vector<unsigned> m_removed;
+
+    json to_json_response() const {
+        auto added = json::array();
+        for (auto & p : m_added) {
+            json msg = json_of_message(p.second);
+            msg["id"] = p.first;
+            added.push_back(msg);
+        }
+
+        json j;
+        j["response"] = "messages_delta";
+        j["added"] = added;
+        j["removed"] = m_removed;
+        return j;
+    }
+};
+
 region_of_interest::intersection_result region_of_interest::intersects(location const & loc) const {
     if (loc.m_file_name.empty()) return InROI;
     if (!m_open_files || !m_open_files->count(loc.m_file_name)) return NoIntersection;
@@ -104,14 +127,13 @@ public:
         if (use_timer) m_timer.reset(new single_timer);
     }
 
-    std::vector<message> get_messages_core(region_of_interest const & roi) {
-        std::vector<message> msgs;
+    void for_each_message(region_of_interest const & roi, std::function<void(log_entry const &, message const &)> const & fn) { // NOLINT
         m_lt->for_each([&] (log_tree::node const & n) {
             if (roi.should_report(n.get_location())) {
                 for (auto & e : n.get_entries()) {
                     if (auto msg = dynamic_cast<message const *>(e.get())) {
                         if (roi.should_report(msg->get_location()))
-                            msgs.push_back(*msg);
+                            fn(e, *msg);
                     }
                 }
                 return true;
@@ -119,15 +141,133 @@ public:
                 return false;
             }
         });
+    }
+
+    std::vector<message> get_messages_core(region_of_interest const & roi) {
+        std::vector<message> msgs;
+        for_each_message(roi, [&] (log_entry const &, message const & msg) { msgs.push_back(msg); });
         return msgs;
     }
 
+    /* Delta protocol: instead of sending all messages on every change, we assign an id to each message
+       reported to the client, and only send the messages added and the ids of the messages removed
+       since the last update. The changes are computed from the log tree events.
+       The messages are identified by their log entries. */
+    bool m_delta_mode = false;
+    unsigned m_next_msg_id = 0;
+    /* Messages known by the client, including the ones in m_added. */
+    std::unordered_map<log_entry_cell const *, pair<unsigned, log_entry>> m_reported;
+    /* Changes since the last update. */
+    std::map<unsigned, log_entry> m_added;
+    std::vector<unsigned> m_removed;
+
+    void add_to_delta(log_entry const & e) {
+        if (m_reported.count(e.get()))
+            return;
+        unsigned id = m_next_msg_id++;
+        m_reported.emplace(e.get(), mk_pair(id, e));
+        m_added.emplace(id, e);
+    }
+
+    void remove_from_delta(log_entry_cell const * e) {
+        auto it = m_reported.find(e);
+        if (it == m_reported.end())
+            return;
+        unsigned id = it->second.first;
+        m_reported.erase(it);
+        if (!m_added.erase(id))
+            m_removed.push_back(id);
+    }
+
+    /* Make sure the messages known by the client are exactly the ones in the region of interest. */
+    void resync_delta(region_of_interest const & roi) {
+        std::unordered_set<log_entry_cell const *> current;
+        for_each_message(roi, [&] (log_entry const & e, message const &) {
+                current.insert(e.get());
+                add_to_delta(e);
+            });
+        buffer<log_entry_cell const *> to_remove;
+        for (auto & p : m_reported) {
+            if (!current.count(p.first))
+                to_remove.push_back(p.first);
+        }
+        for (auto e : to_remove)
+            remove_from_delta(e);
+    }
+
+    /* Remark: the log tree delivers events after releasing its lock, so the entry may have been removed
+       (and the corresponding EntryRemoved event delivered) before we process an EntryAdded event. */
+    static bool is_current_entry(log_tree::event const & e) {
+        if (e.m_node.is_detached())
+            return false;
+        for (auto & e2 : e.m_node.get_entries()) {
+            if (e2 == e.m_entry)
+                return true;
+        }
+        return false;
+    }
+
+    /* Send the pending changes, the caller must hold m_mutex to make sure the updates are sent in order. */
+    void send_delta() {
+        if (m_added.empty() && m_removed.empty())
+            return;
+        messages_delta_msg msg;
+        for (auto & p : m_added)
+            msg.m_added.emplace_back(p.first, *static_cast<message const *>(p.second.get()));
+        msg.m_removed = std::move(m_removed);
+        m_added.clear();
+        m_removed.clear();
+        m_srv->send_msg(msg);
+    }
+
+    void schedule_delta() {
+#if defined(LEAN_MULTI_THREAD)
+        if (m_timer) {
+            m_timer->set(chrono::steady_clock::now() + chrono::milliseconds(100), [&] {
+                    unique_lock<mutex> lock(m_mutex);
+                    if (m_delta_mode)
+                        send_delta();
+                }, false);
+            return;
+        }
+#endif
+        send_delta();
+    }
+
+    void on_event_delta(region_of_interest const & roi, std::vector<log_tree::event> const & events) {
+        /* When a node is replaced by a clone, its entries are removed and added again in the same batch. */
+        std::unordered_set<log_entry_cell const *> added;
+        for (auto & e : events) {
+            if (e.m_kind == log_tree::event::EntryAdded)
+                added.insert(e.m_entry.get());
+        }
+        for (auto & e : events) {
+            auto msg = dynamic_cast<message const *>(e.m_entry.get());
+            if (!msg) continue;
+            switch (e.m_kind) {
+                case log_tree::event::EntryAdded:
+                    if (roi.should_report(e.m_node.get_location()) && roi.should_report(msg->get_location()) &&
+                        is_current_entry(e))
+                        add_to_delta(e.m_entry);
+                    break;
+                case log_tree::event::EntryRemoved:
+                    if (!added.count(e.m_entry.get()))
+                        remove_from_delta(e.m_entry.get());
+                    break;
+                default: break;
+            }
+        }
+        if (!m_added.empty() || !m_removed.empty())
+            schedule_delta();
+    }
+
     void schedule_refresh() {
 #if defined(LEAN_MULTI_THREAD)
         if (m_timer) {
             m_full_refresh_scheduled = true;
             m_timer->set(chrono::steady_clock::now() + chrono::milliseconds(100), [&] {
                     unique_lock<mutex> lock(m_mutex);
+                    if (m_delta_mode) return;
                     m_full_refresh_scheduled = false;
                     m_dirty_files.clear();
                     auto roi = m_srv->get_roi();
@@ -146,6 +286,10 @@ public:
     void on_event(std::vector<log_tree::event> const & events) {
         unique_lock<mutex> lock(m_mutex);
         auto roi = m_srv->get_roi();
+        if (m_delta_mode) {
+            on_event_delta(roi, events);
+            return;
+        }
         for (auto & e : events) {
             switch (e.m_kind) {
                 case log_tree::event::EntryAdded:
@@ -167,7 +311,33 @@ public:
 
     void on_new_roi() {
         unique_lock<mutex> lock(m_mutex);
-        schedule_refresh();
+        if (m_delta_mode) {
+            resync_delta(m_srv->get_roi());
+            schedule_delta();
+        } else {
+            schedule_refresh();
+        }
+    }
+
+    /* Switch between the full protocol (all_messages responses) and the delta protocol
+       (messages_delta responses). In both cases, all messages are sent to the client. */
+    void set_delta_mode(bool delta_mode) {
+        unique_lock<mutex> lock(m_mutex);
+#if defined(LEAN_MULTI_THREAD)
+        if (m_timer) m_timer->reset();
+#endif
+        m_full_refresh_scheduled = false;
+        m_dirty_files.clear();
+        m_reported.clear();
+        m_added.clear();
+        m_removed.clear();
+        m_delta_mode = delta_mode;
+        if (m_delta_mode) {
+            resync_delta(m_srv->get_roi());
+            send_delta();
+        } else {
+            schedule_refresh();
+        }
     }
 };
 
@@ -293,23 +463,28 @@ public:
     }
 };
 
-server::server(unsigned num_threads, search_path const & path, environment const & initial_env, io_state const & ios) :
+server::server(unsigned num_threads, search_path const & path, environment const & initial_env, io_state const & ios,
+               bool work_stealing) :
         m_path(path), m_initial_env(initial_env), m_ios(ios) {
     m_ios.set_regular_channel(std::make_shared<stderr_channel>());
     m_ios.set_diagnostic_channel(std::make_shared<stderr_channel>());
 
     m_msg_handler.reset(new message_handler(this, &m_lt, num_threads > 0));
     m_tasks_handler.reset(new tasks_handler(this, &m_lt, num_threads > 0));
+    m_info_index.reset(new info_index);
 
     m_lt.add_listener([&] (std::vector<log_tree::event> const & evs) {
         m_msg_handler->on_event(evs);
         m_tasks_handler->on_event(evs);
+        m_info_index->on_event(evs);
     });
 
     scope_global_ios scoped_ios(m_ios);
 #if defined(LEAN_MULTI_THREAD)
     if (num_threads == 0) {
         m_tq.reset(new st_task_queue);
+    } else if (work_stealing) {
+        m_tq.reset(new ws_task_queue(num_threads));
     } else {
         m_tq.reset(new mt_task_queue(num_threads));
     }
@@ -321,6 +496,7 @@ server::server(unsigned num_threads, search_path const & path, environment const
     m_mod_mgr.reset(new module_mgr(this, m_lt.get_root(), m_path, m_initial_env, m_ios));
     m_mod_mgr->set_server_mode(true);
     m_mod_mgr->set_save_olean(true);
+    m_mod_mgr->set_olean_cache(get_olean_cache_from_env());
 }
 
 server::~server() {
@@ -447,6 +623,8 @@ void server::handle_request(server::cmd_req const & req) {
         send_msg(handle_search(req));
     } else if (command == "roi") {
         send_msg(handle_roi(req));
+    } else if (command == "message_protocol") {
+        send_msg(handle_message_protocol(req));
     } else if (command == "sleep") {
         chrono::milliseconds small_delay(1000);
         this_thread::sleep_for(small_delay);
@@ -484,17 +662,17 @@ server::cmd_res server::handle_sync(server::cmd_req const & req) {
         new_content = load_module(new_file_name, /* can_use_olean */ false)->m_contents;
     }
 
-    auto mtime = time(nullptr);
-
     bool needs_invalidation = true;
 
-    auto & ef = m_open_files[new_file_name];
-    if (ef.m_content != new_content) {
-        ef.m_content = new_content;
-        ef.m_mtime = mtime;
-        needs_invalidation = true;
-    } else {
-        needs_invalidation = false;
+    {
+        lock_guard<mutex> _(m_open_files_mutex);
+        auto & ef = m_open_files[new_file_name];
+        if (ef.m_content != new_content) {
+            ef.m_content = new_content;
+            needs_invalidation = true;
+        } else {
+            needs_invalidation = false;
+        }
     }
 
     json res;
@@ -583,23 +761,6 @@ task<server::cmd_res> server::handle_complete(cmd_req const & req) {
         .build();
 }
 
-static void get_info_managers(log_tree::node const & n, std::vector<info_manager> & infoms) {
-    n.for_each([&] (log_tree::node const & c) {
-        for (auto & e : c.get_entries()) {
-            if (auto infom = dynamic_cast<info_manager const *>(e.get())) {
-                infoms.push_back(*infom);
-            }
-        }
-        return true;
-    });
-}
-
-std::vector<info_manager> get_info_managers(log_tree const & t) {
-    std::vector<info_manager> infoms;
-    get_info_managers(t.get_root(), infoms);
-    return infoms;
-}
-
 json server::info(std::shared_ptr<module_info const> const & mod_info, pos_info const & pos) {
     json j;
     try {
@@ -611,7 +772,7 @@ json server::info(std::shared_ptr<module_info const> const & mod_info, pos_info
             env = snap->m_snapshot_at_end->m_env;
             opts = snap->m_snapshot_at_end->m_options;
         }
-        report_info(env, opts, m_ios, m_path, *mod_info, get_info_managers(m_lt), pos, e, j);
+        report_info(env, opts, m_ios, m_path, *mod_info, *m_info_index, pos, e, j);
     } catch (throwable & ex) {}
 
     return j;
@@ -635,8 +796,7 @@ task<server::cmd_res> server::handle_info(server::cmd_req const & req) {
 json server::hole_command(std::shared_ptr<module_info const> const & mod_info, std::string const & action,
                           pos_info const & pos) {
     json j;
-    std::vector<info_manager> im = get_info_managers(m_lt);
-    execute_hole_command(*mod_info, im, pos, action, j);
+    execute_hole_command(*mod_info, *m_info_index, pos, action, j);
     return j;
 }
 
@@ -657,18 +817,16 @@ server::cmd_res server::handle_hole_commands(server::cmd_req const & req) {
     std::string fn     = req.m_payload.at("file_name");
     pos_info pos       = {req.m_payload.at("line"), req.m_payload.at("column")};
     auto mod_info      = m_mod_mgr->get_module(fn);
-    std::vector<info_manager> im = get_info_managers(m_lt);
     json j;
-    get_hole_commands(*mod_info, im, pos, j);
+    get_hole_commands(*mod_info, *m_info_index, pos, j);
     return cmd_res(req.m_seq_num, j);
 }
 
 server::cmd_res server::handle_all_hole_commands(server::cmd_req const & req) {
     std::string fn     = req.m_payload.at("file_name");
     auto mod_info      = m_mod_mgr->get_module(fn);
-    std::vector<info_manager> im = get_info_managers(m_lt);
     json j;
-    get_all_hole_commands(*mod_info, im, j);
+    get_all_hole_commands(*mod_info, *m_info_index, j);
     return cmd_res(req.m_seq_num, j);
 }
 
@@ -690,11 +848,14 @@ server::cmd_res server::handle_search(server::cmd_req const & req) {
 }
 
 std::shared_ptr<module_info> server::load_module(module_id const & id, bool can_use_olean) {
-    if (m_open_files.count(id)) {
-        auto & ef = m_open_files[id];
-        auto mod = std::make_shared<module_info>(id, ef.m_content, module_src::LEAN, ef.m_mtime);
-        mod->m_dirty = true;
-        return mod;
+    {
+        lock_guard<mutex> _(m_open_files_mutex);
+        auto it = m_open_files.find(id);
+        if (it != m_open_files.end()) {
+            auto mod = std::make_shared<module_info>(id, it->second.m_content, module_src::LEAN);
+            mod->m_dirty = true;
+            return mod;
+        }
     }
     return m_fs_vfs.load_module(id, can_use_olean);
 }
@@ -751,6 +912,18 @@ server::cmd_res server::handle_roi(server::cmd_req const & req) {
     return cmd_res(req.m_seq_num, json());
 }
 
+server::cmd_res server::handle_message_protocol(server::cmd_req const & req) {
+    std::string mode = req.m_payload.at("mode");
+    if (mode == "full") {
+        m_msg_handler->set_delta_mode(false);
+    } else if (mode == "delta") {
+        m_msg_handler->set_delta_mode(true);
+    } else {
+        throw exception(sstream() << "unknown message protocol: " << mode);
+    }
+    return cmd_res(req.m_seq_num, json());
+}
+
 void initialize_server() {
 }
 
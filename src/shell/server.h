@@ -52,6 +52,8 @@ struct region_of_interest {
     optional<unsigned> get_priority(log_tree::node const & n) const;
 };
 
+class info_index;
+
 class server : public module_vfs {
     search_path m_path;
 
@@ -60,10 +62,11 @@ class server : public module_vfs {
     io_state m_ios;
 
     struct editor_file {
-        time_t m_mtime;
         std::string m_content;
     };
     std::unordered_map<std::string, editor_file> m_open_files;
+    /* The module manager also loads modules from tasks checking the dependents of rebuilt modules. */
+    mutex m_open_files_mutex;
 
     mutex m_roi_mutex;
     region_of_interest m_roi;
@@ -76,6 +79,8 @@ class server : public module_vfs {
     std::unique_ptr<message_handler> m_msg_handler;
     class tasks_handler;
     std::unique_ptr<tasks_handler> m_tasks_handler;
+    /* info records of the log tree entries, used by the info and hole commands */
+    std::unique_ptr<info_index> m_info_index;
 
     std::unique_ptr<module_mgr> m_mod_mgr;
     std::unique_ptr<task_queue> m_tq;
@@ -102,13 +107,15 @@ class server : public module_vfs {
     cmd_res handle_all_hole_commands(cmd_req const & req);
     cmd_res handle_search(cmd_req const & req);
     cmd_res handle_roi(cmd_req const & req);
+    cmd_res handle_message_protocol(cmd_req const & req);
 
     json autocomplete(std::shared_ptr<module_info const> const & mod_info, bool skip_completions, pos_info const & pos);
     json hole_command(std::shared_ptr<module_info const> const & mod_info, std::string const & action, pos_info const & pos);
     json info(std::shared_ptr<module_info const> const & mod_info, pos_info const & pos);
 
 public:
-    server(unsigned num_threads, search_path const & path, environment const & intial_env, io_state const & ios);
+    server(unsigned num_threads, search_path const & path, environment const & intial_env, io_state const & ios,
+           bool work_stealing = false);
     ~server();
 
     std::shared_ptr<module_info> load_module(module_id const & id, bool can_use_olean) override;
@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include <vector>
 #include <limits>
 #include "util/test.h"
+#include "util/thread.h"
 #include "util/init_module.h"
 #include "util/sexpr/init_module.h"
 #include "kernel/expr.h"
@@ -376,6 +377,56 @@ static void tst18() {
     lean_assert(!has_local(mk_app(f, a0, a0, a0, a0)));
 }
 
+static expr mk_hash_cons_term() {
+    expr f = Const("f");
+    expr g = Const("g");
+    expr Type = mk_Type();
+    expr x = Local("x", Type);
+    expr r = Const("a");
+    for (unsigned i = 0; i < 50; i++)
+        r = mk_app(f, mk_app(g, r, mk_constant("c", {mk_succ(mk_param_univ("u"))})), Fun(x, x));
+    return r;
+}
+
+static void tst19() {
+    bool old = enable_global_hash_consing(true);
+    uint64 size;
+    {
+        expr t1, t2;
+        {
+            scoped_expr_caching disable(false);
+            t1 = mk_hash_cons_term();
+            t2 = mk_hash_cons_term();
+        }
+        lean_assert(!is_eqp(t1, t2));
+        expr s1 = hash_cons(t1);
+        expr s2 = hash_cons(t2);
+        lean_assert(is_eqp(s1, s2));
+        lean_assert(s1 == t1);
+        lean_assert(is_cached(s1));
+        lean_assert(get_expr_hash_cons_stats().m_hits > 0);
+        lean_assert(get_level_hash_cons_stats().m_size > 0);
+        /* terms created by different threads while caching is enabled are shared */
+        std::vector<expr> rs(4);
+        std::vector<thread> threads;
+        for (unsigned i = 0; i < rs.size(); i++) {
+            threads.push_back(thread([i, &rs]() {
+                        scoped_expr_caching enable(true);
+                        rs[i] = mk_hash_cons_term();
+                    }));
+        }
+        for (thread & t : threads)
+            t.join();
+        for (expr const & r : rs)
+            lean_assert(is_eqp(r, s1));
+        size = get_expr_hash_cons_stats().m_size;
+        std::cout << "expr hash-consing table size: " << size << "\n";
+    }
+    /* cells are removed from the table when they are deallocated */
+    lean_assert(get_expr_hash_cons_stats().m_size + 150 <= size);
+    enable_global_hash_consing(old);
+}
+
 int main() {
     save_stack_info();
     initialize_util_module();
@@ -403,6 +454,7 @@ int main() {
     tst16();
     tst17();
     tst18();
+    tst19();
     std::cout << "sizeof(expr):            " << sizeof(expr) << "\n";
     std::cout << "sizeof(expr_cell):       " << sizeof(expr_cell) << "\n";
     std::cout << "sizeof(expr_app):        " << sizeof(expr_app) << "\n";
@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "util/test.h"
+#include "util/thread.h"
+#include "util/biased_rc.h"
+#include "util/init_module.h"
+using namespace lean;
+
+#if defined(LEAN_MULTI_THREAD)
+static atomic<unsigned> g_created(0);
+static atomic<unsigned> g_deleted(0);
+
+struct cell {
+    MK_LEAN_BIASED_RC_CORE()
+    unsigned m_value;
+    void dealloc() { g_deleted++; delete this; }
+    explicit cell(unsigned v):m_rc(0), m_value(v) { g_created++; }
+};
+
+class ref {
+    cell * m_ptr;
+public:
+    explicit ref(unsigned v):m_ptr(new cell(v)) { m_ptr->inc_ref(); }
+    ref(ref const & r):m_ptr(r.m_ptr) { if (m_ptr) m_ptr->inc_ref(); }
+    ref(ref && r):m_ptr(r.m_ptr) { r.m_ptr = nullptr; }
+    ~ref() { if (m_ptr) m_ptr->dec_ref(); }
+    ref & operator=(ref const & r) { LEAN_COPY_REF(r); }
+    ref & operator=(ref && r) { LEAN_MOVE_REF(r); }
+    unsigned value() const { return m_ptr->m_value; }
+    unsigned get_rc() const { return m_ptr->get_rc(); }
+};
+
+/* Remark: we do not use lean_assert since the test is also executed in release mode. */
+static void check(bool cond, char const * msg) {
+    if (!cond) {
+        std::cerr << "Error: " << msg << "\n";
+        exit(1);
+    }
+}
+
+static void check_all_deleted() {
+    process_biased_rc_queue();
+    check(g_created == g_deleted, "objects were not deleted");
+}
+
+/* objects used by a single thread */
+static void tst1() {
+    {
+        std::vector<ref> v;
+        for (unsigned i = 0; i < 1000; i++)
+            v.push_back(ref(i));
+        std::vector<ref> w(v);
+        check(v[10].get_rc() == 2, "unexpected reference counter");
+        for (unsigned i = 0; i < 1000; i++)
+            check(w[i].value() == i, "unexpected value");
+    }
+    check_all_deleted();
+}
+
+/* the biased counter overflows */
+static void tst2() {
+    {
+        ref r(0);
+        std::vector<ref> v(200000, r);
+        check(r.get_rc() == 200001, "unexpected reference counter");
+    }
+    check_all_deleted();
+}
+
+/* objects created by the current thread are copied and released by other threads */
+static void tst3() {
+    {
+        std::vector<ref> v;
+        for (unsigned i = 0; i < 1000; i++)
+            v.push_back(ref(i));
+        std::vector<thread> threads;
+        for (unsigned i = 0; i < 4; i++) {
+            threads.emplace_back([&]() {
+                    for (unsigned j = 0; j < 100; j++) {
+                        std::vector<ref> w(v);
+                        for (unsigned k = 0; k < w.size(); k++)
+                            check(w[k].value() == k, "unexpected value");
+                    }
+                    run_thread_finalizers();
+                });
+        }
+        for (auto & t : threads)
+            t.join();
+    }
+    check_all_deleted();
+}
+
+/* the current thread transfers its references to other threads, the objects are released by the other threads */
+static void tst4() {
+    std::vector<thread> threads;
+    for (unsigned i = 0; i < 4; i++) {
+        std::vector<ref> v;
+        for (unsigned j = 0; j < 1000; j++)
+            v.push_back(ref(j));
+        threads.emplace_back([](std::vector<ref> v) {
+                v.clear();
+                run_thread_finalizers();
+            }, std::move(v));
+    }
+    for (auto & t : threads)
+        t.join();
+    /* the objects are only deleted when this thread processes its queue */
+    check_all_deleted();
+}
+
+/* objects created by threads that finish before the objects are released */
+static void tst5() {
+    std::vector<ref> v;
+    mutex m;
+    std::vector<thread> threads;
+    for (unsigned i = 0; i < 4; i++) {
+        threads.emplace_back([&]() {
+                std::vector<ref> w;
+                for (unsigned j = 0; j < 1000; j++)
+                    w.push_back(ref(j));
+                {
+                    lock_guard<mutex> lock(m);
+                    v.insert(v.end(), w.begin(), w.end());
+                }
+                run_thread_finalizers();
+            });
+    }
+    for (auto & t : threads)
+        t.join();
+    check(v.size() == 4000, "unexpected number of objects");
+    v.clear();
+    check_all_deleted();
+}
+
+/* more threads than thread identifiers, the identifiers of finished threads are reused */
+static void tst6() {
+    std::vector<ref> v;
+    for (unsigned i = 0; i < 5000; i++) {
+        thread t([&]() {
+                v.push_back(ref(i));
+                run_thread_finalizers();
+            });
+        t.join();
+    }
+    v.clear();
+    check_all_deleted();
+    bool has_id = false;
+    thread t([&]() {
+            ref r(0);
+            has_id = g_biased_rc_thread_id != LEAN_BIASED_RC_NO_THREAD;
+            run_thread_finalizers();
+        });
+    t.join();
+    check(has_id, "thread identifier was not reused");
+}
+
+int main() {
+    save_stack_info();
+    initialize_util_module();
+    tst1();
+    tst2();
+    tst3();
+    tst4();
+    tst5();
+    tst6();
+    finalize_util_module();
+    return has_violations() ? 1 : 0;
+}
+#else
+int main() { return 0; }
+#endif
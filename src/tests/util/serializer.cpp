@@ -17,6 +17,7 @@ Author: Leonardo de Moura
 #include "util/list.h"
 #include "util/name.h"
 #include "util/init_module.h"
+#include "util/mapped_file.h"
 using namespace lean;
 
 template<typename T>
@@ -171,6 +172,25 @@ static void tst4() {
     lean_assert_eq(d5, o5);
 }
 
+static void tst5() {
+    std::ostringstream out;
+    serializer s(out);
+    s << std::string("before");
+    s.write_blob(std::string("blob contents"));
+    s << 42u;
+    std::string data = out.str();
+    memory_istream in(data.data(), data.data() + data.size());
+    deserializer d(in);
+    std::string before; unsigned after;
+    d >> before;
+    auto blob = d.skip_blob();
+    d >> after;
+    lean_assert_eq(before, "before");
+    lean_assert_eq(std::string(data.data() + blob.first, blob.second), "blob contents");
+    lean_assert_eq(after, 42u);
+    lean_assert(in.good());
+}
+
 int main() {
     save_stack_info();
     initialize_util_module();
@@ -179,6 +199,7 @@ int main() {
     tst2();
     tst3();
     tst4();
+    tst5();
     finalize_util_module();
     return has_violations() ? 1 : 0;
 }
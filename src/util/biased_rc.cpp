@@ -0,0 +1,202 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <utility>
+#include <vector>
+#include "util/biased_rc.h"
+
+namespace lean {
+#if defined(LEAN_MULTI_THREAD)
+#ifdef MSVC
+__declspec(thread) unsigned short g_biased_rc_thread_id = LEAN_BIASED_RC_NO_THREAD;
+__declspec(thread) long long g_biased_rc_num_owned = 0;
+#else
+__thread unsigned short g_biased_rc_thread_id = LEAN_BIASED_RC_NO_THREAD;
+__thread long long g_biased_rc_num_owned = 0;
+#endif
+LEAN_THREAD_VALUE(bool, g_biased_rc_initialized, false);
+
+/* Maximal number of threads owning objects at the same time, the objects created by other threads
+   only use the shared counter. */
+static constexpr unsigned g_max_biased_rc_threads = 4096;
+
+struct biased_rc_thread {
+    mutex                                          m_mutex;
+    std::vector<std::pair<void *, biased_rc_merge_fn>> m_queue;
+    atomic<bool>                                   m_pending{false};
+    bool                                           m_finished{false};
+    /* Number of objects owned by the thread whose counters have not been merged yet, it is only used after the
+       thread has finished (before that, it is stored in g_biased_rc_num_owned).
+       The identifier of the thread can be reused when it becomes zero. */
+    atomic<long long>                              m_num_owned{0};
+};
+
+static mutex                      g_biased_rc_mutex;
+static unsigned short             g_biased_rc_next_id = 1;
+static std::vector<unsigned short> * g_biased_rc_free_ids = nullptr;
+static biased_rc_thread *         g_biased_rc_threads[g_max_biased_rc_threads];
+
+static void release_biased_rc_thread_id(unsigned short id) {
+    lock_guard<mutex> lock(g_biased_rc_mutex);
+    g_biased_rc_free_ids->push_back(id);
+}
+
+static void finalize_biased_rc_thread(void *) { // NOLINT
+    unsigned short id = g_biased_rc_thread_id;
+    if (id == LEAN_BIASED_RC_NO_THREAD)
+        return;
+    /* The objects still owned by this thread are merged by the threads releasing them, and
+       the ones released by this thread from now on use the shared counter. */
+    g_biased_rc_thread_id = LEAN_BIASED_RC_NO_THREAD;
+    biased_rc_thread * t = g_biased_rc_threads[id];
+    std::vector<std::pair<void *, biased_rc_merge_fn>> queue;
+    long long num_owned;
+    {
+        lock_guard<mutex> lock(t->m_mutex);
+        t->m_finished = true;
+        t->m_pending  = false;
+        queue.swap(t->m_queue);
+        num_owned = t->m_num_owned.fetch_add(g_biased_rc_num_owned) + g_biased_rc_num_owned;
+        g_biased_rc_num_owned = 0;
+    }
+    if (num_owned == 0)
+        release_biased_rc_thread_id(id);
+    for (auto const & p : queue)
+        p.second(p.first);
+}
+
+unsigned short init_biased_rc_thread_id() {
+    if (g_biased_rc_initialized)
+        return 0;
+    g_biased_rc_initialized = true;
+    unsigned short id = 0;
+    {
+        lock_guard<mutex> lock(g_biased_rc_mutex);
+        if (!g_biased_rc_free_ids)
+            g_biased_rc_free_ids = new std::vector<unsigned short>();
+        if (!g_biased_rc_free_ids->empty()) {
+            id = g_biased_rc_free_ids->back();
+            g_biased_rc_free_ids->pop_back();
+        } else if (g_biased_rc_next_id < g_max_biased_rc_threads) {
+            id = g_biased_rc_next_id++;
+            g_biased_rc_threads[id] = new biased_rc_thread();
+        }
+    }
+    if (id == 0)
+        return 0;
+    biased_rc_thread * t = g_biased_rc_threads[id];
+    {
+        lock_guard<mutex> lock(t->m_mutex);
+        t->m_finished  = false;
+        t->m_num_owned = 0;
+    }
+    g_biased_rc_thread_id = id;
+    register_thread_finalizer(finalize_biased_rc_thread, nullptr);
+    return id;
+}
+
+void enqueue_biased_rc(unsigned short owner, void * obj, biased_rc_merge_fn fn) {
+    biased_rc_thread * t = g_biased_rc_threads[owner];
+    {
+        lock_guard<mutex> lock(t->m_mutex);
+        if (!t->m_finished) {
+            t->m_queue.emplace_back(obj, fn);
+            t->m_pending = true;
+            return;
+        }
+    }
+    fn(obj);
+}
+
+void process_biased_rc_queue() {
+    unsigned short id = g_biased_rc_thread_id;
+    if (id == LEAN_BIASED_RC_NO_THREAD)
+        return;
+    biased_rc_thread * t = g_biased_rc_threads[id];
+    if (!t->m_pending.load(memory_order_relaxed))
+        return;
+    std::vector<std::pair<void *, biased_rc_merge_fn>> queue;
+    {
+        lock_guard<mutex> lock(t->m_mutex);
+        queue.swap(t->m_queue);
+        t->m_pending = false;
+    }
+    for (auto const & p : queue)
+        p.second(p.first);
+}
+
+void biased_rc::inc_biased_overflow() {
+    /* move half of the biased counter to the shared one */
+    m_shared.fetch_add(0x8000 * one, memory_order_relaxed);
+    m_biased.store(0xFFFF - 0x8000 + 1, memory_order_relaxed);
+}
+
+bool biased_rc::merge_by_owner() {
+    g_biased_rc_num_owned--;
+    /* Remark: we must set the merged bit before resetting the owner, see dec_shared. */
+    int old = m_shared.fetch_add(merged_bit, memory_order_acq_rel);
+    m_owner.store(0, memory_order_relaxed);
+    return (old & queued_bit) == 0 && count(old) == 0;
+}
+
+bool biased_rc::merge_queued() {
+    int delta = -queued_bit;
+    unsigned short o = owner();
+    if (o != 0) {
+        delta += merged_bit + one * m_biased.load(memory_order_relaxed);
+        m_biased.store(0, memory_order_relaxed);
+        m_owner.store(0, memory_order_relaxed);
+    }
+    int old = m_shared.fetch_add(delta, memory_order_acq_rel);
+    if (o != 0) {
+        if (o == g_biased_rc_thread_id) {
+            g_biased_rc_num_owned--;
+        } else if (g_biased_rc_threads[o]->m_num_owned.fetch_sub(1) == 1) {
+            /* the owner has finished, and this was the last object it owned */
+            release_biased_rc_thread_id(o);
+        }
+    }
+    return count(old + delta) == 0;
+}
+
+bool biased_rc::dec_shared(void * obj, biased_rc_merge_fn fn) {
+    /* Remark: we read the owner before updating the shared counter, the owner is reset after setting
+       the merged bit. Thus, if the merged bit is not set when we update the counter, then \c o is the owner. */
+    unsigned short o = owner();
+    int old = m_shared.load(memory_order_relaxed);
+    if (old & merged_bit) {
+        old = m_shared.fetch_sub(one, memory_order_acq_rel);
+        return (old & queued_bit) == 0 && count(old) == 1;
+    }
+    while (true) {
+        int new_val = old - one;
+        bool enqueue = false;
+        if ((old & (merged_bit | queued_bit)) == 0 && count(new_val) < 0) {
+            new_val |= queued_bit;
+            enqueue  = true;
+        }
+        if (m_shared.compare_exchange_weak(old, new_val, memory_order_acq_rel, memory_order_relaxed)) {
+            if (enqueue)
+                enqueue_biased_rc(o, obj, fn);
+            return (old & merged_bit) != 0 && (old & queued_bit) == 0 && count(new_val) == 0;
+        }
+    }
+}
+
+bool biased_rc::try_inc_ref() {
+    if (owner() == g_biased_rc_thread_id) {
+        inc_ref();
+        return true;
+    }
+    int old = m_shared.load(memory_order_relaxed);
+    do {
+        if ((old & merged_bit) != 0 && count(old) == 0)
+            return false;
+    } while (!m_shared.compare_exchange_weak(old, old + one, memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
+#endif
+}
@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <type_traits>
+#include "util/thread.h"
+#include "util/debug.h"
+#include "util/compiler_hints.h"
+#include "util/rc.h"
+
+namespace lean {
+#if defined(LEAN_MULTI_THREAD)
+/* Identifier of the current thread for biased reference counting (see biased_rc).
+   The value LEAN_BIASED_RC_NO_THREAD is used for threads that do not own objects. */
+#define LEAN_BIASED_RC_NO_THREAD 0xFFFF
+#ifdef MSVC
+extern __declspec(thread) unsigned short g_biased_rc_thread_id;
+extern __declspec(thread) long long g_biased_rc_num_owned;
+#else
+extern __thread unsigned short g_biased_rc_thread_id;
+extern __thread long long g_biased_rc_num_owned;
+#endif
+
+typedef void (*biased_rc_merge_fn)(void *); // NOLINT
+unsigned short init_biased_rc_thread_id();
+void enqueue_biased_rc(unsigned short owner, void * obj, biased_rc_merge_fn fn);
+
+/** \brief Biased reference counter.
+
+    Most objects are only used by the thread that created them. The creating thread owns the object, and
+    it updates the biased counter using non-atomic operations. The other threads update the shared counter
+    using atomic operations. The object is alive while the sum of both counters is positive.
+
+    When the biased counter becomes zero, the owner merges the counters: it marks the shared counter as merged,
+    and from then on all threads use the shared counter.
+    When another thread makes the shared counter negative, the object may be unreachable. This thread adds the
+    object to the queue of the owner, which merges the counters (see process_biased_rc_queue), or merges them
+    itself if the owner has finished. A queued object is only deallocated by the thread processing the queue.
+
+    The shared counter is stored in the bits 2-31 of \c m_shared, bit 0 is set when the counters have been merged,
+    and bit 1 is set when the object has been added to the queue of the owner. */
+class biased_rc {
+    static constexpr int merged_bit = 1;
+    static constexpr int queued_bit = 2;
+    static constexpr int one        = 4;
+    atomic<int>            m_shared;
+    atomic<unsigned short> m_owner;  // 0 after the counters have been merged
+    atomic<unsigned short> m_biased;
+
+    static int count(int v) { return v >> 2; }
+    unsigned short owner() const { return m_owner.load(memory_order_relaxed); }
+    static unsigned short current_owner() {
+        unsigned short id = g_biased_rc_thread_id;
+        return id != LEAN_BIASED_RC_NO_THREAD ? id : init_biased_rc_thread_id();
+    }
+
+    void inc_biased_overflow();
+    bool merge_by_owner();
+    bool dec_shared(void * obj, biased_rc_merge_fn fn);
+public:
+    explicit biased_rc(unsigned rc) {
+        unsigned short o = current_owner();
+        if (o != 0) {
+            g_biased_rc_num_owned++;
+            m_shared.store(0, memory_order_relaxed);
+            m_biased.store(rc, memory_order_relaxed);
+        } else {
+            m_shared.store(rc * one + merged_bit, memory_order_relaxed);
+            m_biased.store(0, memory_order_relaxed);
+        }
+        m_owner.store(o, memory_order_relaxed);
+    }
+    biased_rc(biased_rc const &) = delete;
+    biased_rc & operator=(biased_rc const &) = delete;
+
+    /** \brief Return the number of references, the result is only an approximation if the object is used by
+        other threads. */
+    unsigned get_rc() const {
+        int r = count(m_shared.load(memory_order_acquire)) + m_biased.load(memory_order_relaxed);
+        return r < 0 ? 0 : r;
+    }
+
+    void inc_ref() {
+        if (owner() == g_biased_rc_thread_id) {
+            unsigned short b = m_biased.load(memory_order_relaxed);
+            if (LEAN_LIKELY(b != 0xFFFF))
+                m_biased.store(b + 1, memory_order_relaxed);
+            else
+                inc_biased_overflow();
+        } else {
+            m_shared.fetch_add(one, memory_order_relaxed);
+        }
+    }
+
+    /** \brief Increment the reference counter only if the object is not being deallocated. */
+    bool try_inc_ref();
+
+    /** \brief Decrement the reference counter, and return true if \c obj must be deallocated.
+        \c fn merges the counters of an object added to the queue of its owner, and deallocates it if needed. */
+    bool dec_ref(void * obj, biased_rc_merge_fn fn) {
+        if (owner() == g_biased_rc_thread_id) {
+            unsigned short b = m_biased.load(memory_order_relaxed) - 1;
+            m_biased.store(b, memory_order_relaxed);
+            return b == 0 && merge_by_owner();
+        } else {
+            return dec_shared(obj, fn);
+        }
+    }
+
+    /** \brief Merge the counters of an object that was added to the queue of its owner,
+        and return true if it must be deallocated. */
+    bool merge_queued();
+};
+
+template<typename T> void biased_rc_merge(void * obj) {
+    T * o = static_cast<T *>(obj);
+    if (o->m_rc.merge_queued())
+        o->dealloc();
+}
+
+/** \brief Merge the counters of the objects that were added to the queue of the current thread by other threads.
+    It should be invoked periodically by long running threads. */
+void process_biased_rc_queue();
+
+/** \brief Biased reference counter for objects that are usually used by the thread that created them
+    (see biased_rc). It provides the same interface as MK_LEAN_RC. */
+#define MK_LEAN_BIASED_RC_CORE()                                        \
+private:                                                                \
+biased_rc m_rc;                                                         \
+template<typename T> friend void ::lean::biased_rc_merge(void * obj);   \
+public:                                                                 \
+unsigned get_rc() const { return m_rc.get_rc(); }                       \
+void inc_ref() { m_rc.inc_ref(); }                                      \
+bool try_inc_ref() { return m_rc.try_inc_ref(); }                       \
+bool dec_ref_core() {                                                   \
+    typedef std::remove_pointer<decltype(this)>::type self;             \
+    return m_rc.dec_ref(this, biased_rc_merge<self>);                   \
+}                                                                       \
+void dec_ref() { if (dec_ref_core()) { dealloc(); } }
+#else
+inline void process_biased_rc_queue() {}
+#endif
+
+/* The biased reference counter is only used when LEAN_BIASED_RC is defined, see BIASED_RC option. */
+#if defined(LEAN_MULTI_THREAD) && defined(LEAN_BIASED_RC)
+#define MK_LEAN_BIASED_RC() MK_LEAN_BIASED_RC_CORE()
+#else
+#define MK_LEAN_BIASED_RC() MK_LEAN_RC()
+#endif
+}
@@ -4,6 +4,8 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include "util/hash.h"
+
 namespace lean {
 
 void mix(unsigned & a, unsigned & b, unsigned & c) {
@@ -60,4 +62,12 @@ unsigned hash_str(unsigned length, char const * str, unsigned init_value) {
     return c;
 }
 
+uint64 hash_str64(size_t len, char const * str, uint64 init_value) {
+    uint64 h = init_value;
+    for (size_t i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(str[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
 }
@@ -14,6 +14,10 @@ void mix(unsigned & a, unsigned & b, unsigned & c);
 
 unsigned hash_str(unsigned len, char const * str, unsigned init_value);
 
+/** \brief 64-bit hash of the given bytes (FNV-1a). It is used to identify file contents,
+    e.g., to decide whether an .olean file is up to date. */
+uint64 hash_str64(size_t len, char const * str, uint64 init_value = 14695981039346656037ull);
+
 inline unsigned hash(unsigned h1, unsigned h2) {
     h2 -= h1; h2 ^= (h1 << 8);
     h1 -= h2; h2 ^= (h1 << 16);
@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include "util/interrupt.h"
 #include "util/exception.h"
 #include "util/memory.h"
+#include "util/biased_rc.h"
 
 namespace lean {
 LEAN_THREAD_VALUE(size_t, g_max_heartbeat, 0);
@@ -52,6 +53,7 @@ void check_system(char const * component_name) {
     check_memory(component_name);
     check_interrupted();
     check_heartbeat();
+    process_biased_rc_queue();
 }
 
 void sleep_for(unsigned ms, unsigned step_ms) {
@@ -100,6 +100,14 @@ optional<search_path> get_lean_path_from_env() {
     }
 }
 
+optional<std::string> get_olean_cache_from_env() {
+    if (auto r = getenv("LEAN_OLEAN_CACHE")) {
+        if (*r)
+            return optional<std::string>(normalize_path(r));
+    }
+    return optional<std::string>();
+}
+
 search_path get_builtin_search_path() {
     search_path path;
 #if !defined(LEAN_EMSCRIPTEN)
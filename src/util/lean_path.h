@@ -23,6 +23,9 @@ using search_path = std::vector<std::string>;
 optional<std::string> get_leanpkg_path_file();
 search_path parse_leanpkg_path(std::string const & fn);
 optional<search_path> get_lean_path_from_env();
+/** \brief Return the directory of the shared .olean cache given by the LEAN_OLEAN_CACHE environment variable.
+    See module_mgr::set_olean_cache. */
+optional<std::string> get_olean_cache_from_env();
 search_path get_builtin_search_path();
 
 struct standard_search_path {
@@ -119,6 +119,9 @@ log_tree::node log_tree::node::mk_child(name n, std::string const & description,
     if (auto existing = m_ptr->m_children.find(n)) {
         child = existing->clone_core();
         existing->detach_core(events);
+        /* The entries of the detached node have been moved to the clone */
+        for (auto & e : child.m_ptr->m_entries)
+            events.push_back({event::EntryAdded, child, e});
     } else {
         child = node(new node_cell);
         child.m_ptr->m_tree = m_ptr->m_tree;
@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <string>
+#include <fstream>
+#include <sstream>
+#if !defined(LEAN_WINDOWS) || defined(LEAN_CYGWIN)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "util/exception.h"
+#include "util/sstream.h"
+#include "util/mapped_file.h"
+
+namespace lean {
+static std::string read_file_contents(std::string const & fname) {
+    std::ifstream in(fname, std::ios_base::binary);
+    if (!in.good())
+        throw exception(sstream() << "failed to open file '" << fname << "'");
+    std::stringstream buf;
+    buf << in.rdbuf();
+    return buf.str();
+}
+
+mapped_file::mapped_file(std::string const & fname, std::string && contents):
+    m_fname(fname), m_contents(std::move(contents)), m_data(m_contents.data()),
+    m_size(m_contents.size()), m_mapped(false) {
+}
+
+#if !defined(LEAN_WINDOWS) || defined(LEAN_CYGWIN)
+mapped_file::mapped_file(std::string const & fname):
+    m_fname(fname), m_data(nullptr), m_size(0), m_mapped(false) {
+    int fd = open(fname.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw exception(sstream() << "failed to open file '" << fname << "'");
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw exception(sstream() << "failed to read file '" << fname << "'");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size > 0) {
+        void * addr = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            m_data   = static_cast<char const *>(addr);
+            m_mapped = true;
+        }
+    }
+    close(fd);
+    if (!m_mapped) {
+        /* mmap is not supported for this file (e.g., empty file or special file system) */
+        m_contents = read_file_contents(fname);
+        m_data     = m_contents.data();
+        m_size     = m_contents.size();
+    }
+}
+
+mapped_file::~mapped_file() {
+    if (m_mapped)
+        munmap(const_cast<char *>(m_data), m_size);
+}
+#else
+mapped_file::mapped_file(std::string const & fname):
+    mapped_file(fname, read_file_contents(fname)) {
+}
+
+mapped_file::~mapped_file() {}
+#endif
+
+memory_streambuf::memory_streambuf(char const * begin, char const * end) {
+    char * b = const_cast<char *>(begin);
+    setg(b, b, const_cast<char *>(end));
+}
+
+memory_streambuf::pos_type memory_streambuf::seekoff(off_type off, std::ios_base::seekdir dir,
+                                                     std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+    char * target;
+    if (dir == std::ios_base::beg)
+        target = eback() + off;
+    else if (dir == std::ios_base::cur)
+        target = gptr() + off;
+    else
+        target = egptr() + off;
+    if (target < eback() || target > egptr())
+        return pos_type(off_type(-1));
+    setg(eback(), target, egptr());
+    return pos_type(target - eback());
+}
+
+memory_streambuf::pos_type memory_streambuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+}
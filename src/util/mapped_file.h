@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <string>
+#include <iostream>
+
+namespace lean {
+/** \brief Read-only view of the contents of a file.
+
+    On POSIX systems the file is mapped into memory using mmap, so pages are only
+    read from disk (and only count towards the resident set) when they are touched.
+    On other platforms, or when the contents have already been read by the caller,
+    the contents are kept in an owned string. */
+class mapped_file {
+    std::string  m_fname;
+    std::string  m_contents; // used when the file is not memory mapped
+    char const * m_data;
+    size_t       m_size;
+    bool         m_mapped;
+public:
+    /** \brief Map the file \c fname into memory. Throw an exception if it cannot be read. */
+    explicit mapped_file(std::string const & fname);
+    /** \brief Take ownership of \c contents, which were read from the file \c fname. */
+    mapped_file(std::string const & fname, std::string && contents);
+    mapped_file(mapped_file const &) = delete;
+    mapped_file & operator=(mapped_file const &) = delete;
+    ~mapped_file();
+
+    std::string const & get_file_name() const { return m_fname; }
+    char const * data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool is_mapped() const { return m_mapped; }
+};
+
+/** \brief Stream buffer for reading a fixed memory region without copying it. */
+class memory_streambuf : public std::streambuf {
+public:
+    memory_streambuf(char const * begin, char const * end);
+protected:
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+};
+
+class memory_istream : public std::istream {
+    memory_streambuf m_buffer;
+public:
+    memory_istream(char const * begin, char const * end):std::istream(nullptr), m_buffer(begin, end) { rdbuf(&m_buffer); }
+};
+}
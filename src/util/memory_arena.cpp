@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "util/debug.h"
+#include "util/memory.h"
+#include "util/memory_arena.h"
+#if defined(LEAN_WINDOWS)
+#include <malloc.h>
+#endif
+
+/* The number of live objects in a block is LEAN_ARENA_OPEN_BLOCK minus the number of released objects while
+   the arena is allocating from it. */
+#define LEAN_ARENA_OPEN_BLOCK (1u << 30)
+
+namespace lean {
+struct memory_arena::block {
+    atomic<unsigned> m_live;
+};
+
+static unsigned block_header_size() {
+    return (sizeof(memory_arena::block) + 15) & ~15u; // NOLINT
+}
+
+static memory_arena::block * alloc_block() {
+    void * r;
+#if defined(LEAN_WINDOWS)
+    r = _aligned_malloc(LEAN_ARENA_BLOCK_SIZE, LEAN_ARENA_BLOCK_SIZE);
+#else
+    if (posix_memalign(&r, LEAN_ARENA_BLOCK_SIZE, LEAN_ARENA_BLOCK_SIZE) != 0)
+        r = nullptr;
+#endif
+    if (!r)
+        throw std::bad_alloc();
+    return new (r) memory_arena::block();
+}
+
+static void free_block(memory_arena::block * b) {
+    b->~block();
+    lean_report_memory_deallocated(LEAN_ARENA_BLOCK_SIZE);
+#if defined(LEAN_WINDOWS)
+    _aligned_free(b);
+#else
+    free(b);
+#endif
+}
+
+memory_arena::~memory_arena() {
+    close_block();
+}
+
+void memory_arena::close_block() {
+    if (!m_block)
+        return;
+    /* After the update, m_live is the number of live objects in the block. */
+    unsigned delta = LEAN_ARENA_OPEN_BLOCK - m_num_allocated;
+    if (m_block->m_live.fetch_sub(delta, memory_order_acq_rel) == delta)
+        free_block(m_block);
+    m_block = nullptr;
+    m_next  = nullptr;
+    m_end   = nullptr;
+}
+
+void * memory_arena::allocate_in_new_block(unsigned size) {
+    lean_assert(block_header_size() + size <= LEAN_ARENA_BLOCK_SIZE);
+    close_block();
+    block * b = alloc_block();
+    b->m_live.store(LEAN_ARENA_OPEN_BLOCK, memory_order_relaxed);
+    char * mem = reinterpret_cast<char*>(b);
+    m_block         = b;
+    m_next          = mem + block_header_size() + size;
+    m_end           = mem + LEAN_ARENA_BLOCK_SIZE;
+    m_num_allocated = 1;
+    return mem + block_header_size();
+}
+
+void memory_arena::recycle(void * ptr) {
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(ptr) & ~static_cast<std::uintptr_t>(LEAN_ARENA_BLOCK_SIZE - 1);
+    block * b = reinterpret_cast<block*>(addr);
+    if (b->m_live.fetch_sub(1, memory_order_acq_rel) == 1)
+        free_block(b);
+}
+
+LEAN_THREAD_PTR(memory_arena, g_thread_arena);
+
+static void thread_finalize_memory_arena(void * p) {
+    delete reinterpret_cast<memory_arena*>(p);
+    g_thread_arena = nullptr;
+}
+
+memory_arena & get_thread_memory_arena() {
+    if (!g_thread_arena) {
+        g_thread_arena = new memory_arena();
+        register_post_thread_finalizer(thread_finalize_memory_arena, g_thread_arena);
+    }
+    return *g_thread_arena;
+}
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2018 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+
+Author: Leonardo de Moura
+*/
+#pragma once
+#include <cstddef>
+#include "util/thread.h"
+
+#define LEAN_ARENA_BLOCK_SIZE 16384
+
+namespace lean {
+/** \brief Bump allocator for short-lived objects.
+
+    Memory is allocated from aligned blocks of LEAN_ARENA_BLOCK_SIZE bytes. The objects allocated in a block are
+    not recycled individually, the block keeps track of the number of live objects, and it is released in bulk
+    when all of them have been released and the arena has moved to a new block.
+
+    The arena is owned by a single thread, but \c recycle can be invoked by any thread. An object that outlives
+    the other objects in its block keeps the block alive. */
+class memory_arena {
+public:
+    struct block;
+private:
+    block *  m_block;
+    char *   m_next;
+    char *   m_end;
+    unsigned m_num_allocated; // number of objects allocated in m_block
+    void * allocate_in_new_block(unsigned size);
+    void close_block();
+public:
+    memory_arena():m_block(nullptr), m_next(nullptr), m_end(nullptr), m_num_allocated(0) {}
+    ~memory_arena();
+    void * allocate(unsigned size) {
+        size = (size + sizeof(void*) - 1) & ~static_cast<unsigned>(sizeof(void*) - 1);
+        if (m_end - m_next >= static_cast<std::ptrdiff_t>(size)) {
+            void * r = m_next;
+            m_next += size;
+            m_num_allocated++;
+            return r;
+        }
+        return allocate_in_new_block(size);
+    }
+    /** \brief Release an object allocated by a memory_arena. */
+    static void recycle(void * ptr);
+};
+
+memory_arena & get_thread_memory_arena();
+}
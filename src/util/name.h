@@ -10,7 +10,7 @@ Author: Leonardo de Moura
 #include <functional>
 #include <algorithm>
 #include <utility>
-#include "util/rc.h"
+#include "util/biased_rc.h"
 #include "util/pair.h"
 #include "util/serializer.h"
 #include "util/optional.h"
@@ -41,7 +41,7 @@ class name {
 public:
     /** \brief Actual implementation of hierarchical names. */
     struct imp {
-        MK_LEAN_RC()
+        MK_LEAN_BIASED_RC()
         bool     m_is_string;
         unsigned m_hash;
         imp *    m_prefix;
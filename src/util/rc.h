@@ -16,6 +16,15 @@ atomic<unsigned> m_rc;                                                  \
 public:                                                                 \
 unsigned get_rc() const { return atomic_load_explicit(&m_rc, memory_order_acquire); } \
 void inc_ref() { atomic_fetch_add_explicit(&m_rc, 1u, memory_order_relaxed); } \
+/* Increment the reference counter only if it is not zero. */           \
+bool try_inc_ref() {                                                    \
+    unsigned rc = get_rc();                                             \
+    while (rc != 0) {                                                   \
+        if (m_rc.compare_exchange_strong(rc, rc + 1))                   \
+            return true;                                                \
+    }                                                                   \
+    return false;                                                       \
+}                                                                       \
 bool dec_ref_core() {                                                   \
     lean_assert(get_rc() > 0);                                          \
     if (atomic_fetch_sub_explicit(&m_rc, 1u, memory_order_acq_rel) == 1u) { \
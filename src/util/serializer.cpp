@@ -113,4 +113,11 @@ std::string deserializer_core::read_blob() {
     m_in.read(&s[0], sz);
     return s;
 }
+
+pair<std::streamoff, unsigned> deserializer_core::skip_blob() {
+    unsigned sz = read_unsigned();
+    std::streamoff pos = m_in.tellg();
+    m_in.seekg(sz, std::ios_base::cur);
+    return mk_pair(pos, sz);
+}
 }
@@ -72,6 +72,9 @@ public:
     bool read_bool() { return m_in.get() != 0; }
     double read_double();
     std::string read_blob();
+    /** \brief Skip a blob written by serializer_core::write_blob without copying it.
+        Return the stream position where the contents of the blob start, and its size. */
+    pair<std::streamoff, unsigned> skip_blob();
     optional<std::string> get_fname() const { return m_fname; }
 };
 
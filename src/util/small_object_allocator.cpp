@@ -19,6 +19,7 @@ small_object_allocator::small_object_allocator(char const * id) {
     }
     m_id         = id;
     m_alloc_size = 0;
+    m_num_allocs = 0;
 }
 
 small_object_allocator::~small_object_allocator() {
@@ -80,6 +81,7 @@ void small_object_allocator::deallocate(size_t size, void * p) {
 void * small_object_allocator::allocate(size_t size) {
     if (size == 0) return 0;
     inc_heartbeat();
+    m_num_allocs++;
 #if LEAN_DEBUG || defined(LEAN_NO_CUSTOM_ALLOCATORS)
     // Valgrind friendly
     return new char[size];
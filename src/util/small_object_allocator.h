@@ -23,6 +23,7 @@ class small_object_allocator {
     chunk *      m_chunks[NUM_SLOTS];
     void  *      m_free_list[NUM_SLOTS];
     size_t       m_alloc_size;
+    size_t       m_num_allocs;
     char const * m_id;
 public:
     small_object_allocator(char const * id = "unknown");
@@ -31,6 +32,8 @@ public:
     void * allocate(size_t size);
     void deallocate(size_t size, void * p);
     size_t get_allocation_size() const { return m_alloc_size; }
+    /** \brief Return the number of invocations of \c allocate. */
+    size_t get_num_allocations() const { return m_num_allocs; }
     size_t get_wasted_size() const;
     size_t get_num_free_objs() const;
     void consolidate();
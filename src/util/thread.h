@@ -89,7 +89,9 @@ public:
     atomic & operator=(atomic && v) { m_value = std::forward<T>(v.m_value); return *this; }
     operator T() const { return m_value; }
     void store(T const & v) { m_value = v; }
+    void store(T const & v, int ) { m_value = v; }
     T load() const { return m_value; }
+    T load(int ) const { return m_value; }
     atomic & operator|=(T const & v) { m_value |= v; return *this; }
     atomic & operator+=(T const & v) { m_value += v; return *this; }
     atomic & operator-=(T const & v) { m_value -= v; return *this; }
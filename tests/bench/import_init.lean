@@ -0,0 +1 @@
+-- Only imports the init library.
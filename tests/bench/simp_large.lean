@@ -0,0 +1,31 @@
+-- Simplification of large goals.
+open tactic
+
+example (a b c d e : ℕ) :
+  (a + 0) * 1 + (b + 0) * 1 + (c + 0) * 1 + (d + 0) * 1 + (e + 0) * 1 +
+  (a + 0) * 1 + (b + 0) * 1 + (c + 0) * 1 + (d + 0) * 1 + (e + 0) * 1 +
+  (a + 0) * 1 + (b + 0) * 1 + (c + 0) * 1 + (d + 0) * 1 + (e + 0) * 1 +
+  (a + 0) * 1 + (b + 0) * 1 + (c + 0) * 1 + (d + 0) * 1 + (e + 0) * 1 =
+  a + b + c + d + e + a + b + c + d + e + a + b + c + d + e + a + b + c + d + e :=
+by simp
+
+example (a b c d e f g h : ℕ) :
+  a + b + c + d + e + f + g + h + a + b + c + d + e + f + g + h + a + b + c + d + e + f + g + h =
+  h + g + f + e + d + c + b + a + h + g + f + e + d + c + b + a + h + g + f + e + d + c + b + a :=
+by simp [add_comm, add_left_comm, add_assoc]
+
+example (a b c d e f g h : ℕ) :
+  a * b * c * d * e * f * g * h * (a * b * c * d * e * f * g * h) =
+  h * g * f * e * d * c * b * a * (h * g * f * e * d * c * b * a) :=
+by simp [mul_comm, mul_left_comm, mul_assoc]
+
+example (p q r s : Prop) (hp : p) (hq : q) :
+  (p ∧ true) ∧ (q ∨ false) ∧ (true → p) ∧ (p ∧ q ∧ true ∧ p ∧ q) ∧
+  (r ∨ p) ∧ (s ∨ q) ∧ (p ∨ r ∨ s) ∧ (q ∨ s ∨ r) ∧ ¬ ¬ p ∧ ¬ ¬ q ∧
+  (p ↔ p) ∧ (q ↔ q) ∧ (r ↔ r) ∧ (s ↔ s) ∧ (p ∧ q ↔ q ∧ p) :=
+by simp [hp, hq, and_comm]
+
+example (l₁ l₂ l₃ : list ℕ) :
+  list.length (l₁ ++ [] ++ l₂ ++ [] ++ l₃ ++ [] ++ l₁ ++ l₂ ++ l₃) =
+  list.length l₁ + list.length l₂ + list.length l₃ + list.length l₁ + list.length l₂ + list.length l₃ :=
+by simp
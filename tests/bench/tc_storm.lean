@@ -0,0 +1,19 @@
+-- Type class resolution storm: many goals requiring deep instance chains.
+example : decidable_eq (list (option (ℕ × bool × list ℕ))) := by apply_instance
+example : decidable_eq (option (list (ℕ × list (option bool)))) := by apply_instance
+example : decidable_eq (list (list (list (option (ℕ × ℕ))))) := by apply_instance
+example : decidable_eq (ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool) := by apply_instance
+example : decidable_eq (list (ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool)) := by apply_instance
+example : decidable_eq (option (option (option (option (option (option (list ℕ))))))) := by apply_instance
+example : inhabited (list (option (ℕ × bool × list ℕ))) := by apply_instance
+example : inhabited (ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool) := by apply_instance
+example : has_sizeof (list (option (ℕ × bool × list ℕ))) := by apply_instance
+example : has_sizeof (ℕ × list (option (ℕ × bool × list (ℕ × ℕ)))) := by apply_instance
+example : has_to_string (list (option (ℕ × bool × list ℕ))) := by apply_instance
+example : has_to_string (ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool × ℕ × bool) := by apply_instance
+example (a b c d : ℕ) : decidable (a < b ∧ b ≤ c ∨ c ≠ d ∧ ¬ (a = d) ∨ a + b ≤ c * d) := by apply_instance
+example (a b c d : ℤ) : decidable (a < b ∧ b ≤ c ∨ c ≠ d ∧ ¬ (a = d) ∨ a + b ≤ c * d) := by apply_instance
+example (p q r s : Prop) [decidable p] [decidable q] [decidable r] [decidable s] :
+  decidable ((p → q) ∧ (q ↔ r) ∨ ¬ s ∧ (r → p ∨ q) ∧ (s ↔ p ∧ q ∧ r)) := by apply_instance
+example : decidable_eq (list (ℤ × option (list (ℤ × ℕ)) × bool)) := by apply_instance
+example : decidable_eq (list (char × string × option (list (char × ℕ)))) := by apply_instance
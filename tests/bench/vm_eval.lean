@@ -0,0 +1,31 @@
+-- VM execution: meta programs evaluated with #eval, no elaboration in the loop.
+meta def fib : ℕ → ℕ
+| 0     := 1
+| 1     := 1
+| (n+2) := fib n + fib (n+1)
+
+meta def sum_list : list ℕ → ℕ → ℕ
+| []      acc := acc
+| (h::t)  acc := sum_list t (acc + h)
+
+meta def build : ℕ → list ℕ → list ℕ
+| 0     l := l
+| (n+1) l := build n ((n * 7) % 13 :: l)
+
+meta def insert_sorted (a : ℕ) : list ℕ → list ℕ
+| []      := [a]
+| (h::t)  := if a ≤ h then a :: h :: t else h :: insert_sorted t
+
+meta def isort : list ℕ → list ℕ
+| []     := []
+| (h::t) := insert_sorted h (isort t)
+
+meta def count_true : list bool → ℕ → ℕ
+| []          n := n
+| (tt :: bs)  n := count_true bs (n+1)
+| (ff :: bs)  n := count_true bs n
+
+#eval fib 27
+#eval sum_list (build 1000000 []) 0
+#eval (isort (build 3000 [])).length
+#eval count_true ((build 1000000 []).map (λ n, n % 3 = 0)) 0
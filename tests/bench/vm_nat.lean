@@ -0,0 +1,32 @@
+-- VM arithmetic: loops dominated by nat operations and comparisons, evaluated with #eval.
+meta def collatz_len : ℕ → ℕ → ℕ
+| n acc := if n ≤ 1 then acc else if n % 2 = 0 then collatz_len (n / 2) (acc+1) else collatz_len (3*n + 1) (acc+1)
+
+meta def collatz_max : ℕ → ℕ → ℕ → ℕ
+| 0     best_n best := best_n
+| (i+1) best_n best :=
+  let l := collatz_len (i+1) 0 in
+  if best < l then collatz_max i (i+1) l else collatz_max i best_n best
+
+meta def gcd_sum : ℕ → ℕ → ℕ
+| 0     acc := acc
+| (i+1) acc := gcd_sum i (acc + nat.gcd (i * 7919) 104729)
+
+meta def mod_pow : ℕ → ℕ → ℕ → ℕ → ℕ
+| b 0     m acc := acc
+| b (e+1) m acc := mod_pow b e m ((acc * b) % m)
+
+meta def lcg_sum : ℕ → ℕ → ℕ → ℕ
+| 0     x acc := acc
+| (i+1) x acc := let x' := (x * 1103515245 + 12345) % 2147483648 in lcg_sum i x' (acc + x' / 65536)
+
+/- Results exceed the small nat range, exercises the GMP fallback. -/
+meta def fact : ℕ → ℕ
+| 0     := 1
+| (n+1) := (n+1) * fact n
+
+#eval collatz_max 30000 0 0
+#eval gcd_sum 100000 0
+#eval mod_pow 3 1000000 1000000007 1
+#eval lcg_sum 500000 42 0
+#eval (fact 2000) % 1000000007
@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+# Check that `lean --make` stores the solutions of type class problems next to the .olean file, and reuses them
+if [ $# -ne 1 ]; then
+    echo "Usage: instance_cache.sh [lean-executable-path]"
+    exit 1
+fi
+LEAN=$(readlink -f "$1")
+export LEAN_PATH=$(readlink -f ../../../library):.
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+cat > icache.lean <<'LEAN'
+set_option trace.class_instances true
+example : decidable_eq (list (ℕ × ℤ)) := by apply_instance
+LEAN
+if ! "$LEAN" --make icache.lean > out1.txt 2>&1; then
+    echo "failed to execute lean --make"
+    exit 1
+fi
+if [ ! -s icache.icache ]; then
+    echo "instance cache file was not created"
+    exit 1
+fi
+if grep -q "persistent cached instance" out1.txt; then
+    echo "unexpected persistent cache hit"
+    exit 1
+fi
+rm icache.olean
+if ! "$LEAN" --make icache.lean > out2.txt 2>&1; then
+    echo "failed to execute lean --make"
+    exit 1
+fi
+if ! grep -q "persistent cached instance for decidable_eq (list (ℕ × ℤ))" out2.txt; then
+    echo "the instance cache was not used"
+    exit 1
+fi
+# corrupted cache files are ignored
+echo "garbage" > icache.icache
+rm icache.olean
+if ! "$LEAN" --make icache.lean > out3.txt 2>&1 || grep -q "persistent cached instance" out3.txt; then
+    echo "corrupted instance cache file was not ignored"
+    exit 1
+fi
+echo "-- checked"
@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+# Check that `lean --make` does not rebuild the modules importing a module when only its proofs change
+if [ $# -ne 1 ]; then
+    echo "Usage: interface_hash.sh [lean-executable-path]"
+    exit 1
+fi
+LEAN=$(readlink -f "$1")
+export LEAN_PATH=$(readlink -f ../../../library):.
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+cd "$DIR"
+cat > a.lean <<'LEAN'
+theorem a_thm : 1 + 1 = 2 := by refl
+run_cmd tactic.trace "elaborating a"
+LEAN
+cat > b.lean <<'LEAN'
+import .a
+example : 1 + 1 = 2 := a_thm
+run_cmd tactic.trace "elaborating b"
+LEAN
+make() {
+    if ! "$LEAN" --make . > "$1" 2>&1; then
+        echo "failed to execute lean --make"
+        cat "$1"
+        exit 1
+    fi
+}
+make out1.txt
+if ! grep -q "elaborating a" out1.txt || ! grep -q "elaborating b" out1.txt; then
+    echo "modules were not elaborated"
+    exit 1
+fi
+# changing a proof does not change the interface of the module
+sed -i 's/:= by refl/:= by simp/' a.lean
+make out2.txt
+if ! grep -q "elaborating a" out2.txt || grep -q "elaborating b" out2.txt; then
+    echo "only the modified module should be rebuilt after changing a proof"
+    exit 1
+fi
+# adding a declaration does
+echo "def a_def := 1" >> a.lean
+make out3.txt
+if ! grep -q "elaborating a" out3.txt || ! grep -q "elaborating b" out3.txt; then
+    echo "importing module was not rebuilt after changing the interface"
+    exit 1
+fi
+echo "-- checked"
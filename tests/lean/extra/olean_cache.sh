@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+# Check that `lean --make` decides whether .olean files are up to date using the contents of the files,
+# and that it reuses the .olean files stored in the shared cache given by LEAN_OLEAN_CACHE
+if [ $# -ne 1 ]; then
+    echo "Usage: olean_cache.sh [lean-executable-path]"
+    exit 1
+fi
+LEAN=$(readlink -f "$1")
+export LEAN_PATH=$(readlink -f ../../../library):.
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+export LEAN_OLEAN_CACHE="$DIR/cache"
+mkdir "$DIR/cache" "$DIR/p1" "$DIR/p2"
+cat > "$DIR/p1/a.lean" <<'LEAN'
+def a := 1
+run_cmd tactic.trace "elaborating a"
+LEAN
+cat > "$DIR/p1/b.lean" <<'LEAN'
+import .a
+def b := a + 1
+run_cmd tactic.trace "elaborating b"
+LEAN
+make() {
+    if ! (cd "$DIR/$1" && "$LEAN" --make . > "$DIR/$2" 2>&1); then
+        echo "failed to execute lean --make"
+        cat "$DIR/$2"
+        exit 1
+    fi
+}
+make p1 out1.txt
+if ! grep -q "elaborating a" "$DIR/out1.txt" || ! grep -q "elaborating b" "$DIR/out1.txt"; then
+    echo "modules were not elaborated"
+    exit 1
+fi
+if [ "$(ls "$DIR/cache" | grep -c '\.olean$')" -ne 2 ]; then
+    echo ".olean files were not stored in the cache"
+    exit 1
+fi
+# changing the modification time does not invalidate the .olean files
+touch "$DIR/p1/a.lean" "$DIR/p1/b.lean"
+make p1 out2.txt
+if grep -q "elaborating" "$DIR/out2.txt"; then
+    echo "unexpected rebuild after touching the files"
+    exit 1
+fi
+# a fresh copy of the sources uses the .olean files from the cache
+cp "$DIR/p1/a.lean" "$DIR/p1/b.lean" "$DIR/p2"
+make p2 out3.txt
+if grep -q "elaborating" "$DIR/out3.txt" || [ ! -f "$DIR/p2/a.olean" ] || [ ! -f "$DIR/p2/b.olean" ]; then
+    echo "the cache was not used"
+    exit 1
+fi
+# modified modules and, when their interface changes, their dependents are rebuilt
+echo "def a2 := 2" >> "$DIR/p2/a.lean"
+make p2 out4.txt
+if ! grep -q "elaborating a" "$DIR/out4.txt" || ! grep -q "elaborating b" "$DIR/out4.txt"; then
+    echo "modified module was not rebuilt"
+    exit 1
+fi
+# and restoring the original contents restores the original .olean files
+cp "$DIR/p1/a.lean" "$DIR/p2"
+make p2 out5.txt
+if grep -q "elaborating" "$DIR/out5.txt"; then
+    echo "the cache was not used after restoring the sources"
+    exit 1
+fi
+echo "-- checked"
@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+# Run the VM profiler on several files in parallel, and check the collapsed stack output
+if [ $# -ne 1 ]; then
+    echo "Usage: profiler.sh [lean-executable-path]"
+    exit 1
+fi
+LEAN=$1
+export LEAN_PATH=../../../library:.
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+if ! "$LEAN" -j2 -D profiler=true -D profiler.freq=1 -D profiler.output="$OUT" \
+     ../run/cc1.lean ../run/smt_ematch2.lean ../run/comp_val1.lean > /dev/null; then
+    echo "failed to execute lean with the profiler"
+    exit 1
+fi
+if [ ! -s "$OUT" ]; then
+    echo "profiler output is empty"
+    exit 1
+fi
+if grep -v -E '^[^ ].* [0-9]+$' "$OUT"; then
+    echo "invalid line(s) in the profiler output"
+    exit 1
+fi
+if ! grep -q "tactic" "$OUT"; then
+    echo "tactic frames are missing in the profiler output"
+    exit 1
+fi
+echo "-- checked"
@@ -0,0 +1,30 @@
+-- The VM implements nat.add, nat.sub, ..., nat.decidable_le using dedicated instructions.
+-- Check the boundary between small numbers and GMP numbers (2^31).
+meta def big : ℕ := 2147483647
+
+open tactic
+
+run_cmd guard (big + 1 = 2147483648)
+run_cmd guard (big + big = 4294967294)
+run_cmd guard ((big + 1) - 1 = big)
+run_cmd guard (big - (big + 1) = 0)
+run_cmd guard (5 - 7 = 0)
+run_cmd guard (65536 * 32768 = 2147483648)
+run_cmd guard (65536 * 32767 = 2147418112)
+run_cmd guard (big * big = 4611686014132420609)
+run_cmd guard (big * big / big = big)
+run_cmd guard (4611686014132420609 % big = 0)
+run_cmd guard (7 / 0 = 0)
+run_cmd guard (7 % 0 = 7)
+run_cmd guard ((big + 10) % 0 = big + 10)
+run_cmd guard (big + 1 ≠ big)
+run_cmd guard (big < big + 1)
+run_cmd guard (big + 1 ≤ big + 1)
+run_cmd guard (¬ (big + 2 ≤ big + 1))
+run_cmd guard (3 < 4 ∧ 4 ≤ 4 ∧ ¬ 5 < 5)
+
+meta def sum_to : ℕ → ℕ → ℕ
+| 0     acc := acc
+| (n+1) acc := sum_to n (acc + (n+1) * 1000)
+
+run_cmd guard (sum_to 100000 0 = 5000050000000)